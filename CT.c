@@ -4,8 +4,16 @@
 #include <stdarg.h>
 #include <string.h>
 #include <ctype.h>
+#include <limits.h>
+#include <math.h>
+#include <setjmp.h>
+#include <stdint.h>
+#include <pthread.h>
+#include <time.h>
 #include <fcntl.h>
 #include <sys/stat.h>
+#include <sys/mman.h>
+#include <sys/wait.h>
 #include <unistd.h>
 
 enum
@@ -14,29 +22,491 @@ enum
     LPAR,RPAR,LBRACKET,RBRACKET,LACC,RACC,ADD,SUB,MUL,DIV,
     DOT,AND,OR,NOT,ASSIGN,EQUAL,NOTEQ,LESS,LESSEQ,GREATER,GREATEREQ,
     END,STRUCT,WHILE,IF,VOID,ELSE,FOR,
-    BREAK,RETURN,DOUBLE,INT
+    BREAK,RETURN,DOUBLE,INT,CHAR
 };
 
-int line = 1;
-int crtDepth = 0;
+// The tokens are kept as a structure of arrays (13 bytes per token), so that
+// the parser, which mostly tests codes, reads only the dense array of codes.
+// The line of a token is not stored; it is found from its offset in lines.
+typedef struct
+{
+    unsigned char *code;   // Code (name) of each token
+    unsigned int *offset;  // Offset of the first character in the input
+    unsigned int *length;  // Number of input characters
+    unsigned int *aux;     // Index in names for ID, CT_STRING, in literals for CT_INT, CT_REAL, CT_CHAR, else 0
+    int n;                 // number of tokens
+    int capacity;          // number of tokens which fit in the allocated space
+    int first;             // index of the token in code[0]; not 0 only in streaming mode
+} Tokens;
+
+// The value of a literal token
+typedef union
+{
+    long int i; // Used for CT_INT, CT_CHAR
+    double r;   // Used for CT_REAL
+} Literal;
+
+// Each distinct identifier or string is stored only once in names and it is
+// referred by its index, so equal names have equal indexes and text pointers.
+typedef struct
+{
+    const char *text;    // NUL terminated
+    unsigned int length;
+    unsigned int hash;
+} Name;
+
+// The value of the number being analyzed, accumulated by the lexer states
+// while they walk its digits, so that it is not scanned again by strtol or strtod
+typedef struct
+{
+    unsigned long value;    // the value of an integer, in its base
+    int overflow;           // value does not fit in a long
+    unsigned long mantissa; // the first 19 significant digits of a real
+    int digits;             // the number of digits in mantissa
+    int exponent;           // the power of 10 of the last digit in mantissa
+    int truncated;          // some nonzero digits did not fit in mantissa
+    int expSign;            // the exponent written after e or E
+    int expValue;
+} LexNumber;
+
+// A node of the syntax tree. The nodes are kept in one array and refer to each
+// other by index, with 0 for "none", so the tree is freed at once with the array.
+// A node is added after its children and before the nodes which follow it in a
+// list, so a pass which needs the children first is a scan of the array.
+// The children are in a, b and c by kind; a child which is a list (the
+// declarations of a unit, the statements of a block, the arguments of a call...)
+// is its first node and the others follow by next.
+typedef struct
+{
+    unsigned char kind;   // N_*
+    unsigned char op;     // the token code of an operator, constant or base type
+    unsigned short flags; // F_*
+    unsigned int tk;      // the token of the node, which gives its name, value and line
+    unsigned int a, b, c;
+    unsigned int next;    // the next node of the list which contains this node
+} Node;
+
+enum
+{
+    N_NONE,
+    N_UNIT,   // a: declarations
+    N_STRUCT, // tk: name, a: members
+    N_VAR,    // tk: name, a: type
+    N_FUNC,   // tk: name, a: type of the result, b: parameters, c: body
+    N_PARAM,  // tk: name, a: type
+    N_TYPE,   // op: INT, DOUBLE, CHAR, STRUCT (name at tk + 1) or VOID, a: array size
+    N_BLOCK,  // a: variables and statements
+    N_IF,     // a: condition, b: then, c: else
+    N_WHILE,  // a: condition, b: body
+    N_FOR,    // a: initialization, condition and step, in a list, b: body
+    N_BREAK,
+    N_RETURN, // a: value
+    N_EMPTY,  // an empty statement or a missing expression of for
+    N_ASSIGN, // a: destination, b: value
+    N_BINARY, // op: operator, a, b: operands
+    N_UNARY,  // op: SUB or NOT, a: operand
+    N_CAST,   // a: type, b: value
+    N_INDEX,  // a: array, b: index
+    N_MEMBER, // tk: name of the member, a: struct
+    N_CALL,   // tk: name of the function, a: arguments
+    N_ID,     // tk: name
+    N_CONST   // op: CT_INT, CT_REAL, CT_CHAR or CT_STRING, tk: the literal
+};
+
+enum
+{
+    F_ARRAY = 1,  // N_TYPE of an array
+    F_POINTER = 2, // N_TYPE of the result of a function declared with MUL
+    F_ASSIGN = 4   // an expression which contains an assignment, for the register machine
+};
+
+typedef struct _Symbol Symbol;
+typedef struct _Type Type;
+
+// The symbol declared or used by an N_STRUCT, N_VAR, N_FUNC, N_PARAM, N_ID,
+// N_CALL or N_MEMBER node, or the type of another expression node. The type
+// of the first ones is the type of their symbol.
+typedef union
+{
+    Type *type;
+    Symbol *symbol;
+} NodeInfo;
+
+// The instructions of the virtual machine, with the kind of their operand and
+// the number of values they push on the stack, negative for the ones they pop.
+// The machine has a stack of values for the operands and the results, and a
+// stack of frames for the variables of the functions being run. A value is an
+// int (also used for char), a double or an address; a struct or an array is
+// handled by its address. The suffix of an instruction gives the type of its
+// operands: I for int, D for double and C for char.
+#define OPCODES(X)                                                             \
+    X(HALT, A_NONE, 0)                                                         \
+    X(PUSH_I, A_INT, 1)     /* pushes the operand */                           \
+    X(PUSH_D, A_REAL, 1)                                                       \
+    X(PUSH_A, A_ADDR, 1)                                                       \
+    X(ADDR_L, A_INT, 1)     /* pushes the address of a local at the offset */  \
+    X(DROP, A_NONE, -1)                                                        \
+    X(LOAD_I, A_NONE, 0)    /* replaces an address by the value at it */       \
+    X(LOAD_D, A_NONE, 0)                                                       \
+    X(LOAD_C, A_NONE, 0)                                                       \
+    X(STORE_I, A_NONE, -1)  /* address, value: stores the value, leaves it */  \
+    X(STORE_D, A_NONE, -1)                                                     \
+    X(STORE_C, A_NONE, -1)                                                     \
+    X(COPY, A_INT, -1)      /* dst, src: copies a struct and leaves dst */     \
+    X(POP_L, A_INT, -1)     /* pops an argument into a local at the offset */  \
+    X(POP_L_C, A_INT, -1)                                                      \
+    X(POP_L_S, A_PAIR, -1)  /* pops the address of a struct and copies it */   \
+    X(ADD_I, A_NONE, -1)    /* the D variants follow the I ones */             \
+    X(ADD_D, A_NONE, -1)                                                       \
+    X(SUB_I, A_NONE, -1)                                                       \
+    X(SUB_D, A_NONE, -1)                                                       \
+    X(MUL_I, A_NONE, -1)                                                       \
+    X(MUL_D, A_NONE, -1)                                                       \
+    X(DIV_I, A_NONE, -1)                                                       \
+    X(DIV_D, A_NONE, -1)                                                       \
+    X(EQ_I, A_NONE, -1)     /* the comparisons push 1 or 0 */                  \
+    X(EQ_D, A_NONE, -1)                                                        \
+    X(NE_I, A_NONE, -1)                                                        \
+    X(NE_D, A_NONE, -1)                                                        \
+    X(LT_I, A_NONE, -1)                                                        \
+    X(LT_D, A_NONE, -1)                                                        \
+    X(LE_I, A_NONE, -1)                                                        \
+    X(LE_D, A_NONE, -1)                                                        \
+    X(GT_I, A_NONE, -1)                                                        \
+    X(GT_D, A_NONE, -1)                                                        \
+    X(GE_I, A_NONE, -1)                                                        \
+    X(GE_D, A_NONE, -1)                                                        \
+    X(NEG_I, A_NONE, 0)                                                        \
+    X(NEG_D, A_NONE, 0)                                                        \
+    X(NOT_I, A_NONE, 0)                                                        \
+    X(NOT_D, A_NONE, 0)                                                        \
+    X(I2D, A_NONE, 0)       /* conversions */                                  \
+    X(D2I, A_NONE, 0)                                                          \
+    X(I2C, A_NONE, 0)                                                          \
+    X(INDEX, A_INT, -1)     /* address, index: the address of the element */   \
+    X(OFFSET, A_INT, 0)     /* adds the offset of a member to an address */    \
+    X(JMP, A_TARGET, 0)                                                        \
+    X(JF_I, A_TARGET, -1)   /* pops a value and jumps if it is false */        \
+    X(JF_D, A_TARGET, -1)                                                      \
+    X(JT_I, A_TARGET, -1)   /* pops a value and jumps if it is true */         \
+    X(JT_D, A_TARGET, -1)                                                      \
+    X(CALL, A_TARGET, 0)    /* pops the arguments and pushes the result */     \
+    X(ENTER, A_PAIR, 0)     /* a frame of n[0] bytes, stack depth n[1] */      \
+    X(RET, A_NONE, 0)       /* the result is left on the stack */              \
+    X(FALLOFF, A_FUNC, 0)   /* the end of a function which returns a value */  \
+    X(LOAD_L, A_INT, 1)     /* superinstructions, made by fuseCode: */         \
+    X(LOAD_L_C, A_INT, 1)   /* pushes the local at the offset */               \
+    X(SET_L, A_PAIR, 0)     /* stores the int n[1] in the local n[0] */        \
+    X(ADD_I_K, A_INT, 0)    /* adds the operand to the int on the stack */     \
+    X(INC_L, A_PAIR, 0)     /* adds n[1] to the int local n[0] */              \
+    X(ADDTO_L, A_INT, -1)   /* pops an int and adds it to the local */         \
+    X(ELEM_L, A_PAIR, 1)    /* the address of the element of 8 bytes of */     \
+    X(ELEM_A, A_PAIR, 1)    /* the array n[0] at the index in local n[1] */    \
+    X(LOAD_ELEM_L, A_PAIR, 1) /* the value of this element; in the A */        \
+    X(LOAD_ELEM_A, A_PAIR, 1) /* variants, the local n[0] is an address */     \
+    X(STOREP, A_NONE, -2)   /* a store of 8 bytes whose value is dropped */    \
+    X(STOREP_C, A_NONE, -2)                                                    \
+    X(JEQ_I, A_TARGET, -2)  /* pops two ints, jumps if the comparison holds */ \
+    X(JNE_I, A_TARGET, -2)                                                     \
+    X(JLT_I, A_TARGET, -2)                                                     \
+    X(JLE_I, A_TARGET, -2)                                                     \
+    X(JGT_I, A_TARGET, -2)                                                     \
+    X(JGE_I, A_TARGET, -2)                                                     \
+    X(JEQ_I_K, A_KTARGET, -1) /* pops an int and compares it with n[0] */      \
+    X(JNE_I_K, A_KTARGET, -1) /* the target is n[1] */                         \
+    X(JLT_I_K, A_KTARGET, -1)                                                  \
+    X(JLE_I_K, A_KTARGET, -1)                                                  \
+    X(JGT_I_K, A_KTARGET, -1)                                                  \
+    X(JGE_I_K, A_KTARGET, -1)                                                  \
+    X(PUT_S, A_NONE, -1)    /* the functions of the runtime */                 \
+    X(GET_S, A_NONE, -1)                                                       \
+    X(PUT_I, A_NONE, -1)                                                       \
+    X(GET_I, A_NONE, 1)                                                        \
+    X(PUT_D, A_NONE, -1)                                                       \
+    X(GET_D, A_NONE, 1)                                                        \
+    X(PUT_C, A_NONE, -1)                                                       \
+    X(GET_C, A_NONE, 1)                                                        \
+    X(SECONDS, A_NONE, 1)
+
+enum { A_NONE, A_INT, A_REAL, A_ADDR, A_TARGET, A_PAIR, A_KTARGET, A_FUNC };
+
+#define OP_ENUM(name, arg, stack) OP_##name,
+enum { OPCODES(OP_ENUM) N_OPCODES };
+
+typedef union
+{
+    long i;
+    double d;
+    char *p;
+} Value;
+
+// An instruction. Before it runs, the code is threaded: op is replaced by the
+// address of the code of the instruction in the interpreter.
+typedef struct
+{
+    union
+    {
+        int op;
+        const void *label;
+    };
+    union
+    {
+        long i;     // A_INT; the index of the instruction for A_TARGET
+        double d;   // A_REAL
+        char *p;    // A_ADDR
+        int n[2];   // A_PAIR: the offset and the size, or the two sizes of ENTER; A_KTARGET: the constant and the target
+        Symbol *s;  // A_FUNC
+    };
+} Instr;
+
+// The instructions of the register machine, selected with -vm reg. The
+// locals and the temporary values of a function are registers: slots of 8
+// bytes at offsets in its frame, on which the instructions operate directly.
+// The format gives the operands in order: r is a register, k an int constant
+// and t the index of an instruction, in a, b and c; i, d, p and s are a long,
+// a double, an address and a symbol, in the second union of RInstr. The
+// operators ADD_I..GE_D and the functions of the runtime are in the same
+// order as in OPCODES.
+#define ROPCODES(X)                                                            \
+    X(HALT, "")                                                                \
+    X(MOV, "rr")        /* a = b */                                            \
+    X(LI, "ri")         /* a = the constant */                                 \
+    X(LI_D, "rd")                                                              \
+    X(LI_A, "rp")                                                              \
+    X(LADDR, "rk")      /* a = the address of the frame at the offset b */     \
+    X(GLD8, "rp")       /* a = the global at p; C: a char */                   \
+    X(GLDC, "rp")                                                              \
+    X(GST8, "rp")       /* the global at p = a */                              \
+    X(GSTC, "rp")                                                              \
+    X(LD8, "rrk")       /* a = the value at the address b + c */               \
+    X(LDC, "rrk")                                                              \
+    X(ST8, "rrk")       /* the value at the address a + c = b */               \
+    X(STC, "rrk")                                                              \
+    X(LDLC, "rk")       /* a = the char of the frame at the offset b */        \
+    X(STLC, "kr")       /* the char of the frame at the offset a = b */        \
+    X(LDX8, "rrr")      /* a = b[c], with b the address of an array */         \
+    X(LDXC, "rrr")                                                             \
+    X(STX8, "rrr")      /* a[b] = c */                                         \
+    X(STXC, "rrr")                                                             \
+    X(LDXL8, "rkr")     /* a = b[c], with b the offset of a local array */     \
+    X(LDXLC, "rkr")                                                            \
+    X(STXL8, "krr")     /* a[b] = c, with a the offset of a local array */     \
+    X(STXLC, "krr")                                                            \
+    X(COPY, "rrk")      /* copies c bytes from the address b to a */           \
+    X(COPY_L, "krk")    /* the same, to the frame at the offset a */           \
+    X(ADD_I, "rrr")     /* a = b op c */                                       \
+    X(ADD_D, "rrr")                                                            \
+    X(SUB_I, "rrr")                                                            \
+    X(SUB_D, "rrr")                                                            \
+    X(MUL_I, "rrr")                                                            \
+    X(MUL_D, "rrr")                                                            \
+    X(DIV_I, "rrr")                                                            \
+    X(DIV_D, "rrr")                                                            \
+    X(EQ_I, "rrr")                                                             \
+    X(EQ_D, "rrr")                                                             \
+    X(NE_I, "rrr")                                                             \
+    X(NE_D, "rrr")                                                             \
+    X(LT_I, "rrr")                                                             \
+    X(LT_D, "rrr")                                                             \
+    X(LE_I, "rrr")                                                             \
+    X(LE_D, "rrr")                                                             \
+    X(GT_I, "rrr")                                                             \
+    X(GT_D, "rrr")                                                             \
+    X(GE_I, "rrr")                                                             \
+    X(GE_D, "rrr")                                                             \
+    X(ADD_IK, "rrk")    /* a = b + c */                                        \
+    X(MUL_IK, "rrk")    /* a = b * c */                                        \
+    X(NEG_I, "rr")      /* a = op b */                                         \
+    X(NEG_D, "rr")                                                             \
+    X(NOT_I, "rr")                                                             \
+    X(NOT_D, "rr")                                                             \
+    X(I2D, "rr")                                                               \
+    X(D2I, "rr")                                                               \
+    X(I2C, "rr")                                                               \
+    X(JMP, "t")                                                                \
+    X(JT_I, "tr")       /* jumps if b is true or false */                      \
+    X(JF_I, "tr")                                                              \
+    X(JT_D, "tr")                                                              \
+    X(JF_D, "tr")                                                              \
+    X(JEQ_I, "trr")     /* jumps if b op c */                                  \
+    X(JNE_I, "trr")                                                            \
+    X(JLT_I, "trr")                                                            \
+    X(JLE_I, "trr")                                                            \
+    X(JGT_I, "trr")                                                            \
+    X(JGE_I, "trr")                                                            \
+    X(JEQ_IK, "trk")    /* jumps if b op the constant c */                     \
+    X(JNE_IK, "trk")                                                           \
+    X(JLT_IK, "trk")                                                           \
+    X(JLE_IK, "trk")                                                           \
+    X(JGT_IK, "trk")                                                           \
+    X(JGE_IK, "trk")                                                           \
+    X(CALL, "tkr")      /* the frame of the callee at b, its result in c */    \
+    X(ENTER, "ks")      /* a: the size of the frame, s: the function */        \
+    X(RET, "r")                                                                \
+    X(RET_S, "rk")      /* copies the struct at the address a, of b bytes */   \
+    X(RET_V, "")                                                               \
+    X(FALLOFF, "s")                                                            \
+    X(PUT_S, "r")       /* the argument or the result is in a */               \
+    X(GET_S, "r")                                                              \
+    X(PUT_I, "r")                                                              \
+    X(GET_I, "r")                                                              \
+    X(PUT_D, "r")                                                              \
+    X(GET_D, "r")                                                              \
+    X(PUT_C, "r")                                                              \
+    X(GET_C, "r")                                                              \
+    X(SECONDS, "r")
+
+#define ROP_ENUM(name, format) ROP_##name,
+enum { ROPCODES(ROP_ENUM) N_ROPCODES };
 
-typedef struct _Token
+typedef struct
 {
-    int code; // Code (name)
     union
     {
-        char *text; // Used for ID, CT_STRING (dynamically allocated)
-        long int i; // Used for CT_INT, CT_CHAR
-        double r;   // Used for CT_REAL
+        int op;
+        const void *label;
+    };
+    int a;
+    union
+    {
+        struct
+        {
+            int b, c;
+        };
+        long i;
+        double d;
+        char *p;
+        Symbol *s;
     };
-    int line;            // Input file line
-    struct _Token *next; // Link to the next token
-} Token;
+} RInstr;
+
+// The first symbols are kept in the list itself; when they do not fit, the
+// list moves to the arena of the context. Most functions have a few args and
+// most structs a few members, so their lists need no allocation.
+#define SYMBOLS_INLINE 4
+
+typedef struct{
+	Symbol **begin; 	// the beginning of the symbols, or NULL
+	Symbol **end;		// the position after the last symbol
+	Symbol **after;		// the position after the allocated space
+	Symbol *inlined[SYMBOLS_INLINE];
+} Symbols;
+
+// A slot of the index of the symbols by name. A slot is never emptied, so
+// the probing stays simple; its symbol is NULL when no symbol has the name.
+typedef struct
+{
+    const char *name;   // interned, so the names are compared as pointers
+    Symbol *symbol;     // the innermost symbol with the name
+} SymbolSlot;
+
+// The state of the compilation of one input. The lexer, the parser and the
+// symbol table keep all their variables here and get the context as their
+// first argument, so that several inputs can be compiled at the same time.
+typedef struct _Context
+{
+    const char *filename;   // printed before the errors, if not NULL
+    FILE *errors;           // where the errors are printed
+    jmp_buf onError;        // tkerr and lexerr return here after printing the error
+
+    Tokens tokens;          // all the tokens, in the order of the input
+    int crtTk;              // index of the current token
+    int consumedTk;         // index of the last consumed token
+    int furthestTk;         // the tokens before it were consumed at least once
+    int lastUnary;          // the first token of the last unary expression parsed
+    long reconsumedTk;      // statistics: tokens consumed again after backtracking
+
+    Literal *literals;      // the values of the literal tokens; literals[0] is unused
+    int nLiterals;
+    int literalsCapacity;
+
+    unsigned int *lines;    // offsets of the newlines counted by the lexer, ascending
+    int nLines;
+    int linesCapacity;
+    int linesBefore;        // the newlines dropped from lines in streaming mode
+
+    Name *names;            // names[0] is unused, so 0 can mean "no name"
+    int nNames;
+    int namesCapacity;
+    int *namesHash;         // open addressing hash table of indexes in names, 0 for empty slots
+    int namesHashSize;      // a power of 2
+    char *namesPage;        // the storage in use for the names text
+    size_t namesPageFree;   // free bytes at the end of namesPage
+    char *namesPages;       // the last page allocated; each page starts with a pointer to the previous one
+    long internLookups;     // statistics
+    long internHits;
+    long internBytesSaved;
+
+    const char *pInput;            // the input being analyzed, tokens refer to it by offset
+    size_t inputSize;              // the size of the input of parallelLex
+    const char *pStartCh, *pCrtCh; // the first and the current character of the token being analyzed
+    LexNumber lexNum;              // the number being analyzed
+    char *lexText;                 // the decoded text of the char or string literal being analyzed
+    int nLexText, lexTextCapacity;
+    const char *lexLimit;          // the lexers stop in state 0 from here
+    int lexSpeculative;            // lexing a chunk of parallelLex
 
-Token *tokens = NULL;
-Token *lastToken = NULL;
-Token *crtTk;
-Token *consumedTk;
+    // In streaming mode the input is read in chunks and the lexer returns to
+    // pullTokens through lexJump when it reaches the end of the chunks read.
+    // The lexers of the chunks of parallelLex return through it on errors.
+    jmp_buf lexJump;
+    const char *streamEnd;  // the '\0' after the last chunk
+    int streamEof;          // nothing left to read; always set outside streaming mode
+    int streamFd;
+    char *streamBuffer;
+    size_t streamCapacity;  // the bytes of text which fit in streamBuffer
+    int (*streamLexer)(struct _Context *, const char *);
+    long long streamRead;   // statistics
+    int streamPeakTokens;
+    int committedTk;        // the parser will not backtrack before this token
+    int streamRefill;       // the lexer stopped at the end of the buffer
+
+    Node *nodes;            // the syntax tree; nodes[0] is unused
+    int nNodes;
+    int nodesCapacity;
+    int root;               // the N_UNIT node
+    int keepNodes;          // 0 in streaming mode, where all the nodes are written in nodes[1]
+
+    int crtDepth;
+    Symbols symbols;        // the visible symbols, in the order of their declaration
+    SymbolSlot *symbolsHash; // open addressing index of symbols by name
+    int symbolsHashSize;    // a power of 2
+    int nSymbolsHash;       // the used slots
+    int *scopes;            // scopes[d]: the number of symbols when depth d was entered
+    int scopesCapacity;
+    char *arena;            // the storage in use for the symbols and their lists
+    size_t arenaFree;       // free bytes at the end of arena
+    char *arenaPages;       // the last page allocated; each page starts with a pointer to the previous one
+    size_t arenaSize;       // bytes allocated from the arena
+    Type **typesHash;       // open addressing index of the interned types
+    int typesHashSize;      // a power of 2
+    int nTypes;
+    NodeInfo *nodeInfo;     // what the semantic analysis found for each node
+    Symbol *crtFunc;        // the function being checked
+    int loopDepth;          // the loops around the statement being checked
+    int nFolded;            // the constant expressions replaced by their values
+    Instr *code;            // the program for the virtual machine
+    int nCode, codeCapacity;
+    RInstr *rcode;          // the program for the register machine
+    int nRCode, rcodeCapacity;
+    int tempStart;          // the first temporary register of the expression being generated
+    char *globals;          // the memory of the global variables
+    long globalsSize;
+    int frameOffset;        // the first free byte of the frame of the function being generated
+    int frameSize;          // the largest frameOffset in the function
+    int stackDepth;         // the values pushed on the stack by the code of the function so far
+    int maxStackDepth;      // the largest stackDepth in the function
+    int *breaks;            // the jumps of the break statements not yet patched
+    int nBreaks, breaksCapacity;
+    long vmSteps;           // the instructions run
+    int useJit;             // the hot functions of the register machine are translated to machine code
+    int nJitted;            // the functions translated
+    long jitBytes;          // their bytes of machine code
+    int nAllocated;         // the registers of the machine kept in registers of the processor by -S
+    int nSpilled;           // and those left in the frame
+    int nSymbolsAdded;      // statistics
+    long symbolLookups;
+} Context;
 
 #define SAFEALLOC(var, Type)                          \
     if ((var = (Type *)malloc(sizeof(Type))) == NULL) \
@@ -66,15 +536,55 @@ char *createString(const char *start, const char *end)
     return str;
 }
 
-void tkerr(const Token *tk, const char *fmt, ...)
+// Returns the line of the input character at the given offset
+int lineOf(Context *ctx, unsigned int offset)
+{
+    int left = 0, right = ctx->nLines; // the result is 1 + the number of newlines before offset
+    while (left < right)
+    {
+        int middle = (left + right) / 2;
+        if (ctx->lines[middle] < offset)
+            left = middle + 1;
+        else
+            right = middle;
+    }
+    return ctx->linesBefore + left + 1;
+}
+
+int tkLine(Context *ctx, int tk)
+{
+    return lineOf(ctx, ctx->tokens.offset[tk - ctx->tokens.first]);
+}
+
+// Prints the error and returns to ctx->onError
+void tkerr(Context *ctx, int tk, const char *fmt, ...)
 {
     va_list va;
     va_start(va, fmt);
-    fprintf(stderr, "error in line %d: ", tk->line);
-    vfprintf(stderr, fmt, va);
-    fputc('\n', stderr);
+    if (ctx->filename)
+        fprintf(ctx->errors, "%s: ", ctx->filename);
+    fprintf(ctx->errors, "error in line %d: ", tkLine(ctx, tk));
+    vfprintf(ctx->errors, fmt, va);
+    fputc('\n', ctx->errors);
     va_end(va);
-    exit(-1);
+    longjmp(ctx->onError, 1);
+}
+
+// Reports an error at the current position of the lexer
+void lexerr(Context *ctx, const char *fmt, ...)
+{
+    va_list va;
+    if ((!ctx->streamEof && ctx->pCrtCh >= ctx->streamEnd) || // the text may continue in the next chunk
+        ctx->lexSpeculative)                         // reported only if the chunk was lexed from a right state
+        longjmp(ctx->lexJump, 1);
+    va_start(va, fmt);
+    if (ctx->filename)
+        fprintf(ctx->errors, "%s: ", ctx->filename);
+    fprintf(ctx->errors, "error in line %d: ", ctx->linesBefore + ctx->nLines + 1);
+    vfprintf(ctx->errors, fmt, va);
+    fputc('\n', ctx->errors);
+    va_end(va);
+    longjmp(ctx->onError, 1);
 }
 
 char escaped(char ch)
@@ -100,1336 +610,7124 @@ char escaped(char ch)
     case 't':
         escapedCh = '\t';
         break;
+    case 'v':
+        escapedCh = '\v';
+        break;
     case '0':
         escapedCh = '\0';
         break;
+    default: // ' ? " and backslash stand for themselves
+        escapedCh = ch;
+        break;
     }
     return escapedCh;
 }
 
-Token *addTk(int code)
+void *growArray(void *p, int *capacity, int minimum, size_t size)
+{
+    *capacity = *capacity ? *capacity * 2 : minimum;
+    p = realloc(p, *capacity * size);
+    if (p == NULL)
+        err("not enough memory");
+    return p;
+}
+
+void initContext(Context *ctx, const char *filename, FILE *errors)
+{
+    memset(ctx, 0, sizeof(*ctx));
+    ctx->filename = filename;
+    ctx->errors = errors;
+    ctx->nLiterals = 1;
+    ctx->nNames = 1;
+    ctx->lexLimit = (const char *)UINTPTR_MAX;
+    ctx->streamEof = 1;
+    ctx->nNodes = 1;
+    ctx->keepNodes = 1;
+}
+
+// Frees all the memory of the context, but not its input
+void freeContext(Context *ctx)
 {
-    Token *tk;
-    SAFEALLOC(tk, Token);
-    tk->code = code;
-    tk->line = line;
-    tk->next = NULL;
-    if (lastToken)
+    free(ctx->tokens.code);
+    free(ctx->tokens.offset);
+    free(ctx->tokens.length);
+    free(ctx->tokens.aux);
+    free(ctx->literals);
+    free(ctx->lines);
+    free(ctx->names);
+    free(ctx->namesHash);
+    while (ctx->namesPages)
     {
-        lastToken->next = tk;
+        char *previous = *(char **)ctx->namesPages;
+        free(ctx->namesPages);
+        ctx->namesPages = previous;
     }
-    else
+    free(ctx->lexText);
+    free(ctx->streamBuffer);
+    free(ctx->nodes);
+    while (ctx->arenaPages)
+    {
+        char *previous = *(char **)ctx->arenaPages;
+        free(ctx->arenaPages);
+        ctx->arenaPages = previous;
+    }
+    free(ctx->symbolsHash);
+    free(ctx->scopes);
+    free(ctx->typesHash);
+    free(ctx->nodeInfo);
+    free(ctx->code);
+    free(ctx->rcode);
+    free(ctx->globals);
+    free(ctx->breaks);
+}
+
+// Makes room for n more tokens
+void reserveTokens(Context *ctx, int n)
+{
+    if (ctx->tokens.n + n > ctx->tokens.capacity)
     {
-        tokens = tk;
+        while (ctx->tokens.n + n > ctx->tokens.capacity)
+            ctx->tokens.capacity = ctx->tokens.capacity ? ctx->tokens.capacity * 2 : 1024;
+        ctx->tokens.code = (unsigned char *)realloc(ctx->tokens.code, ctx->tokens.capacity * sizeof(*ctx->tokens.code));
+        ctx->tokens.offset = (unsigned int *)realloc(ctx->tokens.offset, ctx->tokens.capacity * sizeof(*ctx->tokens.offset));
+        ctx->tokens.length = (unsigned int *)realloc(ctx->tokens.length, ctx->tokens.capacity * sizeof(*ctx->tokens.length));
+        ctx->tokens.aux = (unsigned int *)realloc(ctx->tokens.aux, ctx->tokens.capacity * sizeof(*ctx->tokens.aux));
+        if (!ctx->tokens.code || !ctx->tokens.offset || !ctx->tokens.length || !ctx->tokens.aux)
+            err("not enough memory");
     }
-    lastToken = tk;
-    return tk;
 }
 
+int addTk(Context *ctx, int code)
+{
+    reserveTokens(ctx, 1);
+    ctx->tokens.code[ctx->tokens.n] = code;
+    ctx->tokens.offset[ctx->tokens.n] = ctx->pStartCh - ctx->pInput;
+    ctx->tokens.length[ctx->tokens.n] = ctx->pCrtCh - ctx->pStartCh;
+    ctx->tokens.aux[ctx->tokens.n] = 0;
+    return ctx->tokens.n++;
+}
 
-int getNextToken(char *input)
+int isLiteral(int code)
 {
-    int state = 0;
-    char ch;
-    char *pStartCh, *pCrtCh = input;
-    Token *tk;
-    while (1)
+    return code == CT_INT || code == CT_REAL || code == CT_CHAR;
+}
+
+// Adds a literal token; the returned pointer is valid only until the next addLit
+Literal *addLit(Context *ctx, int code)
+{
+    int tk = addTk(ctx, code);
+    if (ctx->nLiterals >= ctx->literalsCapacity)
+        ctx->literals = (Literal *)growArray(ctx->literals, &ctx->literalsCapacity, 256, sizeof(Literal));
+    ctx->tokens.aux[tk] = ctx->nLiterals;
+    return &ctx->literals[ctx->nLiterals++];
+}
+
+// FNV-1a
+unsigned int hashText(const char *text, size_t length)
+{
+    unsigned int h = 2166136261u;
+    size_t i;
+    for (i = 0; i < length; i++)
+        h = (h ^ (unsigned char)text[i]) * 16777619u;
+    return h;
+}
+
+void rehashNames(Context *ctx)
+{
+    int i, j;
+    free(ctx->namesHash);
+    ctx->namesHashSize = ctx->namesHashSize ? ctx->namesHashSize * 2 : 1024;
+    ctx->namesHash = (int *)calloc(ctx->namesHashSize, sizeof(int));
+    if (ctx->namesHash == NULL)
+        err("not enough memory");
+    for (i = 1; i < ctx->nNames; i++)
     {
-        ch = (*pCrtCh);
-        switch (state)
+        for (j = ctx->names[i].hash & (ctx->namesHashSize - 1); ctx->namesHash[j]; j = (j + 1) & (ctx->namesHashSize - 1))
         {
-        case 0:
-            pStartCh = pCrtCh;
-            if (ch == '\n')
-            {
-                line++;
-                pCrtCh++;
-            }
-            else if (isalpha(ch) || ch == '_')
-            {
-                pCrtCh++;
-                state = 1;
-            }
-            else if (ch >= '1' && ch <= '9')
-            {
-                pCrtCh++;
-                state = 3;
-            }
-            else if (ch == '0')
-            {
-                pCrtCh++;
-                state = 5;
-            }
-            else if(ch == ' ' || ch == '\t' || ch == '\r') {
-				pCrtCh++;
-			}
-            else if (ch == '/') {
-                pCrtCh++;
-                state = 20;
-            }
-            else if(ch == '\'') {
-					pCrtCh++;
-					state = 14;
-				}
-			else if(ch == '\"') {
-					pCrtCh++;
-					state = 17;
-				}
-            else if (ch == ',')
-            {
-                pCrtCh++;
-                addTk(COMMA);
-            }
-            else if (ch == ';')
-            {
-                pCrtCh++;
-                addTk(SEMICOLON);
-            }
-            else if (ch == '(')
-            {
-                pCrtCh++;
-                addTk(LPAR);
-            }
-            else if (ch == ')')
-            {
-                pCrtCh++;
-                addTk(RPAR);
-            }
-            else if (ch == '[')
-            {
-                pCrtCh++;
-                addTk(LBRACKET);
-            }
-            else if (ch == ']')
-            {
-                pCrtCh++;
-                addTk(RBRACKET);
-            }
-            else if (ch == '{')
-            {
-                pCrtCh++;
-                addTk(LACC);
-            }
-            else if (ch == '}')
-            {
-                pCrtCh++;
-                addTk(RACC);
-            }
-            else if (ch == '+')
-            {
-                pCrtCh++;
-                addTk(ADD);
-            }
-            else if (ch == '-')
-            {
-                pCrtCh++;
-                addTk(SUB);
-            }
-            else if (ch == '*')
-            {
-                pCrtCh++;
-                addTk(MUL);
-            }
-            else if (ch == '.')
-            {
-                pCrtCh++;
-                addTk(DOT);
-            }
-            else if (ch == '&')
-            {
-                pCrtCh++;
-                ch = *pCrtCh;
-                if (ch == '&')
-                {
-                    pCrtCh++;
-                    addTk(AND);
-                }
-                else {
-                    tkerr(tk, "Expected binary operator column %s\n", pStartCh);
-                }
-            }
-            else if (ch == '|')
-            {
-                pCrtCh++;
-                ch = *pCrtCh;
-                if (ch == '|')
-                {
-                    pCrtCh++;
-                    addTk(OR);
-                }
-                else
-                    tkerr(tk, "Expected binary operator column %s\n", pCrtCh);
-            }
-            else if (ch == '!')
-            {
-                pCrtCh++;
-                ch = *pCrtCh;
-                if (ch == '=')
-                {
-                    pCrtCh++;
-                    addTk(NOTEQ);
-                }
-                else
-                {
-                    addTk(NOT);
-                }
-            }
-            else if (ch == '=')
-            {
-                pCrtCh++;
-                ch = *pCrtCh;
-                if (ch == '=')
-                {
-                    pCrtCh++;
-                    addTk(EQUAL);
-                }
-                else
-                {
-                    addTk(ASSIGN);
-                }
-            }
-            else if (ch == '<')
-            {
-                pCrtCh++;
-                ch = *pCrtCh;
-                if (ch == '=')
-                {
-                    pCrtCh++;
-                    addTk(LESSEQ);
-                }
-                else
-                {
-                    addTk(LESS);
-                }
-            }
-            else if (ch == '>')
-            {
-                pCrtCh++;
-                ch = *pCrtCh;
-                if (ch == '=')
-                {
-                    pCrtCh++;
-                    addTk(GREATEREQ);
-                }
-                else
-                {
-                    addTk(GREATER);
-                }
-            }
-            else if (ch == '\0')
-            {
-                addTk(END);
-                return 0;
-            }
-            else {
-                printf("Intra in else-ul asta de la sfarsit de la cazul 0\n");
-                tkerr(tk, "Error");
-            }
-            break;
-        case 1:
-				if((ch >= 'a' && ch <= 'z') || (ch >= 'A' && ch <= 'Z') || (ch >= '0' && ch <= '9') || ch == '_') {
-					if(!memcmp(pStartCh, "break", 5)) {
-						tk=addTk(BREAK);
-						pCrtCh+= 3;
-						state = 0;
-					} else if(!memcmp(pStartCh, "char", 4)) {
-						tk = addTk(CT_CHAR);
-						pCrtCh+= 2;
-						state = 0;
-					} else if(!memcmp(pStartCh, "double", 6)) {
-						tk = addTk(DOUBLE);
-						pCrtCh+= 4;
-						state = 0;
-					} else if(!memcmp(pStartCh, "else", 4)) {
-						tk = addTk(ELSE);
-						pCrtCh+= 2;
-						state = 0;
-					} else if(!memcmp(pStartCh, "for", 3)) {
-						tk = addTk(FOR);
-						pCrtCh+= 1;
-						state = 0;
-					} else if(!memcmp(pStartCh, "if", 2)) {
-						tk = addTk(IF);
-						state = 0;
-					} else if(!memcmp(pStartCh, "int", 3)) {
-						tk = addTk(INT);
-						pCrtCh+= 2;
-						state = 0;
-					} else if(!memcmp(pStartCh, "return", 6)) {
-						tk = addTk(RETURN);
-						pCrtCh+= 4;
-						state = 0;
-					} else if(!memcmp(pStartCh, "struct", 6)) {
-						tk = addTk(STRUCT);
-						pCrtCh+= 4;
-						state = 0;
-					} else if(!memcmp(pStartCh, "void", 4)) {
-						tk = addTk(VOID);
-						pCrtCh+= 2;
-						state = 0;
-					} else if(!memcmp(pStartCh, "while", 5)) { 
-						tk = addTk(WHILE);
-						pCrtCh+= 3;
-						state = 0;
-					}
-					pCrtCh++;
-				}
-				else {
-					state = 2;
-				}
-				break;
-        case 2:
-            tk = addTk(ID);
-            char *str = createString(pStartCh, pCrtCh);
-            tk->text = str;
-            state = 0;
-            break;
-        case 3:
-            if (ch >= '0' && ch <= '9')
-            {
-                pCrtCh++;
-                state = 3;
-            }
-            else if (ch == '.')
-            {
-                pCrtCh++;
-                state = 8;
-            }
-            else if (ch == 'e' || ch == 'E')
-            {
-                pCrtCh++;
-                state = 10;
-            }
-            else
-                state = 4;
-            break;
-        case 4:
-            tk = addTk(CT_INT);
-            tk->i = strtol(pStartCh, NULL, 0);
-            state = 0;
-            break;
-        case 5:
-            if (ch >= '0' && ch <= '7')
-            {
-                pCrtCh++;
-            }
+        }
+        ctx->namesHash[j] = i;
+    }
+}
+
+// Copies a name text in the names storage, which is allocated in pages that never move
+const char *storeName(Context *ctx, const char *text, size_t length)
+{
+    char *p;
+    if (length + 1 > ctx->namesPageFree)
+    {
+        size_t size = length + 1 > 65536 ? length + 1 : 65536;
+        char *page = (char *)malloc(sizeof(char *) + size);
+        if (page == NULL)
+            err("not enough memory");
+        *(char **)page = ctx->namesPages;
+        ctx->namesPages = page;
+        ctx->namesPage = page + sizeof(char *);
+        ctx->namesPageFree = size;
+    }
+    p = ctx->namesPage;
+    memcpy(p, text, length);
+    p[length] = '\0';
+    ctx->namesPage += length + 1;
+    ctx->namesPageFree -= length + 1;
+    return p;
+}
+
+// Allocates from the arena of the context, which is freed all at once with
+// the context. The blocks are aligned for pointers and doubles.
+void *arenaAlloc(Context *ctx, size_t size)
+{
+    char *p;
+    size = (size + 7) & ~(size_t)7;
+    if (size > ctx->arenaFree)
+    {
+        size_t pageSize = size > 65536 ? size : 65536;
+        char *page = (char *)malloc(8 + pageSize);
+        if (page == NULL)
+            err("not enough memory");
+        *(char **)page = ctx->arenaPages;
+        ctx->arenaPages = page;
+        ctx->arena = page + 8;
+        ctx->arenaFree = pageSize;
+    }
+    p = ctx->arena;
+    ctx->arena += size;
+    ctx->arenaFree -= size;
+    ctx->arenaSize += size;
+    return p;
+}
+
+// Returns the index of the name with the given text, adding it if it is new
+int intern(Context *ctx, const char *text, size_t length)
+{
+    unsigned int h = hashText(text, length);
+    int i, j;
+    ctx->internLookups++;
+    if (ctx->nNames * 2 >= ctx->namesHashSize)
+        rehashNames(ctx);
+    for (j = h & (ctx->namesHashSize - 1); (i = ctx->namesHash[j]) != 0; j = (j + 1) & (ctx->namesHashSize - 1))
+    {
+        if (ctx->names[i].hash == h && ctx->names[i].length == length && !memcmp(ctx->names[i].text, text, length))
+        {
+            ctx->internHits++;
+            ctx->internBytesSaved += length + 1;
+            return i;
+        }
+    }
+    if (ctx->nNames >= ctx->namesCapacity)
+        ctx->names = (Name *)growArray(ctx->names, &ctx->namesCapacity, 1024, sizeof(Name));
+    ctx->names[ctx->nNames].text = storeName(ctx, text, length);
+    ctx->names[ctx->nNames].length = length;
+    ctx->names[ctx->nNames].hash = h;
+    ctx->namesHash[j] = ctx->nNames;
+    return ctx->nNames++;
+}
+
+// Records the newline at p
+void addLineAt(Context *ctx, const char *p)
+{
+    if (ctx->nLines == ctx->linesCapacity)
+        ctx->lines = (unsigned int *)growArray(ctx->lines, &ctx->linesCapacity, 256, sizeof(*ctx->lines));
+    ctx->lines[ctx->nLines++] = p - ctx->pInput;
+}
+
+// Records the newline at the current position of the lexer
+void addLine(Context *ctx)
+{
+    addLineAt(ctx, ctx->pCrtCh);
+}
+
+
+typedef struct
+{
+    const char *text;
+    int length;
+    int code;
+} Keyword;
+
+// Perfect hash of the keywords, from their length, first and last character.
+// The table is laid out by the compiler from the designators, so a collision
+// after a change of the keywords shows as an overridden initializer.
+#define KEYWORD_HASH(length, first, last) (((length) + (first) + (last) * 6) & 15)
+#define KEYWORD(text, first, last, code) [KEYWORD_HASH(sizeof(text) - 1, first, last)] = {text, sizeof(text) - 1, code}
+
+const Keyword keywords[16] = {
+    KEYWORD("break", 'b', 'k', BREAK),
+    KEYWORD("char", 'c', 'r', CHAR),
+    KEYWORD("double", 'd', 'e', DOUBLE),
+    KEYWORD("else", 'e', 'e', ELSE),
+    KEYWORD("for", 'f', 'r', FOR),
+    KEYWORD("if", 'i', 'f', IF),
+    KEYWORD("int", 'i', 't', INT),
+    KEYWORD("return", 'r', 'n', RETURN),
+    KEYWORD("struct", 's', 't', STRUCT),
+    KEYWORD("void", 'v', 'd', VOID),
+    KEYWORD("while", 'w', 'e', WHILE),
+};
+
+// Returns the code of the keyword with the given text, or ID if it is not a keyword
+int keywordCode(const char *text, int length)
+{
+    const Keyword *k = &keywords[KEYWORD_HASH(length, (unsigned char)text[0], (unsigned char)text[length - 1])];
+    if (k->length == length && !memcmp(k->text, text, length))
+        return k->code;
+    return ID;
+}
+
+// Kernels which skip the long runs of the input 16 or 32 characters at a
+// time: blanks, the text of comments and the rest of identifiers. They stop
+// at the final '\0' and may read up to 31 characters after the position
+// where they stop, so the input must be followed by LEX_PADDING readable bytes.
+// The newlines they skip are recorded in lines.
+
+#define LEX_PADDING 32
+
+int isBlank(char ch)
+{
+    return ch == ' ' || ch == '\t' || ch == '\r' || ch == '\n';
+}
+
+int isIdentChar(char ch)
+{
+    return (ch >= 'a' && ch <= 'z') || (ch >= 'A' && ch <= 'Z') || (ch >= '0' && ch <= '9') || ch == '_';
+}
+
+const char *skipBlanksScalar(Context *ctx, const char *p)
+{
+    for (; isBlank(*p); p++)
+    {
+        if (*p == '\n')
+            addLineAt(ctx, p);
+    }
+    return p;
+}
+
+// the characters of a block comment up to the next * or '\0'
+const char *skipCommentScalar(Context *ctx, const char *p)
+{
+    for (; *p != '*' && *p != '\0'; p++)
+    {
+        if (*p == '\n')
+            addLineAt(ctx, p);
+    }
+    return p;
+}
+
+// the characters of a line comment up to the next \n, \r or '\0'
+const char *skipLineScalar(const char *p)
+{
+    while (*p != '\n' && *p != '\r' && *p != '\0')
+        p++;
+    return p;
+}
+
+const char *skipIdentScalar(const char *p)
+{
+    while (isIdentChar(*p))
+        p++;
+    return p;
+}
+
+const char *(*skipBlanks)(Context *, const char *) = skipBlanksScalar;
+const char *(*skipComment)(Context *, const char *) = skipCommentScalar;
+const char *(*skipLine)(const char *) = skipLineScalar;
+const char *(*skipIdent)(const char *) = skipIdentScalar;
+const char *lexKernels = "scalar";
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+
+// records the newlines marked in the first n bits of mask, for the block at p
+void addLinesMask(Context *ctx, const char *p, unsigned int mask, int n)
+{
+    if (n < 32)
+        mask &= (1u << n) - 1;
+    while (mask)
+    {
+        addLineAt(ctx, p + __builtin_ctz(mask));
+        mask &= mask - 1;
+    }
+}
+
+// SSE2: each function computes a mask of the characters where it must stop
+
+__attribute__((target("sse2"))) const char *skipBlanksSse2(Context *ctx, const char *p)
+{
+    for (;; p += 16)
+    {
+        __m128i v = _mm_loadu_si128((const __m128i *)p);
+        __m128i nl = _mm_cmpeq_epi8(v, _mm_set1_epi8('\n'));
+        __m128i blank = _mm_or_si128(_mm_or_si128(_mm_cmpeq_epi8(v, _mm_set1_epi8(' ')), _mm_cmpeq_epi8(v, _mm_set1_epi8('\t'))),
+                                     _mm_or_si128(_mm_cmpeq_epi8(v, _mm_set1_epi8('\r')), nl));
+        unsigned int stop = ~_mm_movemask_epi8(blank) & 0xFFFF;
+        int n = stop ? __builtin_ctz(stop) : 16;
+        addLinesMask(ctx, p, _mm_movemask_epi8(nl), n);
+        if (stop)
+            return p + n;
+    }
+}
+
+__attribute__((target("sse2"))) const char *skipCommentSse2(Context *ctx, const char *p)
+{
+    for (;; p += 16)
+    {
+        __m128i v = _mm_loadu_si128((const __m128i *)p);
+        unsigned int stop = _mm_movemask_epi8(_mm_or_si128(_mm_cmpeq_epi8(v, _mm_set1_epi8('*')), _mm_cmpeq_epi8(v, _mm_setzero_si128())));
+        int n = stop ? __builtin_ctz(stop) : 16;
+        addLinesMask(ctx, p, _mm_movemask_epi8(_mm_cmpeq_epi8(v, _mm_set1_epi8('\n'))), n);
+        if (stop)
+            return p + n;
+    }
+}
+
+__attribute__((target("sse2"))) const char *skipLineSse2(const char *p)
+{
+    for (;; p += 16)
+    {
+        __m128i v = _mm_loadu_si128((const __m128i *)p);
+        __m128i end = _mm_or_si128(_mm_or_si128(_mm_cmpeq_epi8(v, _mm_set1_epi8('\n')), _mm_cmpeq_epi8(v, _mm_set1_epi8('\r'))),
+                                   _mm_cmpeq_epi8(v, _mm_setzero_si128()));
+        unsigned int stop = _mm_movemask_epi8(end);
+        if (stop)
+            return p + __builtin_ctz(stop);
+    }
+}
+
+// a character c is in a..z when the unsigned (c | 0x20) - 'a' <= 25, and in 0..9 when c - '0' <= 9
+__attribute__((target("sse2"))) const char *skipIdentSse2(const char *p)
+{
+    for (;; p += 16)
+    {
+        __m128i v = _mm_loadu_si128((const __m128i *)p);
+        __m128i letter = _mm_sub_epi8(_mm_or_si128(v, _mm_set1_epi8(0x20)), _mm_set1_epi8('a'));
+        __m128i digit = _mm_sub_epi8(v, _mm_set1_epi8('0'));
+        __m128i ident = _mm_or_si128(_mm_or_si128(_mm_cmpeq_epi8(_mm_min_epu8(letter, _mm_set1_epi8(25)), letter),
+                                                  _mm_cmpeq_epi8(_mm_min_epu8(digit, _mm_set1_epi8(9)), digit)),
+                                     _mm_cmpeq_epi8(v, _mm_set1_epi8('_')));
+        unsigned int stop = ~_mm_movemask_epi8(ident) & 0xFFFF;
+        if (stop)
+            return p + __builtin_ctz(stop);
+    }
+}
+
+// AVX2: the same, 32 characters at a time
+
+__attribute__((target("avx2"))) const char *skipBlanksAvx2(Context *ctx, const char *p)
+{
+    for (;; p += 32)
+    {
+        __m256i v = _mm256_loadu_si256((const __m256i *)p);
+        __m256i nl = _mm256_cmpeq_epi8(v, _mm256_set1_epi8('\n'));
+        __m256i blank = _mm256_or_si256(_mm256_or_si256(_mm256_cmpeq_epi8(v, _mm256_set1_epi8(' ')), _mm256_cmpeq_epi8(v, _mm256_set1_epi8('\t'))),
+                                        _mm256_or_si256(_mm256_cmpeq_epi8(v, _mm256_set1_epi8('\r')), nl));
+        unsigned int stop = ~(unsigned int)_mm256_movemask_epi8(blank);
+        int n = stop ? __builtin_ctz(stop) : 32;
+        addLinesMask(ctx, p, _mm256_movemask_epi8(nl), n);
+        if (stop)
+            return p + n;
+    }
+}
+
+__attribute__((target("avx2"))) const char *skipCommentAvx2(Context *ctx, const char *p)
+{
+    for (;; p += 32)
+    {
+        __m256i v = _mm256_loadu_si256((const __m256i *)p);
+        unsigned int stop = _mm256_movemask_epi8(_mm256_or_si256(_mm256_cmpeq_epi8(v, _mm256_set1_epi8('*')), _mm256_cmpeq_epi8(v, _mm256_setzero_si256())));
+        int n = stop ? __builtin_ctz(stop) : 32;
+        addLinesMask(ctx, p, _mm256_movemask_epi8(_mm256_cmpeq_epi8(v, _mm256_set1_epi8('\n'))), n);
+        if (stop)
+            return p + n;
+    }
+}
+
+__attribute__((target("avx2"))) const char *skipLineAvx2(const char *p)
+{
+    for (;; p += 32)
+    {
+        __m256i v = _mm256_loadu_si256((const __m256i *)p);
+        __m256i end = _mm256_or_si256(_mm256_or_si256(_mm256_cmpeq_epi8(v, _mm256_set1_epi8('\n')), _mm256_cmpeq_epi8(v, _mm256_set1_epi8('\r'))),
+                                      _mm256_cmpeq_epi8(v, _mm256_setzero_si256()));
+        unsigned int stop = _mm256_movemask_epi8(end);
+        if (stop)
+            return p + __builtin_ctz(stop);
+    }
+}
+
+__attribute__((target("avx2"))) const char *skipIdentAvx2(const char *p)
+{
+    for (;; p += 32)
+    {
+        __m256i v = _mm256_loadu_si256((const __m256i *)p);
+        __m256i letter = _mm256_sub_epi8(_mm256_or_si256(v, _mm256_set1_epi8(0x20)), _mm256_set1_epi8('a'));
+        __m256i digit = _mm256_sub_epi8(v, _mm256_set1_epi8('0'));
+        __m256i ident = _mm256_or_si256(_mm256_or_si256(_mm256_cmpeq_epi8(_mm256_min_epu8(letter, _mm256_set1_epi8(25)), letter),
+                                                        _mm256_cmpeq_epi8(_mm256_min_epu8(digit, _mm256_set1_epi8(9)), digit)),
+                                        _mm256_cmpeq_epi8(v, _mm256_set1_epi8('_')));
+        unsigned int stop = ~(unsigned int)_mm256_movemask_epi8(ident);
+        if (stop)
+            return p + __builtin_ctz(stop);
+    }
+}
+#endif
+
+// Selects the best kernels supported by the processor; with scalar only the scalar ones
+void initLexKernels(int scalar)
+{
+    if (scalar)
+        return;
+#if defined(__x86_64__) || defined(__i386__)
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2"))
+    {
+        skipBlanks = skipBlanksAvx2;
+        skipComment = skipCommentAvx2;
+        skipLine = skipLineAvx2;
+        skipIdent = skipIdentAvx2;
+        lexKernels = "avx2";
+    }
+    else if (__builtin_cpu_supports("sse2"))
+    {
+        skipBlanks = skipBlanksSse2;
+        skipComment = skipCommentSse2;
+        skipLine = skipLineSse2;
+        skipIdent = skipIdentSse2;
+        lexKernels = "sse2";
+    }
+#endif
+}
+
+void startNumber(Context *ctx)
+{
+    memset(&ctx->lexNum, 0, sizeof(ctx->lexNum));
+    ctx->lexNum.expSign = 1;
+}
+
+// adds a digit to the integer value, in the given base
+void numInt(Context *ctx, int base, int digit)
+{
+    if (ctx->lexNum.value > (unsigned long)(LONG_MAX - digit) / base)
+        ctx->lexNum.overflow = 1;
+    else
+        ctx->lexNum.value = ctx->lexNum.value * base + digit;
+}
+
+// adds a digit to the mantissa of a real; fraction is set for the digits after .
+void numDigit(Context *ctx, int digit, int fraction)
+{
+    if (ctx->lexNum.digits == 0 && digit == 0)
+    {
+        ctx->lexNum.exponent -= fraction; // a leading zero
+    }
+    else if (ctx->lexNum.digits < 19)
+    {
+        ctx->lexNum.mantissa = ctx->lexNum.mantissa * 10 + digit;
+        ctx->lexNum.digits++;
+        ctx->lexNum.exponent -= fraction;
+    }
+    else
+    {
+        ctx->lexNum.exponent += !fraction;
+        ctx->lexNum.truncated |= digit != 0;
+    }
+}
+
+void numExponent(Context *ctx, int digit)
+{
+    if (ctx->lexNum.expValue < 100000) // far beyond the range of double
+        ctx->lexNum.expValue = ctx->lexNum.expValue * 10 + digit;
+}
+
+// The 128 bit approximations of the powers of 5 from 5^-342 to 5^308, used by
+// decimalToDouble(). The powers of 5 are normalized to have the bit 127 set;
+// the positive ones are truncated and the negative ones are 2^b / 5^-q + 1,
+// truncated, as in the Eisel-Lemire algorithm (Lemire, "Number parsing at a
+// gigabyte per second", 2021). They are computed exactly on first use.
+#define POW5_MIN -342
+#define POW5_MAX 308
+#define BIG_LIMBS 16
+
+unsigned long long *powersOfFive = NULL; // hi, lo for each power
+
+typedef struct
+{
+    unsigned long long limb[BIG_LIMBS]; // little endian
+} Big;
+
+int bigBits(const Big *a)
+{
+    int i;
+    for (i = BIG_LIMBS - 1; i >= 0; i--)
+    {
+        if (a->limb[i])
+            return i * 64 + 64 - __builtin_clzll(a->limb[i]);
+    }
+    return 0;
+}
+
+int bigBit(const Big *a, int bit)
+{
+    return (a->limb[bit / 64] >> (bit % 64)) & 1;
+}
+
+void bigMul5(Big *a)
+{
+    unsigned long long carry = 0;
+    int i;
+    for (i = 0; i < BIG_LIMBS; i++)
+    {
+        unsigned __int128 p = (unsigned __int128)a->limb[i] * 5 + carry;
+        a->limb[i] = (unsigned long long)p;
+        carry = p >> 64;
+    }
+}
+
+// a = a * 2 + bit
+void bigShift1(Big *a, int bit)
+{
+    int i;
+    for (i = BIG_LIMBS - 1; i > 0; i--)
+        a->limb[i] = a->limb[i] << 1 | a->limb[i - 1] >> 63;
+    a->limb[0] = a->limb[0] << 1 | bit;
+}
+
+// a = a - b if a >= b; returns if it was subtracted
+int bigSubIfGreater(Big *a, const Big *b)
+{
+    unsigned long long borrow = 0;
+    int i;
+    for (i = BIG_LIMBS - 1; i >= 0 && a->limb[i] == b->limb[i]; i--)
+    {
+    }
+    if (i >= 0 && a->limb[i] < b->limb[i])
+        return 0;
+    for (i = 0; i < BIG_LIMBS; i++)
+    {
+        unsigned long long d = a->limb[i] - b->limb[i] - borrow;
+        borrow = a->limb[i] < b->limb[i] || (a->limb[i] == b->limb[i] && borrow);
+        a->limb[i] = d;
+    }
+    return 1;
+}
+
+// stores the 128 most significant bits of a, shifted up if a is shorter
+void bigTop128(const Big *a, unsigned long long *hi, unsigned long long *lo)
+{
+    int n = bigBits(a), i;
+    *hi = *lo = 0;
+    for (i = 0; i < 128; i++)
+    {
+        int bit = n - 1 - i >= 0 ? bigBit(a, n - 1 - i) : 0;
+        if (i < 64)
+            *hi |= (unsigned long long)bit << (63 - i);
+        else
+            *lo |= (unsigned long long)bit << (127 - i);
+    }
+}
+
+void initPowersOfFive()
+{
+    Big power, quotient, rest;
+    int q, i, z, b;
+    unsigned long long *p;
+    powersOfFive = (unsigned long long *)malloc(2 * (POW5_MAX - POW5_MIN + 1) * sizeof(unsigned long long));
+    if (powersOfFive == NULL)
+        err("not enough memory");
+    memset(&power, 0, sizeof(power));
+    power.limb[0] = 1;
+    for (q = 0; q >= POW5_MIN; q--) // power = 5^-q
+    {
+        p = &powersOfFive[2 * (q - POW5_MIN)];
+        if (q == 0)
+        {
+            bigTop128(&power, &p[0], &p[1]);
+        }
+        else
+        {
+            // quotient = 2^b / power + 1, with the division done bit by bit,
+            // starting after the first z bits, whose rest is 2^(z-1)
+            z = bigBits(&power);
+            b = q >= -27 ? z + 127 : 2 * z + 128;
+            memset(&quotient, 0, sizeof(quotient));
+            memset(&rest, 0, sizeof(rest));
+            rest.limb[(z - 1) / 64] = 1ULL << ((z - 1) % 64);
+            for (i = b - z; i >= 0; i--)
+            {
+                bigShift1(&rest, 0);
+                bigShift1(&quotient, bigSubIfGreater(&rest, &power));
+            }
+            for (i = 0; i < BIG_LIMBS && ++quotient.limb[i] == 0; i++)
+            {
+            }
+            bigTop128(&quotient, &p[0], &p[1]);
+        }
+        bigMul5(&power);
+    }
+    memset(&power, 0, sizeof(power));
+    power.limb[0] = 1;
+    for (q = 0; q <= POW5_MAX; q++)
+    {
+        p = &powersOfFive[2 * (q - POW5_MIN)];
+        bigTop128(&power, &p[0], &p[1]);
+        bigMul5(&power);
+    }
+}
+
+// Converts w * 10^q to the nearest double. Returns 0 if it could not decide
+// the correct rounding (or for subnormals), when strtod must be used instead.
+int decimalToDouble(unsigned long long w, int q, double *result)
+{
+    static const double exact[] = {1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11,
+                                   1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22};
+    unsigned long long hi, lo, mantissa, bits;
+    unsigned __int128 product;
+    int lz, upperbit, power2, index;
+
+    // Clinger's fast path: w and 10^|q| are exact doubles, so there is only one rounding
+    if (w <= 1ULL << 53 && q >= -22 && q <= 22)
+    {
+        *result = q < 0 ? w / exact[-q] : w * exact[q];
+        return 1;
+    }
+    if (w == 0 || q < POW5_MIN)
+    {
+        *result = 0.0;
+        return 1;
+    }
+    if (q > POW5_MAX)
+    {
+        *result = HUGE_VAL;
+        return 1;
+    }
+    if (powersOfFive == NULL)
+        initPowersOfFive();
+
+    lz = __builtin_clzll(w);
+    w <<= lz;
+    index = 2 * (q - POW5_MIN);
+    product = (unsigned __int128)w * powersOfFive[index];
+    hi = product >> 64;
+    lo = (unsigned long long)product;
+    if ((hi & 0x1FF) == 0x1FF) // the 55 significant bits may be wrong; use the low half of the power
+    {
+        unsigned long long hi2 = ((unsigned __int128)w * powersOfFive[index + 1]) >> 64;
+        lo += hi2;
+        if (hi2 > lo)
+            hi++;
+        if (lo == 0xFFFFFFFFFFFFFFFFULL && (q < -27 || q > 55))
+            return 0;
+    }
+    upperbit = hi >> 63;
+    mantissa = hi >> (upperbit + 9);
+    power2 = (((152170 + 65536) * q) >> 16) + 63 + upperbit - lz + 1023;
+    if (power2 <= 0)
+        return 0;
+    // halfway between two doubles: round to even instead of up
+    if (lo <= 1 && q >= -4 && q <= 23 && (mantissa & 3) == 1 && (mantissa << (upperbit + 9)) == hi)
+        mantissa &= ~1ULL;
+    mantissa += mantissa & 1;
+    mantissa >>= 1;
+    if (mantissa >= 2ULL << 52)
+    {
+        mantissa = 1ULL << 52;
+        power2++;
+    }
+    mantissa &= ~(1ULL << 52);
+    if (power2 >= 0x7FF)
+    {
+        *result = HUGE_VAL;
+        return 1;
+    }
+    bits = mantissa | (unsigned long long)power2 << 52;
+    memcpy(result, &bits, sizeof(bits));
+    return 1;
+}
+
+// Walks the text of a number like the lexer states do; used by the table
+// lexer, which has no actions on each digit
+void scanNumber(Context *ctx, const char *p, const char *end)
+{
+    int base = 10, fraction = 0;
+    startNumber(ctx);
+    if (p[0] == '0' && (p[1] == 'x' || p[1] == 'X'))
+    {
+        for (p += 2; p < end; p++)
+            numInt(ctx, 16, *p <= '9' ? *p - '0' : (*p | 0x20) - 'a' + 10);
+        return;
+    }
+    if (p[0] == '0')
+        base = 8;
+    for (; p < end && *p != 'e' && *p != 'E'; p++)
+    {
+        if (*p == '.')
+        {
+            fraction = 1;
+            continue;
+        }
+        numInt(ctx, base, *p - '0');
+        numDigit(ctx, *p - '0', fraction);
+    }
+    if (p < end)
+    {
+        p++;
+        if (*p == '+' || *p == '-')
+            ctx->lexNum.expSign = *p++ == '-' ? -1 : 1;
+        for (; p < end; p++)
+            numExponent(ctx, *p - '0');
+    }
+}
+
+void startText(Context *ctx)
+{
+    if (ctx->lexTextCapacity == 0) // so that an empty text is not NULL
+        ctx->lexText = (char *)growArray(ctx->lexText, &ctx->lexTextCapacity, 256, sizeof(char));
+    ctx->nLexText = 0;
+}
+
+void textChar(Context *ctx, char ch)
+{
+    if (ctx->nLexText == ctx->lexTextCapacity)
+        ctx->lexText = (char *)growArray(ctx->lexText, &ctx->lexTextCapacity, 256, sizeof(char));
+    ctx->lexText[ctx->nLexText++] = ch;
+}
+
+// decodes the text between the quotes of a complete char or string literal
+void scanText(Context *ctx, const char *p, const char *end)
+{
+    startText(ctx);
+    for (; p < end; p++)
+    {
+        if (*p == '\\')
+            p++, textChar(ctx, escaped(*p));
+        else
+            textChar(ctx, *p);
+    }
+}
+
+// The tokens which need more than their code, emitted when the lexer
+// reaches their final state; pStartCh..pCrtCh is the token text
+
+void emitId(Context *ctx)
+{
+    int length = ctx->pCrtCh - ctx->pStartCh;
+    int code = keywordCode(ctx->pStartCh, length);
+    if (code == ID)
+    {
+        int name = intern(ctx, ctx->pStartCh, length);
+        int tk = addTk(ctx, ID);
+        ctx->tokens.aux[tk] = name;
+    }
+    else
+    {
+        addTk(ctx, code);
+    }
+}
+
+// the numbers use the value accumulated in lexNum
+void emitInt(Context *ctx)
+{
+    addLit(ctx, CT_INT)->i = ctx->lexNum.overflow ? LONG_MAX : (long)ctx->lexNum.value; // saturated like strtol
+}
+
+void emitReal(Context *ctx)
+{
+    double r;
+    if (ctx->lexNum.truncated || !decimalToDouble(ctx->lexNum.mantissa, ctx->lexNum.exponent + ctx->lexNum.expSign * ctx->lexNum.expValue, &r))
+        r = strtod(ctx->pStartCh, NULL);
+    addLit(ctx, CT_REAL)->r = r;
+}
+
+// the char and string literals use the text decoded in lexText
+void emitChar(Context *ctx)
+{
+    addLit(ctx, CT_CHAR)->i = ctx->lexText[0];
+}
+
+void emitString(Context *ctx)
+{
+    int name = intern(ctx, ctx->lexText, ctx->nLexText);
+    int tk = addTk(ctx, CT_STRING);
+    ctx->tokens.aux[tk] = name;
+}
+
+// the final '\0'; in streaming mode the end of a chunk is not the end of the input
+void emitEnd(Context *ctx)
+{
+    if (!ctx->streamEof && ctx->pCrtCh >= ctx->streamEnd)
+        longjmp(ctx->lexJump, 1);
+    ctx->pStartCh = ctx->pCrtCh;
+    addTk(ctx, END);
+}
+
+// states 24..29 are the second character of & | ! = < >
+#define LEX_STATES 30
+
+// The error of each state of the lexers, so that getNextToken and the
+// LX_ERROR moves of getNextTokenTable report the same one. The messages are
+// formats for the character at which the error is found.
+const char *lexMessages[LEX_STATES] = {
+    [0] = "invalid character '%c'",
+    [7] = "State 7: Expected . or exponent after the digits 8 or 9 of an octal number",
+    [8] = "After '.' a digit is expected",
+    [10] = "State 10: Expected number, + or - sign",
+    [11] = "State 11: Expected digit after exponent sign",
+    [14] = "State 14: Expected character",
+    [15] = "State 15: Char expected",
+    [16] = "State 16: Expected character",
+    [17] = "State 17: Unterminated string",
+    [18] = "Not escaped char",
+    [21] = "State 21: Unterminated comment",
+    [22] = "State 22: Unterminated comment",
+    [24] = "Expected binary operator &&",
+    [25] = "Expected binary operator ||",
+};
+
+// Lexes from input, which is in pInput, up to the final '\0' and returns 0,
+// or up to the first token boundary from lexLimit and returns 1
+int getNextToken(Context *ctx, const char *input)
+{
+    int state = 0;
+    char ch;
+    ctx->pCrtCh = input;
+    while (1)
+    {
+        ch = (*ctx->pCrtCh);
+        switch (state)
+        {
+        case 0:
+            ctx->pStartCh = ctx->pCrtCh;
+            if (ctx->pCrtCh >= ctx->lexLimit)
+                return 1;
+            if (ch == ' ' || ch == '\n' || ch == '\t' || ch == '\r')
+            {
+                ctx->pCrtCh = skipBlanks(ctx, ctx->pCrtCh);
+            }
+            else if (isalpha(ch) || ch == '_')
+            {
+                ctx->pCrtCh++;
+                state = 1;
+            }
+            else if (ch >= '1' && ch <= '9')
+            {
+                startNumber(ctx);
+                numInt(ctx, 10, ch - '0');
+                numDigit(ctx, ch - '0', 0);
+                ctx->pCrtCh++;
+                state = 3;
+            }
+            else if (ch == '0')
+            {
+                startNumber(ctx);
+                ctx->pCrtCh++;
+                state = 5;
+            }
+            else if (ch == '/') {
+                ctx->pCrtCh++;
+                state = 20;
+            }
+            else if(ch == '\'') {
+					startText(ctx);
+					ctx->pCrtCh++;
+					state = 14;
+				}
+			else if(ch == '\"') {
+					startText(ctx);
+					ctx->pCrtCh++;
+					state = 17;
+				}
+            else if (ch == ',')
+            {
+                ctx->pCrtCh++;
+                addTk(ctx, COMMA);
+            }
+            else if (ch == ';')
+            {
+                ctx->pCrtCh++;
+                addTk(ctx, SEMICOLON);
+            }
+            else if (ch == '(')
+            {
+                ctx->pCrtCh++;
+                addTk(ctx, LPAR);
+            }
+            else if (ch == ')')
+            {
+                ctx->pCrtCh++;
+                addTk(ctx, RPAR);
+            }
+            else if (ch == '[')
+            {
+                ctx->pCrtCh++;
+                addTk(ctx, LBRACKET);
+            }
+            else if (ch == ']')
+            {
+                ctx->pCrtCh++;
+                addTk(ctx, RBRACKET);
+            }
+            else if (ch == '{')
+            {
+                ctx->pCrtCh++;
+                addTk(ctx, LACC);
+            }
+            else if (ch == '}')
+            {
+                ctx->pCrtCh++;
+                addTk(ctx, RACC);
+            }
+            else if (ch == '+')
+            {
+                ctx->pCrtCh++;
+                addTk(ctx, ADD);
+            }
+            else if (ch == '-')
+            {
+                ctx->pCrtCh++;
+                addTk(ctx, SUB);
+            }
+            else if (ch == '*')
+            {
+                ctx->pCrtCh++;
+                addTk(ctx, MUL);
+            }
+            else if (ch == '.')
+            {
+                ctx->pCrtCh++;
+                addTk(ctx, DOT);
+            }
+            else if (ch == '&')
+            {
+                ctx->pCrtCh++;
+                ch = *ctx->pCrtCh;
+                if (ch == '&')
+                {
+                    ctx->pCrtCh++;
+                    addTk(ctx, AND);
+                }
+                else {
+                    lexerr(ctx, lexMessages[24], ch);
+                }
+            }
+            else if (ch == '|')
+            {
+                ctx->pCrtCh++;
+                ch = *ctx->pCrtCh;
+                if (ch == '|')
+                {
+                    ctx->pCrtCh++;
+                    addTk(ctx, OR);
+                }
+                else
+                    lexerr(ctx, lexMessages[25], ch);
+            }
+            else if (ch == '!')
+            {
+                ctx->pCrtCh++;
+                ch = *ctx->pCrtCh;
+                if (ch == '=')
+                {
+                    ctx->pCrtCh++;
+                    addTk(ctx, NOTEQ);
+                }
+                else
+                {
+                    addTk(ctx, NOT);
+                }
+            }
+            else if (ch == '=')
+            {
+                ctx->pCrtCh++;
+                ch = *ctx->pCrtCh;
+                if (ch == '=')
+                {
+                    ctx->pCrtCh++;
+                    addTk(ctx, EQUAL);
+                }
+                else
+                {
+                    addTk(ctx, ASSIGN);
+                }
+            }
+            else if (ch == '<')
+            {
+                ctx->pCrtCh++;
+                ch = *ctx->pCrtCh;
+                if (ch == '=')
+                {
+                    ctx->pCrtCh++;
+                    addTk(ctx, LESSEQ);
+                }
+                else
+                {
+                    addTk(ctx, LESS);
+                }
+            }
+            else if (ch == '>')
+            {
+                ctx->pCrtCh++;
+                ch = *ctx->pCrtCh;
+                if (ch == '=')
+                {
+                    ctx->pCrtCh++;
+                    addTk(ctx, GREATEREQ);
+                }
+                else
+                {
+                    addTk(ctx, GREATER);
+                }
+            }
+            else if (ch == '\0')
+            {
+                emitEnd(ctx);
+                return 0;
+            }
+            else {
+                lexerr(ctx, lexMessages[0], ch);
+            }
+            break;
+        case 1:
+            ctx->pCrtCh = skipIdent(ctx->pCrtCh);
+            state = 2;
+            break;
+        case 2:
+            emitId(ctx);
+            state = 0;
+            break;
+        case 3:
+            if (ch >= '0' && ch <= '9')
+            {
+                numInt(ctx, 10, ch - '0');
+                numDigit(ctx, ch - '0', 0);
+                ctx->pCrtCh++;
+                state = 3;
+            }
+            else if (ch == '.')
+            {
+                ctx->pCrtCh++;
+                state = 8;
+            }
+            else if (ch == 'e' || ch == 'E')
+            {
+                ctx->pCrtCh++;
+                state = 10;
+            }
+            else
+                state = 4;
+            break;
+        case 4:
+            emitInt(ctx);
+            state = 0;
+            break;
+        case 5:
+            if (ch >= '0' && ch <= '7')
+            {
+                numInt(ctx, 8, ch - '0');
+                numDigit(ctx, ch - '0', 0);
+                ctx->pCrtCh++;
+            }
             else if (ch == 'x' || ch == 'X')
             {
-                pCrtCh++;
-                state = 6;
+                ctx->pCrtCh++;
+                state = 6;
+            }
+            else if (ch == '.')
+            {
+                ctx->pCrtCh++;
+                state = 8;
+            }
+            else if (ch == 'e' || ch == 'E')
+            {
+                ctx->pCrtCh++;
+                state = 10;
+            }
+            else if (ch >= '8' && ch <= '9')
+            {
+                numDigit(ctx, ch - '0', 0);
+                ctx->pCrtCh++;
+                state = 7;
+            }
+            else
+                state = 4;
+            break;
+        case 6:
+            if (ch >= '0' && ch <= '9')
+            {
+                numInt(ctx, 16, ch - '0');
+                ctx->pCrtCh++;
+            }
+            else if ((ch >= 'a' && ch <= 'f') || (ch >= 'A' && ch <= 'F'))
+            {
+                numInt(ctx, 16, (ch | 0x20) - 'a' + 10);
+                ctx->pCrtCh++;
+            }
+            else
+            {
+                state = 4;
+            }
+            break;
+        case 7: // 0 followed by decimal digits is valid only as a real
+            if (ch >= '0' && ch <= '9')
+            {
+                numDigit(ctx, ch - '0', 0);
+                ctx->pCrtCh++;
+            }
+            else if (ch == '.')
+            {
+                ctx->pCrtCh++;
+                state = 8;
+            }
+            else if (ch == 'e' || ch == 'E')
+            {
+                ctx->pCrtCh++;
+                state = 10;
+            }
+            else
+                lexerr(ctx, lexMessages[7], ch);
+            break;
+        case 8:
+            if (ch >= '0' && ch <= '9') {
+                numDigit(ctx, ch - '0', 1);
+                ctx->pCrtCh++;
+                state = 9;
+            } else {
+                lexerr(ctx, lexMessages[8], ch);
+            }
+            break;
+        case 9:
+            if (ch >= '0' && ch <= '9') {
+                numDigit(ctx, ch - '0', 1);
+                ctx->pCrtCh++;
+            } else if (ch == 'e' || ch == 'E') {
+                ctx->pCrtCh++;
+                state = 10;
+            } else {
+                state = 13;
+            }
+            break;
+        case 10:
+            if (ch == '+' || ch == '-') {
+                ctx->lexNum.expSign = ch == '-' ? -1 : 1;
+                ctx->pCrtCh++;
+                state = 11;
+            } else if (ch >= '0' && ch <= '9') {
+                numExponent(ctx, ch - '0');
+                ctx->pCrtCh++;
+                state = 12;
+            } else {
+                lexerr(ctx, lexMessages[10], ch);
+            }
+            break;
+        case 11:
+            if (ch >= '0' && ch <= '9') {
+                numExponent(ctx, ch - '0');
+                ctx->pCrtCh++;
+                state = 12;
+            } else {
+                lexerr(ctx, lexMessages[11], ch);
+            }
+            break;
+        case 12:
+            if (ch >= '0' && ch <= '9') {
+                numExponent(ctx, ch - '0');
+                ctx->pCrtCh++;
+                state = 12;
+            } else {
+                state = 13;
+            }
+            break;
+        case 13:
+            emitReal(ctx);
+            state = 0;
+            break;
+        case 14:
+            if (ch == '\\')
+            {
+                ctx->pCrtCh++;
+                state = 15;
+            }
+            else if (ch != '\'' && ch != '\0')
+            {
+                textChar(ctx, ch);
+                ctx->pCrtCh++;
+                state = 16;
+            }
+            else
+                lexerr(ctx, lexMessages[14], ch);
+            break;
+        case 15:
+            if (ch != '\0' && strchr("abfnrtv'?\"\\0", ch))
+            {
+                textChar(ctx, escaped(ch));
+                ctx->pCrtCh++;
+                state = 16;
+            }
+            else
+            {
+                lexerr(ctx, lexMessages[15], ch);
+            }
+            break;
+        case 16:
+            if (ch == '\'')
+            {
+                ctx->pCrtCh++;
+                emitChar(ctx);
+                state = 0;
+            }
+            else
+                lexerr(ctx, lexMessages[16], ch);
+            break;
+
+        case 17:
+            if (ch == '\\')
+            {
+                ctx->pCrtCh++;
+                state = 18;
+            }
+            else if (ch == '\"')
+            {
+                state = 19;
+            }
+            else if (ch == '\0')
+            {
+                lexerr(ctx, lexMessages[17], ch);
+            }
+            else
+            {
+                textChar(ctx, ch);
+                ctx->pCrtCh++;
+            }
+            break;
+        case 18:
+            if (ch != '\0' && strchr("abfnrtv'?\"\\0", ch))
+            {
+                textChar(ctx, escaped(ch));
+                ctx->pCrtCh++;
+                state = 17;
+            }
+            else
+                lexerr(ctx, lexMessages[18], ch);
+            break;
+        case 19:
+            ctx->pCrtCh++;
+            emitString(ctx);
+            state = 0;
+            break;
+
+        case 20:
+				if(ch == '*') {
+					ctx->pCrtCh++;
+					state = 21; 
+				}
+				else if(ch == '/'){
+					ctx->pCrtCh++;
+					state = 23; 
+				}
+				else {
+					addTk(ctx, DIV);
+					state = 0;
+				}
+				break;
+			case 21:
+				if(ch == '*'){
+					ctx->pCrtCh++;
+					state = 22;
+				}
+				else if (ch == '\n'){
+					addLine(ctx);
+					ctx->pCrtCh++;
+				}
+				else if (ch == '\0'){
+					lexerr(ctx, lexMessages[21], ch);
+				}
+				else{
+					ctx->pCrtCh = skipComment(ctx, ctx->pCrtCh);
+                    state = 21;
+                }
+				break;
+			case 22:
+				if(ch == '/') {
+					ctx->pCrtCh++;
+					state = 0; 
+				}
+				else if(ch == '*') {
+					ctx->pCrtCh++;
+                    state = 22;
+				}
+				else if (ch == '\n'){
+					addLine(ctx);
+					ctx->pCrtCh++;
+					state = 21;
+				}
+				else if (ch != '\0'){
+					ctx->pCrtCh++;
+					state = 21;
+				}
+				else
+					lexerr(ctx, lexMessages[22], ch);
+				break;
+			case 23:
+				if(ch !='\n' && ch !='\r' && ch !='\0'){
+					ctx->pCrtCh = skipLine(ctx->pCrtCh);
+				}
+				else if(ch=='\n') {
+					addLine(ctx);
+					ctx->pCrtCh++;
+					state = 0;
+				}
+				else if(ch=='\r') {
+					ctx->pCrtCh++;
+					state = 0;
+				}
+				else
+				{
+					emitEnd(ctx); // not in state 0, so that in streaming mode the comment is analyzed again
+					return 0;
+				}
+				break;
+        default:
+            lexerr(ctx, "invalid lexer state %d at character '%c'", state, ch);
+        }
+    }
+    return 0;
+}
+
+// The table driven lexer. It runs the same automaton as getNextToken, with
+// the states 0..23 described once by lexRules. The character classes and
+// the state x class transition table are built from the rules on first use:
+// the bytes which have the same moves in every state share a class.
+
+enum { LX_CONSUME = 1, LX_LINE = 2, LX_EMIT = 4, LX_ERROR = 8 };
+
+typedef struct
+{
+    unsigned char next;  // the next state
+    unsigned char flags; // LX_*
+    unsigned char emit;  // the code of the token emitted by LX_EMIT
+} LexMove;
+
+typedef struct
+{
+    unsigned char state;
+    const char *chars;   // the characters of the rule, NULL for all the characters
+    int nChars;
+    LexMove move;
+} LexRule;
+
+#define LEX_MAX_CLASSES 64
+
+#define LEX_DIGITS "0123456789"
+#define LEX_LETTERS "abcdefghijklmnopqrstuvwxyzABCDEFGHIJKLMNOPQRSTUVWXYZ_"
+#define LEX_ESCAPES "abfnrtv'?\"\\0"
+// the rules of a state are applied in order, so LEX_ALL comes first
+#define LEX_ALL(state, next, flags, emit) {state, NULL, 0, {next, flags, emit}}
+#define LEX_ON(state, chars, next, flags, emit) {state, chars, sizeof(chars) - 1, {next, flags, emit}}
+#define LEX_TOKEN(ch, code) LEX_ON(0, ch, 0, LX_CONSUME | LX_EMIT, code)
+
+const LexRule lexRules[] = {
+    LEX_ALL(0, 0, LX_ERROR, 0),
+    LEX_ON(0, "\n", 0, LX_CONSUME | LX_LINE, 0),
+    LEX_ON(0, " \t\r", 0, LX_CONSUME, 0),
+    LEX_ON(0, LEX_LETTERS, 1, LX_CONSUME, 0),
+    LEX_ON(0, "123456789", 3, LX_CONSUME, 0),
+    LEX_ON(0, "0", 5, LX_CONSUME, 0),
+    LEX_ON(0, "'", 14, LX_CONSUME, 0),
+    LEX_ON(0, "\"", 17, LX_CONSUME, 0),
+    LEX_ON(0, "/", 20, LX_CONSUME, 0),
+    LEX_ON(0, "&", 24, LX_CONSUME, 0),
+    LEX_ON(0, "|", 25, LX_CONSUME, 0),
+    LEX_ON(0, "!", 26, LX_CONSUME, 0),
+    LEX_ON(0, "=", 27, LX_CONSUME, 0),
+    LEX_ON(0, "<", 28, LX_CONSUME, 0),
+    LEX_ON(0, ">", 29, LX_CONSUME, 0),
+    LEX_ON(0, "\0", 0, LX_EMIT, END),
+    LEX_TOKEN(",", COMMA),
+    LEX_TOKEN(";", SEMICOLON),
+    LEX_TOKEN("(", LPAR),
+    LEX_TOKEN(")", RPAR),
+    LEX_TOKEN("[", LBRACKET),
+    LEX_TOKEN("]", RBRACKET),
+    LEX_TOKEN("{", LACC),
+    LEX_TOKEN("}", RACC),
+    LEX_TOKEN("+", ADD),
+    LEX_TOKEN("-", SUB),
+    LEX_TOKEN("*", MUL),
+    LEX_TOKEN(".", DOT),
+    // identifiers; the final state 2 is merged in the last move of state 1
+    LEX_ALL(1, 0, LX_EMIT, ID),
+    LEX_ON(1, LEX_LETTERS LEX_DIGITS, 1, LX_CONSUME, 0),
+    LEX_ALL(2, 0, LX_EMIT, ID),
+    // numbers; the final states 4 and 13 are merged in the same way
+    LEX_ALL(3, 0, LX_EMIT, CT_INT),
+    LEX_ON(3, LEX_DIGITS, 3, LX_CONSUME, 0),
+    LEX_ON(3, ".", 8, LX_CONSUME, 0),
+    LEX_ON(3, "eE", 10, LX_CONSUME, 0),
+    LEX_ALL(4, 0, LX_EMIT, CT_INT),
+    LEX_ALL(5, 0, LX_EMIT, CT_INT),
+    LEX_ON(5, "01234567", 5, LX_CONSUME, 0),
+    LEX_ON(5, "xX", 6, LX_CONSUME, 0),
+    LEX_ON(5, ".", 8, LX_CONSUME, 0),
+    LEX_ON(5, "eE", 10, LX_CONSUME, 0),
+    LEX_ON(5, "89", 7, LX_CONSUME, 0),
+    LEX_ALL(6, 0, LX_EMIT, CT_INT),
+    LEX_ON(6, LEX_DIGITS "abcdefABCDEF", 6, LX_CONSUME, 0),
+    LEX_ALL(7, 0, LX_ERROR, 0),
+    LEX_ON(7, LEX_DIGITS, 7, LX_CONSUME, 0),
+    LEX_ON(7, ".", 8, LX_CONSUME, 0),
+    LEX_ON(7, "eE", 10, LX_CONSUME, 0),
+    LEX_ALL(8, 0, LX_ERROR, 0),
+    LEX_ON(8, LEX_DIGITS, 9, LX_CONSUME, 0),
+    LEX_ALL(9, 0, LX_EMIT, CT_REAL),
+    LEX_ON(9, LEX_DIGITS, 9, LX_CONSUME, 0),
+    LEX_ON(9, "eE", 10, LX_CONSUME, 0),
+    LEX_ALL(10, 0, LX_ERROR, 0),
+    LEX_ON(10, "+-", 11, LX_CONSUME, 0),
+    LEX_ON(10, LEX_DIGITS, 12, LX_CONSUME, 0),
+    LEX_ALL(11, 0, LX_ERROR, 0),
+    LEX_ON(11, LEX_DIGITS, 12, LX_CONSUME, 0),
+    LEX_ALL(12, 0, LX_EMIT, CT_REAL),
+    LEX_ON(12, LEX_DIGITS, 12, LX_CONSUME, 0),
+    LEX_ALL(13, 0, LX_EMIT, CT_REAL),
+    // characters
+    LEX_ALL(14, 16, LX_CONSUME, 0),
+    LEX_ON(14, "\\", 15, LX_CONSUME, 0),
+    LEX_ON(14, "'\0", 0, LX_ERROR, 0),
+    LEX_ALL(15, 0, LX_ERROR, 0),
+    LEX_ON(15, LEX_ESCAPES, 16, LX_CONSUME, 0),
+    LEX_ALL(16, 0, LX_ERROR, 0),
+    LEX_ON(16, "'", 0, LX_CONSUME | LX_EMIT, CT_CHAR),
+    // strings; the final state 19 is merged in the move of state 17 on "
+    LEX_ALL(17, 17, LX_CONSUME, 0),
+    LEX_ON(17, "\\", 18, LX_CONSUME, 0),
+    LEX_ON(17, "\"", 0, LX_CONSUME | LX_EMIT, CT_STRING),
+    LEX_ON(17, "\0", 0, LX_ERROR, 0),
+    LEX_ALL(18, 0, LX_ERROR, 0),
+    LEX_ON(18, LEX_ESCAPES, 17, LX_CONSUME, 0),
+    LEX_ALL(19, 0, LX_CONSUME | LX_EMIT, CT_STRING),
+    // DIV and comments
+    LEX_ALL(20, 0, LX_EMIT, DIV),
+    LEX_ON(20, "*", 21, LX_CONSUME, 0),
+    LEX_ON(20, "/", 23, LX_CONSUME, 0),
+    LEX_ALL(21, 21, LX_CONSUME, 0),
+    LEX_ON(21, "*", 22, LX_CONSUME, 0),
+    LEX_ON(21, "\n", 21, LX_CONSUME | LX_LINE, 0),
+    LEX_ON(21, "\0", 0, LX_ERROR, 0),
+    LEX_ALL(22, 21, LX_CONSUME, 0),
+    LEX_ON(22, "/", 0, LX_CONSUME, 0),
+    LEX_ON(22, "*", 22, LX_CONSUME, 0),
+    LEX_ON(22, "\n", 21, LX_CONSUME | LX_LINE, 0),
+    LEX_ON(22, "\0", 0, LX_ERROR, 0),
+    LEX_ALL(23, 23, LX_CONSUME, 0),
+    LEX_ON(23, "\n", 0, LX_CONSUME | LX_LINE, 0),
+    LEX_ON(23, "\r", 0, LX_CONSUME, 0),
+    LEX_ON(23, "\0", 0, LX_EMIT, END),
+    // the operators of one or two characters
+    LEX_ALL(24, 0, LX_ERROR, 0),
+    LEX_ON(24, "&", 0, LX_CONSUME | LX_EMIT, AND),
+    LEX_ALL(25, 0, LX_ERROR, 0),
+    LEX_ON(25, "|", 0, LX_CONSUME | LX_EMIT, OR),
+    LEX_ALL(26, 0, LX_EMIT, NOT),
+    LEX_ON(26, "=", 0, LX_CONSUME | LX_EMIT, NOTEQ),
+    LEX_ALL(27, 0, LX_EMIT, ASSIGN),
+    LEX_ON(27, "=", 0, LX_CONSUME | LX_EMIT, EQUAL),
+    LEX_ALL(28, 0, LX_EMIT, LESS),
+    LEX_ON(28, "=", 0, LX_CONSUME | LX_EMIT, LESSEQ),
+    LEX_ALL(29, 0, LX_EMIT, GREATER),
+    LEX_ON(29, "=", 0, LX_CONSUME | LX_EMIT, GREATEREQ),
+};
+
+unsigned char lexClass[256];                   // the class of each character
+LexMove lexTable[LEX_STATES][LEX_MAX_CLASSES]; // the moves for each state and class
+int nLexClasses = 0;
+
+void initLexTable()
+{
+    static LexMove moves[LEX_STATES][256];
+    int representative[LEX_MAX_CLASSES];
+    size_t r;
+    int state, c, k, i;
+    for (r = 0; r < sizeof(lexRules) / sizeof(lexRules[0]); r++)
+    {
+        const LexRule *rule = &lexRules[r];
+        if (rule->chars == NULL)
+        {
+            for (c = 0; c < 256; c++)
+                moves[rule->state][c] = rule->move;
+        }
+        else
+        {
+            for (i = 0; i < rule->nChars; i++)
+                moves[rule->state][(unsigned char)rule->chars[i]] = rule->move;
+        }
+    }
+    for (c = 0; c < 256; c++)
+    {
+        for (k = 0; k < nLexClasses; k++)
+        {
+            for (state = 0; state < LEX_STATES; state++)
+            {
+                if (memcmp(&moves[state][c], &moves[state][representative[k]], sizeof(LexMove)))
+                    break;
+            }
+            if (state == LEX_STATES)
+                break;
+        }
+        if (k == nLexClasses)
+        {
+            if (nLexClasses == LEX_MAX_CLASSES)
+                err("too many character classes in the lexer rules");
+            representative[nLexClasses++] = c;
+        }
+        lexClass[c] = k;
+    }
+    for (state = 0; state < LEX_STATES; state++)
+    {
+        for (k = 0; k < nLexClasses; k++)
+            lexTable[state][k] = moves[state][representative[k]];
+    }
+}
+
+int getNextTokenTable(Context *ctx, const char *input)
+{
+    int state = 0;
+    if (nLexClasses == 0)
+        initLexTable();
+    ctx->pCrtCh = input;
+    ctx->pStartCh = input;
+    while (1)
+    {
+        const LexMove *move = &lexTable[state][lexClass[(unsigned char)*ctx->pCrtCh]];
+        if (state == 0)
+        {
+            ctx->pStartCh = ctx->pCrtCh;
+            if (ctx->pCrtCh >= ctx->lexLimit)
+                return 1;
+        }
+        if (move->flags & LX_LINE)
+            addLine(ctx);
+        ctx->pCrtCh += move->flags & LX_CONSUME;
+        if (move->flags & (LX_EMIT | LX_ERROR))
+        {
+            if (move->flags & LX_ERROR)
+                lexerr(ctx, lexMessages[state], *ctx->pCrtCh);
+            switch (move->emit)
+            {
+            case ID:
+                emitId(ctx);
+                break;
+            case CT_INT:
+                scanNumber(ctx, ctx->pStartCh, ctx->pCrtCh);
+                emitInt(ctx);
+                break;
+            case CT_REAL:
+                scanNumber(ctx, ctx->pStartCh, ctx->pCrtCh);
+                emitReal(ctx);
+                break;
+            case CT_CHAR:
+                scanText(ctx, ctx->pStartCh + 1, ctx->pCrtCh - 1);
+                emitChar(ctx);
+                break;
+            case CT_STRING:
+                scanText(ctx, ctx->pStartCh + 1, ctx->pCrtCh - 1);
+                emitString(ctx);
+                break;
+            case END:
+                emitEnd(ctx);
+                return 0;
+            default:
+                addTk(ctx, move->emit);
+            }
+        }
+        state = move->next;
+    }
+}
+
+// Parallel lexing: the input is split in chunks which start at the beginning
+// of a line, and each chunk is lexed in its own thread up to the first token
+// boundary after its end. A chunk is lexed as code, but it may start inside a
+// comment or a literal, so the chunks are stitched in order: the main thread
+// lexes again from where the previous chunk ended until it reaches a token
+// which the chunk also has at the same offset. From there both lexers are in
+// the same state, so the rest of the chunk is taken. The main thread only
+// interns the distinct names of the chunk, in the order of the input, and
+// reserves the room of its tokens, literals and lines; the threads of the
+// chunks then copy them in parallel, mapping the names through the table of
+// their chunk. The result is the same as that of chunkLexer on the whole input.
+
+#define PARALLEL_MIN_CHUNK 262144
+
+int lexThreads = 1;                                        // set by -threads
+int (*chunkLexer)(Context *, const char *) = getNextToken; // the lexer run on each chunk
+
+typedef struct
+{
+    Context ctx;               // the state of the lexer of the chunk
+    const char *start, *limit; // the chunk
+    const char *end;           // where its lexer stopped, in state 0
+    int failed;                // the lexer found an error; end is after the last token
+    Context *main;             // the context its tokens are copied to
+    int *map;                  // the name in main of each name of the chunk, NULL if the chunk is not taken
+    int first, firstLiteral, firstLine; // the first token, literal and line taken from the chunk
+    int tokens, literals, lines;        // where they are copied to in main
+    pthread_t thread;
+} LexChunk;
+
+void *lexChunk(void *arg)
+{
+    LexChunk *c = (LexChunk *)arg;
+    Context *ctx = &c->ctx;
+    ctx->lexLimit = c->limit;
+    ctx->lexSpeculative = 1;
+    if (setjmp(ctx->lexJump) == 0)
+    {
+        chunkLexer(ctx, c->start);
+        c->end = ctx->pCrtCh;
+    }
+    else
+    {
+        c->failed = 1;
+        c->end = ctx->tokens.n ? ctx->pInput + ctx->tokens.offset[ctx->tokens.n - 1] + ctx->tokens.length[ctx->tokens.n - 1] : c->start;
+        while (ctx->nLines > 0 && ctx->pInput + ctx->lines[ctx->nLines - 1] >= c->end)
+            ctx->nLines--;
+    }
+    return NULL;
+}
+
+// Returns the index of the token of t which starts at offset, or -1
+int tokenAt(const Tokens *t, unsigned int offset)
+{
+    int left = 0, right = t->n;
+    while (left < right)
+    {
+        int middle = (left + right) / 2;
+        if (t->offset[middle] < offset)
+            left = middle + 1;
+        else
+            right = middle;
+    }
+    return left < t->n && t->offset[left] == offset ? left : -1;
+}
+
+// Takes the tokens of the chunk from the index i and its lines from pos: their
+// names are interned and room is reserved for them, to be filled by copyChunk
+void takeChunk(Context *ctx, LexChunk *c, int i, const char *pos)
+{
+    int nTokens = c->ctx.tokens.n - i, nLiterals, nLines, j;
+    if ((c->map = (int *)calloc(c->ctx.nNames, sizeof(int))) == NULL)
+        err("not enough memory");
+    if (i == 0) // the names of the chunk are already in the order of their first use
+    {
+        for (j = 1; j < c->ctx.nNames; j++)
+            c->map[j] = intern(ctx, c->ctx.names[j].text, c->ctx.names[j].length);
+    }
+    else
+    {
+        for (j = i; j < c->ctx.tokens.n; j++)
+        {
+            int code = c->ctx.tokens.code[j], aux = c->ctx.tokens.aux[j];
+            if ((code == ID || code == CT_STRING) && c->map[aux] == 0)
+                c->map[aux] = intern(ctx, c->ctx.names[aux].text, c->ctx.names[aux].length);
+        }
+    }
+    c->main = ctx;
+    c->first = i;
+    c->firstLiteral = 1;
+    for (j = 0; j < i; j++)
+        c->firstLiteral += isLiteral(c->ctx.tokens.code[j]);
+    for (c->firstLine = 0; c->firstLine < c->ctx.nLines; c->firstLine++)
+    {
+        if (c->ctx.lines[c->firstLine] >= (unsigned int)(pos - ctx->pInput))
+            break;
+    }
+    nLiterals = c->ctx.nLiterals - c->firstLiteral;
+    nLines = c->ctx.nLines - c->firstLine;
+    reserveTokens(ctx, nTokens);
+    while (ctx->nLiterals + nLiterals > ctx->literalsCapacity)
+        ctx->literals = (Literal *)growArray(ctx->literals, &ctx->literalsCapacity, 256, sizeof(Literal));
+    while (ctx->nLines + nLines > ctx->linesCapacity)
+        ctx->lines = (unsigned int *)growArray(ctx->lines, &ctx->linesCapacity, 256, sizeof(*ctx->lines));
+    c->tokens = ctx->tokens.n;
+    c->literals = ctx->nLiterals;
+    c->lines = ctx->nLines;
+    ctx->tokens.n += nTokens;
+    ctx->nLiterals += nLiterals;
+    ctx->nLines += nLines;
+}
+
+// Copies the part of the chunk taken by takeChunk to the room reserved for it
+void *copyChunk(void *arg)
+{
+    LexChunk *c = (LexChunk *)arg;
+    Context *ctx = c->main;
+    const Tokens *from = &c->ctx.tokens;
+    int n = from->n - c->first, j;
+    memcpy(ctx->tokens.code + c->tokens, from->code + c->first, n * sizeof(*from->code));
+    memcpy(ctx->tokens.offset + c->tokens, from->offset + c->first, n * sizeof(*from->offset));
+    memcpy(ctx->tokens.length + c->tokens, from->length + c->first, n * sizeof(*from->length));
+    for (j = 0; j < n; j++)
+    {
+        int code = from->code[c->first + j];
+        unsigned int aux = from->aux[c->first + j];
+        if (code == ID || code == CT_STRING)
+            aux = c->map[aux];
+        else if (isLiteral(code))
+            aux = aux - c->firstLiteral + c->literals;
+        ctx->tokens.aux[c->tokens + j] = aux;
+    }
+    memcpy(ctx->literals + c->literals, c->ctx.literals + c->firstLiteral,
+           (c->ctx.nLiterals - c->firstLiteral) * sizeof(Literal));
+    memcpy(ctx->lines + c->lines, c->ctx.lines + c->firstLine, (c->ctx.nLines - c->firstLine) * sizeof(*ctx->lines));
+    return NULL;
+}
+
+void freeChunks(LexChunk *chunks, int n)
+{
+    int k;
+    for (k = 1; k < n; k++)
+    {
+        free(chunks[k].map);
+        freeContext(&chunks[k].ctx);
+    }
+    free(chunks);
+}
+
+// Lexes the input of ctx->inputSize bytes with up to lexThreads threads
+int parallelLex(Context *ctx, const char *input)
+{
+    size_t size = ctx->inputSize;
+    int n = size / PARALLEL_MIN_CHUNK, more, i, k;
+    volatile int joined = 0;
+    const char *end = input + size, *pos;
+    LexChunk *chunks;
+    jmp_buf onError;
+    if (n > lexThreads)
+        n = lexThreads;
+    if (n < 2)
+        return chunkLexer(ctx, input);
+    if (nLexClasses == 0) // initialized before they are shared
+        initLexTable();
+    if (powersOfFive == NULL)
+        initPowersOfFive();
+    if ((chunks = (LexChunk *)calloc(n, sizeof(LexChunk))) == NULL)
+        err("not enough memory");
+    for (k = 0; k < n; k++)
+    {
+        const char *p = memchr(input + size / n * k, '\n', size - size / n * k);
+        initContext(&chunks[k].ctx, ctx->filename, ctx->errors);
+        chunks[k].ctx.pInput = input;
+        chunks[k].start = k == 0 ? input : p ? p + 1 : end;
+    }
+    for (k = 1; k < n; k++)
+    {
+        chunks[k].limit = k + 1 < n ? chunks[k + 1].start : (const char *)UINTPTR_MAX;
+        if (pthread_create(&chunks[k].thread, NULL, lexChunk, &chunks[k]))
+            err("cannot create a thread");
+    }
+    // An error of the first chunk or of the stitching is reported from here,
+    // after the threads which still read the input are done
+    memcpy(onError, ctx->onError, sizeof(jmp_buf));
+    if (setjmp(ctx->onError))
+    {
+        for (k = 1; k < n && !joined; k++)
+            pthread_join(chunks[k].thread, NULL);
+        freeChunks(chunks, n);
+        memcpy(ctx->onError, onError, sizeof(jmp_buf));
+        ctx->lexLimit = (const char *)UINTPTR_MAX;
+        longjmp(ctx->onError, 1);
+    }
+    // the first chunk starts in the right state, so it is lexed here
+    ctx->lexLimit = chunks[1].start;
+    more = chunkLexer(ctx, input);
+    pos = ctx->pCrtCh;
+    for (k = 1; k < n; k++)
+        pthread_join(chunks[k].thread, NULL);
+    joined = 1;
+    for (k = 1; k < n; k++)
+    {
+        LexChunk *c = &chunks[k];
+        for (i = -1; more && pos < c->end; pos = ctx->pCrtCh)
+        {
+            if (pos == c->start)
+                i = 0;
+            else
+                i = tokenAt(&c->ctx.tokens, pos - input);
+            if (i >= 0)
+                break;
+            ctx->lexLimit = pos + 1; // one token, comment or run of blanks
+            more = chunkLexer(ctx, pos);
+        }
+        if (more && i >= 0)
+        {
+            takeChunk(ctx, c, i, pos);
+            pos = c->end;
+            more = c->ctx.tokens.n == i || c->ctx.tokens.code[c->ctx.tokens.n - 1] != END;
+        }
+    }
+    for (k = 1; k < n; k++)
+    {
+        if (chunks[k].map && pthread_create(&chunks[k].thread, NULL, copyChunk, &chunks[k]))
+            err("cannot create a thread");
+    }
+    for (k = 1; k < n; k++)
+    {
+        if (chunks[k].map)
+            pthread_join(chunks[k].thread, NULL);
+    }
+    freeChunks(chunks, n);
+    memcpy(ctx->onError, onError, sizeof(jmp_buf));
+    ctx->lexLimit = (const char *)UINTPTR_MAX;
+    if (more) // the last chunk stopped at an error, which is reported from here
+        more = chunkLexer(ctx, pos);
+    return more;
+}
+
+// Forgets the tokens, literals and lines of a previous analysis; the names are kept
+void resetTokens(Context *ctx)
+{
+    ctx->tokens.n = 0;
+    ctx->nLiterals = 1;
+    ctx->nLines = 0;
+}
+
+double seconds()
+{
+    struct timespec t;
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return t.tv_sec + t.tv_nsec * 1e-9;
+}
+
+// Runs the lexer repeatedly for at least 0.2 seconds and returns the seconds per run
+double timeLexer(Context *ctx, int (*lexer)(Context *, const char *), const char *input)
+{
+    int runs = 0;
+    double start = seconds(), elapsed;
+    ctx->pInput = input;
+    do
+    {
+        resetTokens(ctx);
+        lexer(ctx, input);
+        runs++;
+    } while ((elapsed = seconds() - start) < 0.2);
+    return elapsed / runs;
+}
+
+void *copyOf(const void *p, size_t size)
+{
+    void *copy = malloc(size + 1);
+    if (copy == NULL)
+        err("not enough memory");
+    if (size)
+        memcpy(copy, p, size);
+    return copy;
+}
+
+// Runs the lexer from the start of the input and returns the error it
+// reports, or NULL. The message is allocated, to be freed by the caller.
+char *lexError(Context *ctx, int (*lexer)(Context *, const char *), const char *input)
+{
+    jmp_buf onError;
+    FILE *errors = ctx->errors;
+    char *message = NULL;
+    size_t size = 0;
+    memcpy(onError, ctx->onError, sizeof(jmp_buf));
+    if ((ctx->errors = open_memstream(&message, &size)) == NULL)
+        err("not enough memory");
+    resetTokens(ctx);
+    if (setjmp(ctx->onError) == 0)
+        lexer(ctx, input);
+    fclose(ctx->errors);
+    ctx->errors = errors;
+    memcpy(ctx->onError, onError, sizeof(jmp_buf));
+    if (size == 0)
+    {
+        free(message);
+        return NULL;
+    }
+    return message;
+}
+
+// Prints whether the tokens, lines and error are the same as the expected ones
+void compareTokens(Context *ctx, const char *lexer, const Tokens *expected, const Literal *expectedLiterals,
+                   const unsigned int *expectedLines, int nExpectedLines, const char *expectedError, const char *error)
+{
+    int n = expected->n, i;
+    for (i = 0; i < n && i < ctx->tokens.n; i++)
+    {
+        if (expected->code[i] != ctx->tokens.code[i] || expected->offset[i] != ctx->tokens.offset[i] ||
+            expected->length[i] != ctx->tokens.length[i] || expected->aux[i] != ctx->tokens.aux[i] ||
+            (isLiteral(expected->code[i]) &&
+             memcmp(&expectedLiterals[expected->aux[i]], &ctx->literals[ctx->tokens.aux[i]], sizeof(Literal))))
+            break;
+    }
+    if (i < n || n != ctx->tokens.n)
+        printf("the %s lexer differs at token %d\n", lexer, i);
+    else if (nExpectedLines != ctx->nLines || memcmp(expectedLines, ctx->lines, ctx->nLines * sizeof(int)))
+        printf("the %s lexer differs in the line numbers\n", lexer);
+    else if (expectedError ? !error || strcmp(expectedError, error) : error != NULL)
+        printf("the %s lexer reports %s", lexer, error ? error : "no error\n");
+    else if (error)
+        printf("the %s lexer produces the same %d tokens and the same %s", lexer, n, error);
+    else
+        printf("the %s lexer produces the same %d tokens\n", lexer, n);
+}
+
+// Checks that the table and the parallel lexers produce the same tokens and
+// errors as the switch lexer and compares their speed on an input without errors
+void lexBench(Context *ctx, const char *input, size_t size)
+{
+    Tokens expected;
+    Literal *expectedLiterals;
+    unsigned int *expectedLines;
+    char *expectedError, *error;
+    int n, nLit, nLn;
+    double tSwitch, tTable, tParallel;
+
+    ctx->pInput = input;
+    expectedError = lexError(ctx, getNextToken, input);
+    expected = ctx->tokens;
+    n = ctx->tokens.n, nLit = ctx->nLiterals, nLn = ctx->nLines;
+    expected.code = copyOf(ctx->tokens.code, n);
+    expected.offset = copyOf(ctx->tokens.offset, n * sizeof(int));
+    expected.length = copyOf(ctx->tokens.length, n * sizeof(int));
+    expected.aux = copyOf(ctx->tokens.aux, n * sizeof(int));
+    expectedLiterals = copyOf(ctx->literals, ctx->literals ? nLit * sizeof(Literal) : 0);
+    expectedLines = copyOf(ctx->lines, nLn * sizeof(int));
+
+    error = lexError(ctx, getNextTokenTable, input);
+    compareTokens(ctx, "table", &expected, expectedLiterals, expectedLines, nLn, expectedError, error);
+    free(error);
+    ctx->inputSize = size;
+    chunkLexer = getNextToken;
+    error = lexError(ctx, parallelLex, input);
+    compareTokens(ctx, "parallel", &expected, expectedLiterals, expectedLines, nLn, expectedError, error);
+    free(error);
+
+    if (expectedError == NULL)
+    {
+        tSwitch = timeLexer(ctx, getNextToken, input);
+        tTable = timeLexer(ctx, getNextTokenTable, input);
+        tParallel = timeLexer(ctx, parallelLex, input);
+        printf("switch lexer:   %.3f ms, %.1f MB/s\n", tSwitch * 1e3, size / tSwitch / 1e6);
+        printf("table lexer:    %.3f ms, %.1f MB/s\n", tTable * 1e3, size / tTable / 1e6);
+        printf("parallel lexer: %.3f ms, %.1f MB/s, %d threads\n", tParallel * 1e3, size / tParallel / 1e6, lexThreads);
+    }
+
+    free(expected.code);
+    free(expected.offset);
+    free(expected.length);
+    free(expected.aux);
+    free(expectedLiterals);
+    free(expectedLines);
+    free(expectedError);
+}
+
+int open_file(char *filename)
+{
+    int file = open(filename, O_RDONLY);
+    if (file == -1)
+    {
+        perror("Error opening file");
+        return -1;
+    }
+    return file;
+}
+
+// Maps the file read-only. The mapping is placed at the start of an anonymous
+// region one page larger, so the bytes after the end of the file are always
+// zero and act as the final '\0' of the input without writing to the file.
+// They also provide the LEX_PADDING bytes read by the lexer kernels.
+char *map_file(int fd, size_t size)
+{
+    size_t page = sysconf(_SC_PAGESIZE);
+    size_t span = (size + page - 1) / page * page + page;
+    char *base = mmap(NULL, span, PROT_READ, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (base == MAP_FAILED)
+        return NULL;
+    if (size > 0 && mmap(base, size, PROT_READ, MAP_PRIVATE | MAP_FIXED, fd, 0) == MAP_FAILED)
+    {
+        munmap(base, span);
+        return NULL;
+    }
+    return base;
+}
+
+void unmap_file(char *base, size_t size)
+{
+    size_t page = sysconf(_SC_PAGESIZE);
+    munmap(base, (size + page - 1) / page * page + page);
+}
+
+
+// Streaming mode: the parser pulls the tokens from the lexer as it needs them
+// and the input is read in chunks, so a large input is checked in bounded
+// memory. The parser calls commitTk where it can no longer backtrack, and
+// the tokens before that point are dropped with their literals and lines.
+// The buffer keeps the text from the first token kept to the end of the
+// last chunk, so the offsets of the tokens stay valid and are shifted with it.
+
+#define STREAM_CHUNK 65536
+
+void startStream(Context *ctx, int fd, int (*lexer)(Context *, const char *))
+{
+    ctx->streamFd = fd;
+    ctx->streamLexer = lexer;
+    ctx->streamCapacity = STREAM_CHUNK;
+    if ((ctx->streamBuffer = (char *)malloc(ctx->streamCapacity + 1 + LEX_PADDING)) == NULL)
+        err("not enough memory");
+    memset(ctx->streamBuffer, 0, 1 + LEX_PADDING);
+    ctx->pInput = ctx->pStartCh = ctx->pCrtCh = ctx->streamEnd = ctx->streamBuffer;
+    ctx->streamEof = 0;
+    ctx->streamRefill = 1;
+    ctx->keepNodes = 0; // the tree of the whole input would not fit in bounded memory
+}
+
+// Forgets the lines before offset
+void dropLines(Context *ctx, unsigned int offset)
+{
+    int n = lineOf(ctx, offset) - 1 - ctx->linesBefore;
+    if (n == 0)
+        return;
+    memmove(ctx->lines, ctx->lines + n, (ctx->nLines - n) * sizeof(*ctx->lines));
+    ctx->nLines -= n;
+    ctx->linesBefore += n;
+}
+
+// Forgets the tokens before committedTk, their literals and the lines before them
+void dropTokens(Context *ctx)
+{
+    int n = ctx->committedTk - ctx->tokens.first, i, firstLiteral = 0;
+    if (n <= 0)
+        return;
+    ctx->tokens.n -= n;
+    ctx->tokens.first = ctx->committedTk;
+    memmove(ctx->tokens.code, ctx->tokens.code + n, ctx->tokens.n * sizeof(*ctx->tokens.code));
+    memmove(ctx->tokens.offset, ctx->tokens.offset + n, ctx->tokens.n * sizeof(*ctx->tokens.offset));
+    memmove(ctx->tokens.length, ctx->tokens.length + n, ctx->tokens.n * sizeof(*ctx->tokens.length));
+    memmove(ctx->tokens.aux, ctx->tokens.aux + n, ctx->tokens.n * sizeof(*ctx->tokens.aux));
+    for (i = 0; i < ctx->tokens.n; i++) // the literals are added in the order of their tokens
+    {
+        if (isLiteral(ctx->tokens.code[i]))
+        {
+            if (firstLiteral == 0)
+                firstLiteral = ctx->tokens.aux[i];
+            ctx->tokens.aux[i] -= firstLiteral - 1;
+        }
+    }
+    if (firstLiteral)
+    {
+        memmove(ctx->literals + 1, ctx->literals + firstLiteral, (ctx->nLiterals - firstLiteral) * sizeof(Literal));
+        ctx->nLiterals -= firstLiteral - 1;
+    }
+    else
+        ctx->nLiterals = 1;
+    dropLines(ctx, ctx->tokens.n ? ctx->tokens.offset[0] : (unsigned int)(ctx->pCrtCh - ctx->pInput));
+}
+
+// Called when the lexer reached the end of the chunks read, while analyzing
+// the text from pStartCh. The last token is forgotten if it ends there, as it
+// may continue in the next chunk, and the lexer will restart from pCrtCh once
+// the next chunk is read.
+void stopAtChunkEnd(Context *ctx)
+{
+    if (ctx->tokens.n > 0 && ctx->tokens.offset[ctx->tokens.n - 1] + ctx->tokens.length[ctx->tokens.n - 1] == (size_t)(ctx->streamEnd - ctx->pInput))
+    {
+        ctx->tokens.n--;
+        ctx->pStartCh = ctx->pInput + ctx->tokens.offset[ctx->tokens.n];
+        if (isLiteral(ctx->tokens.code[ctx->tokens.n]))
+            ctx->nLiterals--;
+    }
+    while (ctx->nLines > 0 && ctx->pInput + ctx->lines[ctx->nLines - 1] >= ctx->pStartCh)
+        ctx->nLines--;
+    ctx->pCrtCh = ctx->pStartCh;
+    ctx->streamRefill = 1;
+}
+
+// Moves the text from the first token kept to the start of the buffer and
+// reads the next chunk after it
+void refillStream(Context *ctx)
+{
+    size_t restart = ctx->pCrtCh - ctx->pInput, keep, kept;
+    ssize_t n = 1;
+    int i;
+    keep = ctx->tokens.n ? ctx->tokens.offset[0] : restart;
+    kept = ctx->streamEnd - ctx->pInput - keep;
+    dropLines(ctx, keep);
+    memmove(ctx->streamBuffer, ctx->streamBuffer + keep, kept);
+    for (i = 0; i < ctx->tokens.n; i++)
+        ctx->tokens.offset[i] -= keep;
+    for (i = 0; i < ctx->nLines; i++)
+        ctx->lines[i] -= keep;
+    if (kept > ctx->streamCapacity / 2) // a long token or statement
+    {
+        ctx->streamCapacity *= 2;
+        if ((ctx->streamBuffer = (char *)realloc(ctx->streamBuffer, ctx->streamCapacity + 1 + LEX_PADDING)) == NULL)
+            err("not enough memory");
+    }
+    for (; kept < ctx->streamCapacity && n > 0; kept += n)
+    {
+        if ((n = read(ctx->streamFd, ctx->streamBuffer + kept, ctx->streamCapacity - kept)) < 0)
+            err("cannot read the input");
+        ctx->streamRead += n;
+    }
+    if (n == 0)
+        ctx->streamEof = 1;
+    ctx->streamEnd = ctx->streamBuffer + kept;
+    memset(ctx->streamBuffer + kept, 0, 1 + LEX_PADDING);
+    ctx->pInput = ctx->streamBuffer;
+    ctx->pStartCh = ctx->pCrtCh = ctx->streamBuffer + restart - keep;
+    ctx->streamRefill = 0;
+}
+
+// Lexes at least one more token, for the parser which used all the tokens.
+// The next chunk is read only after the tokens not needed are dropped, so
+// that their text is not kept.
+void pullTokens(Context *ctx)
+{
+    int n;
+    dropTokens(ctx);
+    n = ctx->tokens.n;
+    while (ctx->tokens.n == n)
+    {
+        if (ctx->streamRefill)
+            refillStream(ctx);
+        if (setjmp(ctx->lexJump) == 0)
+            ctx->streamLexer(ctx, ctx->pCrtCh); // returns after END
+        else
+            stopAtChunkEnd(ctx);
+    }
+    if (ctx->tokens.n > ctx->streamPeakTokens)
+        ctx->streamPeakTokens = ctx->tokens.n;
+}
+
+// Called by the parser where no caller can backtrack before the current token
+void commitTk(Context *ctx)
+{
+    ctx->committedTk = ctx->crtTk;
+}
+
+int consume(Context *ctx, int code)
+{
+    if (ctx->crtTk - ctx->tokens.first == ctx->tokens.n) // only in streaming mode, as the parser stops at END
+        pullTokens(ctx);
+    if (ctx->tokens.code[ctx->crtTk - ctx->tokens.first] == code)
+    {
+        if (ctx->crtTk < ctx->furthestTk)
+            ctx->reconsumedTk++;
+        else
+            ctx->furthestTk = ctx->crtTk + 1;
+        ctx->consumedTk = ctx->crtTk++;
+        return 1;
+    }
+    return 0;
+}
+
+// Returns the code of the token k positions after the current one, without
+// consuming it. The tokens after END are read as END.
+int peekTk(Context *ctx, int k)
+{
+    int tk = ctx->crtTk, code;
+    if (tk + k - ctx->tokens.first < ctx->tokens.n) // END is the last token lexed
+        return ctx->tokens.code[tk + k - ctx->tokens.first];
+    while (1)
+    {
+        if (tk - ctx->tokens.first == ctx->tokens.n) // only in streaming mode
+            pullTokens(ctx);
+        code = ctx->tokens.code[tk - ctx->tokens.first];
+        if (k-- == 0 || code == END)
+            return code;
+        tk++;
+    }
+}
+
+// Adds a node to the tree and returns its index
+int newNode(Context *ctx, int kind, int op, int tk, int a, int b, int c)
+{
+    Node *node;
+    if (!ctx->keepNodes)
+        ctx->nNodes = 1;
+    if (ctx->nNodes >= ctx->nodesCapacity)
+        ctx->nodes = (Node *)growArray(ctx->nodes, &ctx->nodesCapacity, 1024, sizeof(Node));
+    node = &ctx->nodes[ctx->nNodes];
+    node->kind = kind;
+    node->op = op;
+    node->flags = 0;
+    node->tk = tk;
+    node->a = a;
+    node->b = b;
+    node->c = c;
+    node->next = 0;
+    return ctx->nNodes++;
+}
+
+// Appends the node, with the nodes which follow it, to the list from *first to *last
+void linkNode(Context *ctx, int *first, int *last, int node)
+{
+    if (!ctx->keepNodes) // all the nodes are nodes[1], which cannot be linked to itself
+    {
+        *first = *last = node;
+        return;
+    }
+    if (*last)
+        ctx->nodes[*last].next = node;
+    else
+        *first = node;
+    for (*last = node; ctx->nodes[*last].next; *last = ctx->nodes[*last].next)
+    {
+    }
+}
+
+// The parser chooses between the productions by their FIRST sets and a bounded
+// lookahead, so it never backtracks and each token is consumed once.
+#define SET(code) (1ULL << (code))
+#define inSet(set, code) ((set) >> (code) & 1)
+#define FIRST_TYPEBASE (SET(INT) | SET(DOUBLE) | SET(CHAR) | SET(STRUCT))
+
+// Tells if the tokens from the current one start a function declaration:
+//     ( typeBase MUL? | VOID ) ID LPAR
+// Otherwise a declaration which starts with typeBase is a declVar.
+int startsFunc(Context *ctx)
+{
+    int k;
+    switch (peekTk(ctx, 0))
+    {
+    case VOID:
+        return 1;
+    case STRUCT:
+        k = 2;
+        break;
+    default:
+        if (!inSet(FIRST_TYPEBASE, peekTk(ctx, 0)))
+            return 0;
+        k = 1;
+    }
+    if (peekTk(ctx, k) == MUL)
+        k++;
+    return peekTk(ctx, k) == ID && peekTk(ctx, k + 1) == LPAR;
+}
+
+int declStruct(Context *ctx);
+int declVar(Context *ctx);
+int typeBase(Context *ctx);
+int arrayDecl(Context *ctx, int type);
+int declFunc(Context *ctx);
+int funcArg(Context *ctx);
+int stmCompound(Context *ctx);
+int expr(Context *ctx);
+int exprAssign(Context *ctx);
+int exprCast(Context *ctx);
+int exprUnary(Context *ctx);
+int exprPostfix(Context *ctx);
+int exprPrimary(Context *ctx);
+
+// unit: ( declStruct | declFunc | declVar )* END
+// STRUCT ID LACC starts a declStruct, the other declarations are told apart by startsFunc
+int unit(Context *ctx)
+{
+    int first = 0, last = 0, decl;
+    ctx->crtTk = 0;
+    while (1)
+    {
+        commitTk(ctx);
+        if (peekTk(ctx, 0) == STRUCT && peekTk(ctx, 2) == LACC)
+            decl = declStruct(ctx);
+        else if (startsFunc(ctx))
+            decl = declFunc(ctx);
+        else if ((decl = declVar(ctx)))
+        {
+        }
+        else
+            break;
+        linkNode(ctx, &first, &last, decl);
+    }
+    if (!consume(ctx, END))
+        tkerr(ctx, ctx->crtTk, "missing END token");
+    return ctx->root = newNode(ctx, N_UNIT, 0, 0, first, 0, 0);
+}
+
+// declStruct: STRUCT ID LACC declVar* RACC SEMICOLON
+int declStruct(Context *ctx)
+{
+    int name, first = 0, last = 0, member;
+    if (!consume(ctx, STRUCT))
+        return 0;
+    if (!consume(ctx, ID))
+        tkerr(ctx, ctx->crtTk, "ID expected after struct");
+    name = ctx->consumedTk;
+    if (!consume(ctx, LACC))
+        tkerr(ctx, ctx->crtTk, "Missing { in struct declaration");
+    while (1)
+    {
+        if ((member = declVar(ctx)))
+            linkNode(ctx, &first, &last, member);
+        else
+            break;
+    }
+    if (!consume(ctx, RACC))
+        tkerr(ctx, ctx->crtTk, "Missing { in struct declaration");
+    if (!consume(ctx, SEMICOLON))
+        tkerr(ctx, ctx->crtTk, "Missing ; in struct declaration");
+    return newNode(ctx, N_STRUCT, 0, name, first, 0, 0);
+}
+
+// declVar:  typeBase ID arrayDecl? ( COMMA ID arrayDecl? )* SEMICOLON
+// Returns the list of the variables
+int declVar(Context *ctx)
+{
+    int type, array, first = 0, last = 0;
+    if (!(type = typeBase(ctx)))
+        return 0;
+    if (!consume(ctx, ID))
+        tkerr(ctx, ctx->crtTk, "ID expected after type base");
+    while (1)
+    {
+        int name = ctx->consumedTk;
+        if (!(array = arrayDecl(ctx, type)))
+        {
+        }
+        linkNode(ctx, &first, &last, newNode(ctx, N_VAR, 0, name, array ? array : type, 0, 0));
+        if (!consume(ctx, COMMA))
+            break;
+        if (!consume(ctx, ID))
+            tkerr(ctx, ctx->crtTk, "ID expected");
+    }
+    if (!consume(ctx, SEMICOLON))
+        tkerr(ctx, ctx->crtTk, "missing ; after variable declaration");
+    return first;
+}
+
+// typeBase: INT | DOUBLE | CHAR | STRUCT ID
+int typeBase(Context *ctx)
+{
+    int tk = ctx->crtTk, code;
+    switch (code = peekTk(ctx, 0))
+    {
+    case INT:
+    case DOUBLE:
+    case CHAR:
+        consume(ctx, code);
+        break;
+    case STRUCT:
+        consume(ctx, STRUCT);
+        if (!consume(ctx, ID))
+            tkerr(ctx, ctx->crtTk, "ID expected after struct");
+        break;
+    default:
+        return 0;
+    }
+    return newNode(ctx, N_TYPE, code, tk, 0, 0, 0);
+}
+
+// arrayDecl: LBRACKET expr? RBRACKET
+// Returns the type of an array of the given type
+int arrayDecl(Context *ctx, int type)
+{
+    int size, array;
+    if (!consume(ctx, LBRACKET))
+        return 0;
+    if ((size = expr(ctx)))
+    {
+    }
+    if (!consume(ctx, RBRACKET))
+        tkerr(ctx, ctx->crtTk, "missing ] from array declaration");
+    array = newNode(ctx, N_TYPE, ctx->nodes[type].op, ctx->nodes[type].tk, size, 0, 0);
+    ctx->nodes[array].flags = F_ARRAY;
+    return array;
+}
+
+// typeName: typeBase arrayDecl?
+int typeName(Context *ctx)
+{
+    int type, array;
+    if (!(type = typeBase(ctx)))
+        return 0;
+    if (!(array = arrayDecl(ctx, type)))
+        return type;
+    return array;
+}
+
+// declFunc: ( typeBase MUL? | VOID ) ID
+//                         LPAR ( funcArg ( COMMA funcArg )* )? RPAR
+//                         stmCompound
+int declFunc(Context *ctx)
+{
+    int type, name, arg, first = 0, last = 0, body;
+    if ((type = typeBase(ctx)))
+    {
+        if (consume(ctx, MUL))
+            ctx->nodes[type].flags = F_POINTER;
+    }
+    else if (consume(ctx, VOID))
+        type = newNode(ctx, N_TYPE, VOID, ctx->consumedTk, 0, 0, 0);
+    else
+        return 0;
+    if (!consume(ctx, ID))
+        tkerr(ctx, ctx->crtTk, "ID expected in function declaration");
+    name = ctx->consumedTk;
+    if (!consume(ctx, LPAR))
+        tkerr(ctx, ctx->crtTk, "missing ( in function declaration");
+    if ((arg = funcArg(ctx)))
+    {
+        linkNode(ctx, &first, &last, arg);
+        while (1)
+        {
+            if (consume(ctx, COMMA))
+            {
+                if (!(arg = funcArg(ctx)))
+                    tkerr(ctx, ctx->crtTk, "missing func arg in stm");
+                linkNode(ctx, &first, &last, arg);
+            }
+            else
+                break;
+        }
+    }
+    if (!consume(ctx, RPAR))
+        tkerr(ctx, ctx->crtTk, "missing ) in func declaration");
+    if (!(body = stmCompound(ctx)))
+        tkerr(ctx, ctx->crtTk, "compound statement expected");
+
+    return newNode(ctx, N_FUNC, 0, name, type, first, body);
+}
+
+// funcArg: typeBase ID arrayDecl?
+int funcArg(Context *ctx)
+{
+    int type, array, name;
+    if (!(type = typeBase(ctx)))
+        return 0;
+    if (!consume(ctx, ID))
+        tkerr(ctx, ctx->crtTk, "ID missing in function declaration");
+    name = ctx->consumedTk;
+    if (!(array = arrayDecl(ctx, type)))
+        array = type;
+    return newNode(ctx, N_PARAM, 0, name, array, 0, 0);
+}
+
+// Returns the expression, or an N_EMPTY node at the current token if there is none
+int exprOrEmpty(Context *ctx)
+{
+    int e = expr(ctx);
+    return e ? e : newNode(ctx, N_EMPTY, 0, ctx->crtTk, 0, 0, 0);
+}
+
+// stm: stmCompound
+//            | IF LPAR expr RPAR stm ( ELSE stm )?
+//            | WHILE LPAR expr RPAR stm
+//            | FOR LPAR expr? SEMICOLON expr? SEMICOLON expr? RPAR stm
+//            | BREAK SEMICOLON
+//            | RETURN expr? SEMICOLON
+//            | expr? SEMICOLON
+int stm(Context *ctx)
+{
+    int tk = ctx->crtTk, a, b, c = 0, node;
+    if ((node = stmCompound(ctx)))
+    {
+    }
+    else if (consume(ctx, IF))
+    {
+        if (!consume(ctx, LPAR))
+            tkerr(ctx, ctx->crtTk, "missing ( after if");
+        if (!(a = expr(ctx)))
+            tkerr(ctx, ctx->crtTk, "Expected expression after ( ");
+        if (!consume(ctx, RPAR))
+            tkerr(ctx, ctx->crtTk, "missing ) after if");
+        if (!(b = stm(ctx)))
+            tkerr(ctx, ctx->crtTk, "Expected statement after if ");
+        if (consume(ctx, ELSE))
+        {
+            if (!(c = stm(ctx)))
+                tkerr(ctx, ctx->crtTk, "Expected statement after else ");
+        }
+        node = newNode(ctx, N_IF, 0, tk, a, b, c);
+    }
+    else if (consume(ctx, WHILE))
+    {
+        if (!consume(ctx, LPAR))
+            tkerr(ctx, ctx->crtTk, "missing ( after while");
+        if (!(a = expr(ctx)))
+            tkerr(ctx, ctx->crtTk, "Expected expression after ( ");
+        if (!consume(ctx, RPAR))
+            tkerr(ctx, ctx->crtTk, "missing ) after while");
+        if (!(b = stm(ctx)))
+            tkerr(ctx, ctx->crtTk, "Expected statement after while ");
+        node = newNode(ctx, N_WHILE, 0, tk, a, b, 0);
+    }
+    else if (consume(ctx, FOR))
+    {
+        int first = 0, last = 0;
+        if (!consume(ctx, LPAR))
+            tkerr(ctx, ctx->crtTk, "missing ( after for");
+        linkNode(ctx, &first, &last, exprOrEmpty(ctx));
+        if (!consume(ctx, SEMICOLON))
+            tkerr(ctx, ctx->crtTk, "missing ; in for");
+        linkNode(ctx, &first, &last, exprOrEmpty(ctx));
+        if (!consume(ctx, SEMICOLON))
+            tkerr(ctx, ctx->crtTk, "missing ; in for");
+        linkNode(ctx, &first, &last, exprOrEmpty(ctx));
+        if (!consume(ctx, RPAR))
+            tkerr(ctx, ctx->crtTk, "missing ) after for");
+        if (!(b = stm(ctx)))
+            tkerr(ctx, ctx->crtTk, "Expected statement after for ");
+        node = newNode(ctx, N_FOR, 0, tk, first, b, 0);
+    }
+    else if (consume(ctx, BREAK))
+    {
+        if (!consume(ctx, SEMICOLON))
+            tkerr(ctx, ctx->crtTk, "missing ; after break");
+        node = newNode(ctx, N_BREAK, 0, tk, 0, 0, 0);
+    }
+    else if (consume(ctx, RETURN))
+    {
+        a = expr(ctx);
+        if (!consume(ctx, SEMICOLON))
+            tkerr(ctx, ctx->crtTk, "missing ; after return");
+        node = newNode(ctx, N_RETURN, 0, tk, a, 0, 0);
+    }
+    else if ((node = expr(ctx)))
+    {
+        if (!consume(ctx, SEMICOLON))
+            tkerr(ctx, ctx->crtTk, "missing ; after expression in statement");
+    }
+    else if (consume(ctx, SEMICOLON))
+        node = newNode(ctx, N_EMPTY, 0, tk, 0, 0, 0);
+    else
+        return 0;
+    return node;
+}
+
+// stmCompound: LACC ( declVar | stm )* RACC
+int stmCompound(Context *ctx)
+{
+    int tk = ctx->crtTk, first = 0, last = 0, node;
+    if (!consume(ctx, LACC))
+        return 0;
+    while (1)
+    {
+        commitTk(ctx);
+        if ((node = declVar(ctx)))
+        {
+        }
+        else if ((node = stm(ctx)))
+        {
+        }
+        else
+            break;
+        linkNode(ctx, &first, &last, node);
+    }
+    if (!consume(ctx, RACC))
+        tkerr(ctx, ctx->crtTk, "Expected } in compound statement");
+    return newNode(ctx, N_BLOCK, 0, tk, first, 0, 0);
+}
+
+// The binary operators are parsed by precedence climbing, with their binding
+// power in binaryPower; all of them are left associative:
+//     exprOr:  exprOr OR exprAnd | exprAnd
+//     exprAnd: exprAnd AND exprEq | exprEq
+//     exprEq:  exprEq ( EQUAL | NOTEQ ) exprRel | exprRel
+//     exprRel: exprRel ( LESS | LESSEQ | GREATER | GREATEREQ ) exprAdd | exprAdd
+//     exprAdd: exprAdd ( ADD | SUB ) exprMul | exprMul
+//     exprMul: exprMul ( MUL | DIV ) exprCast | exprCast
+// An operand is parsed by one call for each higher binding power, so a leaf
+// takes a few calls and the depth does not grow with the length of a chain.
+enum { BP_NONE, BP_OR, BP_AND, BP_EQ, BP_REL, BP_ADD, BP_MUL };
+
+const unsigned char binaryPower[] = {
+    [OR] = BP_OR,
+    [AND] = BP_AND,
+    [EQUAL] = BP_EQ, [NOTEQ] = BP_EQ,
+    [LESS] = BP_REL, [LESSEQ] = BP_REL, [GREATER] = BP_REL, [GREATEREQ] = BP_REL,
+    [ADD] = BP_ADD, [SUB] = BP_ADD,
+    [MUL] = BP_MUL, [DIV] = BP_MUL,
+    [CHAR] = BP_NONE // the last token code
+};
+
+const char *binaryMessages[] = {
+    [BP_OR] = "missing expression after OR",
+    [BP_AND] = "missing expression after AND",
+    [BP_EQ] = "missing expressiong after =",
+    [BP_REL] = "missing expression after relationship",
+    [BP_ADD] = "missing expressiong after + or -",
+    [BP_MUL] = "missing expressiong after * or /",
+};
+
+// Parses an expression whose binary operators bind at least with minPower
+int exprBinary(Context *ctx, int minPower)
+{
+    int code, power, left, right, tk;
+    if (!(left = exprCast(ctx)))
+        return 0;
+    while ((power = binaryPower[code = peekTk(ctx, 0)]) >= minPower)
+    {
+        tk = ctx->crtTk;
+        consume(ctx, code);
+        if (!(right = exprBinary(ctx, power + 1)))
+            tkerr(ctx, ctx->crtTk, binaryMessages[power]);
+        left = newNode(ctx, N_BINARY, code, tk, left, right, 0);
+    }
+    return left;
+}
+
+// expr: exprAssign
+int expr(Context *ctx)
+{
+    return exprAssign(ctx);
+}
+
+// exprAssign: exprUnary ASSIGN exprAssign | exprOr
+// An exprUnary is also an exprOr, so the exprOr is parsed first and it is the
+// left side of ASSIGN if it was a single exprUnary.
+int exprAssign(Context *ctx)
+{
+    int startTk = ctx->crtTk, left, right;
+    if (!(left = exprBinary(ctx, BP_OR)))
+        return 0;
+    if (ctx->lastUnary == startTk && consume(ctx, ASSIGN))
+    {
+        int tk = ctx->consumedTk;
+        if (!(right = exprAssign(ctx)))
+            tkerr(ctx, ctx->crtTk, "Expected assign in expression");
+        return newNode(ctx, N_ASSIGN, 0, tk, left, right, 0);
+    }
+    return left;
+}
+
+// exprCast: LPAR typeName RPAR exprCast | exprUnary
+// LPAR starts a cast if a type follows, as an expression cannot start with one
+int exprCast(Context *ctx)
+{
+    if (peekTk(ctx, 0) == LPAR && inSet(FIRST_TYPEBASE, peekTk(ctx, 1)))
+    {
+        int tk = ctx->crtTk, type, value;
+        consume(ctx, LPAR);
+        type = typeName(ctx);
+        if (!consume(ctx, RPAR))
+            tkerr(ctx, ctx->crtTk, "missing ) after the type of the cast");
+        if (!(value = exprCast(ctx)))
+            tkerr(ctx, ctx->crtTk, "missing expression after cast");
+        return newNode(ctx, N_CAST, 0, tk, type, value, 0);
+    }
+    return exprUnary(ctx);
+}
+
+// exprUnary: ( SUB | NOT ) exprUnary | exprPostfix
+int exprUnary(Context *ctx)
+{
+    int startTk = ctx->crtTk, code, node;
+    switch (code = peekTk(ctx, 0))
+    {
+    case SUB:
+        consume(ctx, SUB);
+        if (!(node = exprUnary(ctx)))
+            tkerr(ctx, ctx->crtTk, "missing unary expression after -");
+        node = newNode(ctx, N_UNARY, code, startTk, node, 0, 0);
+        break;
+    case NOT:
+        consume(ctx, NOT);
+        if (!(node = exprUnary(ctx)))
+            tkerr(ctx, ctx->crtTk, "missing unary expression after !");
+        node = newNode(ctx, N_UNARY, code, startTk, node, 0, 0);
+        break;
+    default:
+        if (!(node = exprPostfix(ctx)))
+            return 0;
+    }
+    ctx->lastUnary = startTk;
+    return node;
+}
+
+// exprPostfix: exprPostfix LBRACKET expr RBRACKET
+//            | exprPostfix DOT ID
+//            | exprPrimary
+// Remove left recursion:
+//     exprPostfix: exprPrimary ( LBRACKET expr RBRACKET | DOT ID )*
+int exprPostfix(Context *ctx)
+{
+    int node, index, tk;
+    if (!(node = exprPrimary(ctx)))
+        return 0;
+    while (1)
+    {
+        tk = ctx->crtTk;
+        switch (peekTk(ctx, 0))
+        {
+        case LBRACKET:
+            consume(ctx, LBRACKET);
+            if (!(index = expr(ctx)))
+                tkerr(ctx, ctx->crtTk, "missing expression after (");
+            if (!consume(ctx, RBRACKET))
+                tkerr(ctx, ctx->crtTk, "missing ) after expression");
+            node = newNode(ctx, N_INDEX, 0, tk, node, index, 0);
+            break;
+        case DOT:
+            consume(ctx, DOT);
+            if (!consume(ctx, ID))
+                tkerr(ctx, ctx->crtTk, "error consuming");
+            node = newNode(ctx, N_MEMBER, 0, ctx->consumedTk, node, 0, 0);
+            break;
+        default:
+            return node;
+        }
+    }
+}
+
+// exprPrimary: ID ( LPAR ( expr ( COMMA expr )* )? RPAR )?
+//            | CT_INT
+//            | CT_REAL
+//            | CT_CHAR
+//            | CT_STRING
+//            | LPAR expr RPAR
+int exprPrimary(Context *ctx)
+{
+    int tk = ctx->crtTk, code, node, arg, first = 0, last = 0;
+    switch (code = peekTk(ctx, 0))
+    {
+    case ID:
+        consume(ctx, ID);
+        if (consume(ctx, LPAR))
+        {
+            if ((arg = expr(ctx)))
+            {
+                linkNode(ctx, &first, &last, arg);
+                while (1)
+                {
+                    if (!consume(ctx, COMMA))
+                        break;
+                    if (!(arg = expr(ctx)))
+                        tkerr(ctx, ctx->crtTk, "missing expression after , in primary expression");
+                    linkNode(ctx, &first, &last, arg);
+                }
+            }
+            if (!consume(ctx, RPAR))
+                tkerr(ctx, ctx->crtTk, "missing )");
+            node = newNode(ctx, N_CALL, 0, tk, first, 0, 0);
+        }
+        else
+            node = newNode(ctx, N_ID, 0, tk, 0, 0, 0);
+        break;
+    case CT_INT:
+    case CT_REAL:
+    case CT_CHAR:
+    case CT_STRING:
+        consume(ctx, code);
+        node = newNode(ctx, N_CONST, code, tk, 0, 0, 0);
+        break;
+    case LPAR:
+        consume(ctx, LPAR);
+        if (!(node = expr(ctx)))
+            tkerr(ctx, ctx->crtTk, "missing expression after (");
+        if (!consume(ctx, RPAR))
+            tkerr(ctx, ctx->crtTk, "missing ) after expression");
+        break;
+    default:
+        return 0;
+    }
+    return node;
+}
+
+enum { TB_INT, TB_DOUBLE, TB_CHAR, TB_STRUCT, TB_VOID };
+
+struct _Type {
+    int typeBase;   // TB_*
+    Symbol *s;      // struct definition for TB_STRUCT
+    int nElements;  // >0 array of given size, 0=array without size, <0 non array
+};
+
+enum { CLS_VAR, CLS_FUNC, CLS_EXTFUNC, CLS_STRUCT };
+enum { MEM_GLOBAL, MEM_ARG, MEM_LOCAL };
+
+typedef struct _Symbol {
+    const char *name;  // the interned name (text of names[]), so equal names have equal pointers
+    int cls;           // CLS_*
+    int mem;           // MEM_*
+    Type *type;        // interned
+    int depth;         // 0-global, 1-in function, 2... - nested blocks in function
+    union {
+        Symbols args;    // used only for functions
+        Symbols members; // used only for structs
+    };
+    Symbol *shadowed;  // the symbol with the same name at a lower depth, hidden by this one
+    int offset;        // of a member in its struct
+    int size, align;   // of a struct
+    int code;          // of a function: its first instruction; of a function of the runtime: its OP_*
+} Symbol;
+
+void initSymbols(Symbols *symbols) {
+    symbols->begin = NULL;
+    symbols->end = NULL;
+    symbols->after = NULL;
+}
+
+// Appends the symbol to the list
+void pushSymbol(Context *ctx, Symbols *symbols, Symbol *s) {
+	if(symbols->end==symbols->after){ // create more room
+		int count = symbols->end-symbols->begin;
+		int n = count*2; // double the room
+		if(n==0){ // the initial case
+			symbols->begin = symbols->inlined;
+			n = SYMBOLS_INLINE;
+		}else{ // the old room is left in the arena
+			Symbol **begin = (Symbol**)arenaAlloc(ctx, n*sizeof(Symbol*));
+			memcpy(begin, symbols->begin, count*sizeof(Symbol*));
+			symbols->begin = begin;
+		}
+		symbols->end = symbols->begin+count;
+		symbols->after = symbols->begin+n;
+	}
+	*symbols->end++ = s;
+}
+
+// The names are interned, so their addresses are hashed
+unsigned int hashPointer(const void *p)
+{
+    return (unsigned int)(((uintptr_t)p * 0x9E3779B97F4A7C15ull) >> 32);
+}
+
+void rehashSymbols(Context *ctx)
+{
+    SymbolSlot *old = ctx->symbolsHash;
+    int oldSize = ctx->symbolsHashSize, i, j;
+    ctx->symbolsHashSize = oldSize ? oldSize * 2 : 256;
+    ctx->symbolsHash = (SymbolSlot *)calloc(ctx->symbolsHashSize, sizeof(SymbolSlot));
+    if (ctx->symbolsHash == NULL)
+        err("not enough memory");
+    for (i = 0; i < oldSize; i++)
+    {
+        if (!old[i].name)
+            continue;
+        for (j = hashPointer(old[i].name) & (ctx->symbolsHashSize - 1); ctx->symbolsHash[j].name; j = (j + 1) & (ctx->symbolsHashSize - 1))
+        {
+        }
+        ctx->symbolsHash[j] = old[i];
+    }
+    free(old);
+}
+
+// Returns the slot of the name in the index of the symbols. A missing name
+// gets a new slot if insert is set, else NULL is returned.
+SymbolSlot *symbolSlot(Context *ctx, const char *name, int insert)
+{
+    int j;
+    if (insert && ctx->nSymbolsHash * 2 >= ctx->symbolsHashSize)
+        rehashSymbols(ctx);
+    if (ctx->symbolsHashSize == 0)
+        return NULL;
+    for (j = hashPointer(name) & (ctx->symbolsHashSize - 1); ctx->symbolsHash[j].name; j = (j + 1) & (ctx->symbolsHashSize - 1))
+    {
+        if (ctx->symbolsHash[j].name == name)
+            return &ctx->symbolsHash[j];
+    }
+    if (!insert)
+        return NULL;
+    ctx->nSymbolsHash++;
+    ctx->symbolsHash[j].name = name;
+    return &ctx->symbolsHash[j];
+}
+
+// Adds a symbol at the current depth. When symbols is the table of the
+// context, the symbol also hides the one with the same name until its scope
+// is left; the lists of args and members are not indexed.
+Symbol *addSymbol(Context *ctx, Symbols *symbols,const char *name,int cls) {
+	Symbol *s = (Symbol*)arenaAlloc(ctx, sizeof(Symbol));
+	memset(s, 0, sizeof(*s));
+	s->name = name;
+	s->cls = cls;
+	s->depth = ctx->crtDepth;
+	ctx->nSymbolsAdded++;
+	pushSymbol(ctx, symbols, s);
+	if (symbols == &ctx->symbols)
+	{
+		SymbolSlot *slot = symbolSlot(ctx, name, 1);
+		s->shadowed = slot->symbol;
+		slot->symbol = s;
+	}
+	return s;
+}
+
+// Returns the innermost visible symbol with the given interned name, or NULL
+Symbol *findSymbol(Context *ctx, const char *name)
+{
+    SymbolSlot *slot = symbolSlot(ctx, name, 0);
+    ctx->symbolLookups++;
+    return slot ? slot->symbol : NULL;
+}
+
+// Returns the symbol with the given interned name from a list of args or members, or NULL
+Symbol *findSymbolIn(Symbols *symbols, const char *name)
+{
+    Symbol **p;
+    for (p = symbols->begin; p != symbols->end; p++)
+        if ((*p)->name == name)
+            return *p;
+    return NULL;
+}
+
+// Enters a nested scope, recording where its symbols begin
+void enterScope(Context *ctx)
+{
+    if (++ctx->crtDepth >= ctx->scopesCapacity)
+        ctx->scopes = (int *)growArray(ctx->scopes, &ctx->scopesCapacity, 64, sizeof(int));
+    ctx->scopes[ctx->crtDepth] = ctx->symbols.end - ctx->symbols.begin;
+}
+
+// Leaves the scopes deeper than depth: the table is truncated to the mark of
+// the first of them, and the removed symbols uncover the ones they shadowed
+void deleteSymbolsAfter(Context *ctx, int depth)
+{
+    Symbol **start = ctx->symbols.begin + ctx->scopes[depth + 1];
+    while (ctx->symbols.end != start)
+    {
+        Symbol *s = *--ctx->symbols.end;
+        symbolSlot(ctx, s->name, 0)->symbol = s->shadowed;
+    }
+    ctx->crtDepth = depth;
+}
+
+const char *tkTexts[] = {
+    [ADD] = "+", [SUB] = "-", [MUL] = "*", [DIV] = "/", [AND] = "&&", [OR] = "||", [NOT] = "!",
+    [EQUAL] = "==", [NOTEQ] = "!=", [LESS] = "<", [LESSEQ] = "<=", [GREATER] = ">", [GREATEREQ] = ">=",
+    [INT] = "int", [DOUBLE] = "double", [CHAR] = "char", [STRUCT] = "struct", [VOID] = "void"};
+
+// The types are interned, so equal types are the same object and are
+// compared as pointers
+unsigned int hashType(int typeBase, Symbol *s, int nElements)
+{
+    return hashPointer(s) ^ (unsigned int)typeBase * 0x9E3779B1u ^ (unsigned int)nElements * 0x85EBCA6Bu;
+}
+
+void rehashTypes(Context *ctx)
+{
+    Type **old = ctx->typesHash;
+    int oldSize = ctx->typesHashSize, i, j;
+    ctx->typesHashSize = oldSize ? oldSize * 2 : 64;
+    ctx->typesHash = (Type **)calloc(ctx->typesHashSize, sizeof(Type *));
+    if (ctx->typesHash == NULL)
+        err("not enough memory");
+    for (i = 0; i < oldSize; i++)
+    {
+        Type *t = old[i];
+        if (!t)
+            continue;
+        for (j = hashType(t->typeBase, t->s, t->nElements) & (ctx->typesHashSize - 1); ctx->typesHash[j]; j = (j + 1) & (ctx->typesHashSize - 1))
+        {
+        }
+        ctx->typesHash[j] = t;
+    }
+    free(old);
+}
+
+// Returns the single object of the given type
+Type *internType(Context *ctx, int typeBase, Symbol *s, int nElements)
+{
+    Type *t;
+    int j;
+    if (ctx->nTypes * 2 >= ctx->typesHashSize)
+        rehashTypes(ctx);
+    for (j = hashType(typeBase, s, nElements) & (ctx->typesHashSize - 1); (t = ctx->typesHash[j]) != NULL; j = (j + 1) & (ctx->typesHashSize - 1))
+    {
+        if (t->typeBase == typeBase && t->s == s && t->nElements == nElements)
+            return t;
+    }
+    t = (Type *)arenaAlloc(ctx, sizeof(Type));
+    t->typeBase = typeBase;
+    t->s = s;
+    t->nElements = nElements;
+    ctx->typesHash[j] = t;
+    ctx->nTypes++;
+    return t;
+}
+
+Type *createType(Context *ctx, int typeBase, int nElements)
+{
+    return internType(ctx, typeBase, NULL, nElements);
+}
+
+// The type of an element of the array type t
+Type *elementType(Context *ctx, Type *t)
+{
+    return internType(ctx, t->typeBase, t->s, -1);
+}
+
+// The layout of the values: int and double take 8 bytes and char 1, each
+// aligned to its size. The elements of an array follow one another, and an
+// array argument without a size is passed as its address. The members of a
+// struct are laid out in order, each at the first offset aligned for it, and
+// the size of the struct is rounded up to its alignment, so that it is also
+// the stride of an array of structs.
+
+int typeAlign(Type *t)
+{
+    if (t->nElements == 0)
+        return 8;
+    switch (t->typeBase)
+    {
+    case TB_CHAR: return 1;
+    case TB_STRUCT: return t->s->align;
+    case TB_VOID: return 1;
+    default: return 8;
+    }
+}
+
+long typeSize(Type *t)
+{
+    long size;
+    if (t->nElements == 0)
+        return 8;
+    switch (t->typeBase)
+    {
+    case TB_CHAR: size = 1; break;
+    case TB_STRUCT: size = t->s->size; break;
+    case TB_VOID: size = 0; break;
+    default: size = 8;
+    }
+    return t->nElements > 0 ? size * t->nElements : size;
+}
+
+// Computes the offsets of the members of the struct declared at the token tk, and its size
+void layoutStruct(Context *ctx, Symbol *s, int tk)
+{
+    Symbol **m;
+    long offset = 0;
+    int align = 1;
+    for (m = s->members.begin; m != s->members.end; m++)
+    {
+        int a = typeAlign((*m)->type);
+        offset = (offset + a - 1) & -a;
+        if (offset > INT_MAX)
+            tkerr(ctx, tk, "struct %s is too large", s->name);
+        (*m)->offset = offset;
+        offset += typeSize((*m)->type);
+        if (a > align)
+            align = a;
+    }
+    offset = (offset + align - 1) & -align;
+    if (offset > INT_MAX)
+        tkerr(ctx, tk, "struct %s is too large", s->name);
+    s->size = offset;
+    s->align = align;
+}
+
+void printType(Type *t)
+{
+    static const char *names[] = {[TB_INT] = "int", [TB_DOUBLE] = "double", [TB_CHAR] = "char", [TB_VOID] = "void"};
+    if (t->typeBase == TB_STRUCT)
+        printf("struct %s", t->s->name);
+    else
+        printf("%s", names[t->typeBase]);
+    if (t->nElements > 0)
+        printf("[%d]", t->nElements);
+    else if (t->nElements == 0)
+        printf("[]");
+}
+
+// Prints the layout of the structs, for the tools which access their values
+void printLayout(Context *ctx)
+{
+    Symbol **p, **m;
+    for (p = ctx->symbols.begin; p != ctx->symbols.end; p++)
+    {
+        if ((*p)->cls != CLS_STRUCT)
+            continue;
+        printf("struct %s: size %d, align %d\n", (*p)->name, (*p)->size, (*p)->align);
+        for (m = (*p)->members.begin; m != (*p)->members.end; m++)
+        {
+            printf("    %s: ", (*m)->name);
+            printType((*m)->type);
+            printf(", offset %d, size %ld\n", (*m)->offset, typeSize((*m)->type));
+        }
+    }
+}
+
+const char *internText(Context *ctx, const char *text)
+{
+    return ctx->names[intern(ctx, text, strlen(text))].text;
+}
+
+Symbol *addExtFunc(Context *ctx, const char *name, Type *type, int code)
+{
+    Symbol *s = addSymbol(ctx, &ctx->symbols, internText(ctx, name), CLS_EXTFUNC);
+    s->type = type;
+    s->code = code;
+    return s;
+}
+
+Symbol *addFuncArg(Context *ctx, Symbol *func, const char *name, Type *type)
+{
+    Symbol *a = addSymbol(ctx, &func->args, internText(ctx, name), CLS_VAR);
+    a->mem = MEM_ARG;
+    a->type = type;
+    return a;
+}
+
+// The functions of the runtime
+void addBuiltins(Context *ctx)
+{
+    Symbol *s;
+    s = addExtFunc(ctx, "put_s", createType(ctx, TB_VOID, -1), OP_PUT_S);
+    addFuncArg(ctx, s, "s", createType(ctx, TB_CHAR, 0));
+    s = addExtFunc(ctx, "get_s", createType(ctx, TB_VOID, -1), OP_GET_S);
+    addFuncArg(ctx, s, "s", createType(ctx, TB_CHAR, 0));
+    s = addExtFunc(ctx, "put_i", createType(ctx, TB_VOID, -1), OP_PUT_I);
+    addFuncArg(ctx, s, "i", createType(ctx, TB_INT, -1));
+    addExtFunc(ctx, "get_i", createType(ctx, TB_INT, -1), OP_GET_I);
+    s = addExtFunc(ctx, "put_d", createType(ctx, TB_VOID, -1), OP_PUT_D);
+    addFuncArg(ctx, s, "d", createType(ctx, TB_DOUBLE, -1));
+    addExtFunc(ctx, "get_d", createType(ctx, TB_DOUBLE, -1), OP_GET_D);
+    s = addExtFunc(ctx, "put_c", createType(ctx, TB_VOID, -1), OP_PUT_C);
+    addFuncArg(ctx, s, "c", createType(ctx, TB_CHAR, -1));
+    addExtFunc(ctx, "get_c", createType(ctx, TB_CHAR, -1), OP_GET_C);
+    addExtFunc(ctx, "seconds", createType(ctx, TB_DOUBLE, -1), OP_SECONDS);
+}
+
+// The interned name of the token
+const char *tkName(Context *ctx, int tk)
+{
+    return ctx->names[ctx->tokens.aux[tk]].text;
+}
+
+// Returns the size of an array, from its checked and folded size expression
+int arraySize(Context *ctx, int node)
+{
+    Node *n = &ctx->nodes[node];
+    long size;
+    if (n->kind == N_CAST && ctx->nodes[n->b].kind == N_CONST && ctx->nodes[n->b].op == CT_REAL) // not folded, out of the range of long
+        tkerr(ctx, n->tk, "invalid array size: %g", ctx->literals[ctx->tokens.aux[ctx->nodes[n->b].tk]].r);
+    if (n->kind != N_CONST || n->op == CT_STRING)
+        tkerr(ctx, n->tk, "the array size is not a constant");
+    if (n->op == CT_REAL)
+        tkerr(ctx, n->tk, "the array size is not an integer");
+    size = ctx->literals[ctx->tokens.aux[n->tk]].i;
+    if (size <= 0 || size > INT_MAX)
+        tkerr(ctx, n->tk, "invalid array size: %ld", size);
+    return size;
+}
+
+// Returns the type described by an N_TYPE node
+Type *domainType(Context *ctx, int node)
+{
+    Node *n = &ctx->nodes[node];
+    Symbol *s = NULL;
+    int typeBase, nElements = -1;
+    switch (n->op)
+    {
+    case INT: typeBase = TB_INT; break;
+    case DOUBLE: typeBase = TB_DOUBLE; break;
+    case CHAR: typeBase = TB_CHAR; break;
+    case VOID: typeBase = TB_VOID; break;
+    default:
+        typeBase = TB_STRUCT;
+        if (!(s = findSymbol(ctx, tkName(ctx, n->tk + 1))))
+            tkerr(ctx, n->tk + 1, "undefined symbol: %s", tkName(ctx, n->tk + 1));
+        if (s->cls != CLS_STRUCT)
+            tkerr(ctx, n->tk + 1, "%s is not a struct", s->name);
+    }
+    if (n->flags & F_ARRAY)
+        nElements = n->a ? arraySize(ctx, n->a) : 0;
+    else if (n->flags & F_POINTER)
+        nElements = 0;
+    return internType(ctx, typeBase, s, nElements);
+}
+
+// Checks that a value of type src can be converted to the type dst
+void cast(Context *ctx, int tk, Type *dst, Type *src)
+{
+    if (dst == src)
+        return;
+    if (src->nElements >= 0 || dst->nElements >= 0)
+    {
+        if (src->nElements < 0)
+            tkerr(ctx, tk, "a non-array cannot be converted to an array");
+        if (dst->nElements < 0)
+            tkerr(ctx, tk, "an array cannot be converted to a non-array");
+        if (src->typeBase != dst->typeBase || src->s != dst->s)
+            tkerr(ctx, tk, "an array cannot be converted to an array of another type");
+        return;
+    }
+    switch (src->typeBase)
+    {
+    case TB_CHAR:
+    case TB_INT:
+    case TB_DOUBLE:
+        if (dst->typeBase == TB_CHAR || dst->typeBase == TB_INT || dst->typeBase == TB_DOUBLE)
+            return;
+        break;
+    case TB_STRUCT:
+        if (dst->typeBase == TB_STRUCT)
+            tkerr(ctx, tk, "a structure can only be converted to the same structure");
+        break;
+    }
+    tkerr(ctx, tk, "incompatible types");
+}
+
+// The type of the result of an arithmetic operator
+Type *arithType(Context *ctx, Type *a, Type *b)
+{
+    if (a->typeBase == TB_DOUBLE || b->typeBase == TB_DOUBLE)
+        return createType(ctx, TB_DOUBLE, -1);
+    if (a->typeBase == TB_INT || b->typeBase == TB_INT)
+        return createType(ctx, TB_INT, -1);
+    return createType(ctx, TB_CHAR, -1);
+}
+
+int isLValue(Context *ctx, int node)
+{
+    int kind = ctx->nodes[node].kind;
+    return kind == N_ID || kind == N_INDEX || kind == N_MEMBER;
+}
+
+Type *checkExpr(Context *ctx, int node);
+Type *nodeType(Context *ctx, int node);
+
+// Constant folding: an operator whose operands are constants is replaced by
+// a constant node with its result, computed with the types of the operands.
+// As the expressions are checked from the leaves up, whole constant
+// expressions are folded. The values of type int wrap around, and those of
+// type char are truncated to char.
+
+int isConstNode(Context *ctx, int node)
+{
+    return ctx->nodes[node].kind == N_CONST && ctx->nodes[node].op != CT_STRING;
+}
+
+// Tells if the integer part of the double is in the range of long, so that
+// its conversion is defined
+int fitsLong(double d)
+{
+    return d >= (double)LONG_MIN && d < -(double)LONG_MIN;
+}
+
+// The value of a constant node, converted to the type base. A real converted
+// to an integer must fit in a long.
+Literal constValue(Context *ctx, int node, int typeBase)
+{
+    Node *n = &ctx->nodes[node];
+    Literal v = ctx->literals[ctx->tokens.aux[n->tk]];
+    if (n->op == CT_REAL)
+    {
+        if (typeBase != TB_DOUBLE)
+            v.i = (long)v.r;
+    }
+    else if (typeBase == TB_DOUBLE)
+        v.r = (double)v.i;
+    if (typeBase == TB_CHAR)
+        v.i = (char)v.i;
+    return v;
+}
+
+// Replaces the expression node by a constant with the given value. The token
+// of the constant is added at the position of the token of the node.
+void replaceByConst(Context *ctx, int node, int typeBase, Literal value)
+{
+    Node *n = &ctx->nodes[node];
+    int tk;
+    reserveTokens(ctx, 1);
+    tk = ctx->tokens.n++;
+    ctx->tokens.code[tk] = typeBase == TB_DOUBLE ? CT_REAL : typeBase == TB_CHAR ? CT_CHAR : CT_INT;
+    ctx->tokens.offset[tk] = ctx->tokens.offset[n->tk];
+    ctx->tokens.length[tk] = ctx->tokens.length[n->tk];
+    if (ctx->nLiterals >= ctx->literalsCapacity)
+        ctx->literals = (Literal *)growArray(ctx->literals, &ctx->literalsCapacity, 256, sizeof(Literal));
+    if (typeBase == TB_CHAR)
+        value.i = (char)value.i;
+    ctx->tokens.aux[tk] = ctx->nLiterals;
+    ctx->literals[ctx->nLiterals++] = value;
+    n->kind = N_CONST;
+    n->op = ctx->tokens.code[tk];
+    n->tk = tk;
+    n->a = n->b = n->c = 0;
+    ctx->nFolded++;
+}
+
+int isTrue(Context *ctx, int node)
+{
+    int typeBase = nodeType(ctx, node)->typeBase;
+    Literal v = constValue(ctx, node, typeBase);
+    return typeBase == TB_DOUBLE ? v.r != 0 : v.i != 0;
+}
+
+// Folds the checked unary, binary or cast node of type t if its operands are constants
+void foldConst(Context *ctx, int node, Type *t)
+{
+    Node *n = &ctx->nodes[node];
+    Literal a, b, r;
+    int typeBase;
+    switch (n->kind)
+    {
+    case N_CAST:
+        if (!isConstNode(ctx, n->b) || t->nElements >= 0)
+            return;
+        if (ctx->nodes[n->b].op == CT_REAL && t->typeBase != TB_DOUBLE &&
+            !fitsLong(ctx->literals[ctx->tokens.aux[ctx->nodes[n->b].tk]].r))
+            return; // left to be converted at run time
+        r = constValue(ctx, n->b, t->typeBase);
+        break;
+    case N_UNARY:
+        if (!isConstNode(ctx, n->a))
+            return;
+        if (n->op == NOT)
+            r.i = !isTrue(ctx, n->a);
+        else if (t->typeBase == TB_DOUBLE)
+            r.r = -constValue(ctx, n->a, TB_DOUBLE).r;
+        else
+            r.i = -(unsigned long)constValue(ctx, n->a, t->typeBase).i;
+        break;
+    default:
+        if (!isConstNode(ctx, n->a) || !isConstNode(ctx, n->b))
+            return;
+        if (n->op == AND || n->op == OR)
+        {
+            r.i = n->op == AND ? isTrue(ctx, n->a) && isTrue(ctx, n->b) : isTrue(ctx, n->a) || isTrue(ctx, n->b);
+            break;
+        }
+        typeBase = arithType(ctx, nodeType(ctx, n->a), nodeType(ctx, n->b))->typeBase;
+        a = constValue(ctx, n->a, typeBase);
+        b = constValue(ctx, n->b, typeBase);
+        if (typeBase == TB_DOUBLE)
+        {
+            switch (n->op)
+            {
+            case ADD: r.r = a.r + b.r; break;
+            case SUB: r.r = a.r - b.r; break;
+            case MUL: r.r = a.r * b.r; break;
+            case DIV: r.r = a.r / b.r; break;
+            case EQUAL: r.i = a.r == b.r; break;
+            case NOTEQ: r.i = a.r != b.r; break;
+            case LESS: r.i = a.r < b.r; break;
+            case LESSEQ: r.i = a.r <= b.r; break;
+            case GREATER: r.i = a.r > b.r; break;
+            default: r.i = a.r >= b.r;
             }
-            else if (ch == '.')
+            break;
+        }
+        switch (n->op)
+        {
+        case ADD: r.i = (unsigned long)a.i + b.i; break;
+        case SUB: r.i = (unsigned long)a.i - b.i; break;
+        case MUL: r.i = (unsigned long)a.i * b.i; break;
+        case DIV:
+            if (b.i == 0 || (b.i == -1 && a.i == LONG_MIN))
+                return; // left to fail at run time
+            r.i = a.i / b.i;
+            break;
+        case EQUAL: r.i = a.i == b.i; break;
+        case NOTEQ: r.i = a.i != b.i; break;
+        case LESS: r.i = a.i < b.i; break;
+        case LESSEQ: r.i = a.i <= b.i; break;
+        case GREATER: r.i = a.i > b.i; break;
+        default: r.i = a.i >= b.i;
+        }
+    }
+    replaceByConst(ctx, node, t->typeBase, r);
+}
+
+// Checks an expression whose value is used
+Type *checkValue(Context *ctx, int node)
+{
+    Type *t = checkExpr(ctx, node);
+    if (t->typeBase == TB_VOID)
+        tkerr(ctx, ctx->nodes[node].tk, "a void value cannot be used");
+    return t;
+}
+
+// Checks an expression which is tested as a condition
+void checkCondition(Context *ctx, int node)
+{
+    Type *t = checkValue(ctx, node);
+    if (t->typeBase == TB_STRUCT)
+        tkerr(ctx, ctx->nodes[node].tk, "a structure cannot be logically tested");
+    if (t->nElements >= 0)
+        tkerr(ctx, ctx->nodes[node].tk, "an array cannot be logically tested");
+}
+
+// Resolves the names of the expression and returns its type; both are
+// recorded in nodeInfo
+Type *checkExpr(Context *ctx, int node)
+{
+    Node *n = &ctx->nodes[node];
+    Symbol *s, **param;
+    Type *t, *u;
+    int arg;
+    switch (n->kind)
+    {
+    case N_CONST:
+        switch (n->op)
+        {
+        case CT_INT: t = createType(ctx, TB_INT, -1); break;
+        case CT_REAL: t = createType(ctx, TB_DOUBLE, -1); break;
+        case CT_CHAR: t = createType(ctx, TB_CHAR, -1); break;
+        default: t = createType(ctx, TB_CHAR, 0);
+        }
+        break;
+    case N_ID:
+        if (!(s = findSymbol(ctx, tkName(ctx, n->tk))))
+            tkerr(ctx, n->tk, "undefined symbol: %s", tkName(ctx, n->tk));
+        if (s->cls == CLS_FUNC || s->cls == CLS_EXTFUNC)
+            tkerr(ctx, n->tk, "missing call for function %s", s->name);
+        if (s->cls != CLS_VAR)
+            tkerr(ctx, n->tk, "%s is not a variable", s->name);
+        ctx->nodeInfo[node].symbol = s;
+        return s->type;
+    case N_CALL:
+        if (!(s = findSymbol(ctx, tkName(ctx, n->tk))))
+            tkerr(ctx, n->tk, "undefined symbol: %s", tkName(ctx, n->tk));
+        if (s->cls != CLS_FUNC && s->cls != CLS_EXTFUNC)
+            tkerr(ctx, n->tk, "only a function can be called");
+        ctx->nodeInfo[node].symbol = s;
+        for (arg = n->a, param = s->args.begin; arg; arg = ctx->nodes[arg].next, param++)
+        {
+            if (param == s->args.end)
+                tkerr(ctx, ctx->nodes[arg].tk, "too many arguments in call");
+            cast(ctx, ctx->nodes[arg].tk, (*param)->type, checkValue(ctx, arg));
+        }
+        if (param != s->args.end)
+            tkerr(ctx, n->tk, "too few arguments in call");
+        return s->type;
+    case N_MEMBER:
+        u = checkValue(ctx, n->a);
+        if (u->typeBase != TB_STRUCT || u->nElements >= 0)
+            tkerr(ctx, n->tk, "a field can only be selected from a struct");
+        if (!(s = findSymbolIn(&u->s->members, tkName(ctx, n->tk))))
+            tkerr(ctx, n->tk, "struct %s does not have a field %s", u->s->name, tkName(ctx, n->tk));
+        ctx->nodeInfo[node].symbol = s;
+        return s->type;
+    case N_INDEX:
+        u = checkValue(ctx, n->a);
+        if (u->nElements < 0)
+            tkerr(ctx, n->tk, "only an array can be indexed");
+        t = checkValue(ctx, n->b);
+        if (t->nElements >= 0 || t->typeBase == TB_STRUCT)
+            tkerr(ctx, ctx->nodes[n->b].tk, "the index is not convertible to int");
+        t = elementType(ctx, u);
+        break;
+    case N_UNARY:
+        t = checkValue(ctx, n->a);
+        if (t->nElements >= 0)
+            tkerr(ctx, n->tk, "unary '%s' cannot be applied to an array", tkTexts[n->op]);
+        if (t->typeBase == TB_STRUCT)
+            tkerr(ctx, n->tk, "unary '%s' cannot be applied to a struct", tkTexts[n->op]);
+        if (n->op == NOT)
+            t = createType(ctx, TB_INT, -1);
+        break;
+    case N_BINARY:
+        t = checkValue(ctx, n->a);
+        u = checkValue(ctx, n->b);
+        switch (n->op)
+        {
+        case AND:
+        case OR:
+            if (t->typeBase == TB_STRUCT || u->typeBase == TB_STRUCT)
+                tkerr(ctx, n->tk, "a structure cannot be logically tested");
+            if (t->nElements >= 0 || u->nElements >= 0)
+                tkerr(ctx, n->tk, "an array cannot be logically tested");
+            t = createType(ctx, TB_INT, -1);
+            break;
+        case ADD:
+        case SUB:
+        case MUL:
+        case DIV:
+            if (t->typeBase == TB_STRUCT || u->typeBase == TB_STRUCT)
+                tkerr(ctx, n->tk, "a structure cannot be added, subtracted, multiplied or divided");
+            if (t->nElements >= 0 || u->nElements >= 0)
+                tkerr(ctx, n->tk, "an array cannot be added, subtracted, multiplied or divided");
+            t = arithType(ctx, t, u);
+            break;
+        default: // the comparisons
+            if (t->typeBase == TB_STRUCT || u->typeBase == TB_STRUCT)
+                tkerr(ctx, n->tk, "a structure cannot be compared");
+            if (t->nElements >= 0 || u->nElements >= 0)
+                tkerr(ctx, n->tk, "an array cannot be compared");
+            t = createType(ctx, TB_INT, -1);
+        }
+        break;
+    case N_ASSIGN:
+        t = checkValue(ctx, n->a);
+        u = checkValue(ctx, n->b);
+        if (!isLValue(ctx, n->a))
+            tkerr(ctx, n->tk, "cannot assign to a non-lval");
+        if (t->nElements >= 0 || u->nElements >= 0)
+            tkerr(ctx, n->tk, "the arrays cannot be assigned");
+        cast(ctx, n->tk, t, u);
+        break;
+    case N_CAST:
+        if (ctx->nodes[n->a].a)
+            checkValue(ctx, ctx->nodes[n->a].a); // the array size
+        t = domainType(ctx, n->a);
+        cast(ctx, n->tk, t, checkValue(ctx, n->b));
+        break;
+    default:
+        tkerr(ctx, n->tk, "expression expected");
+    }
+    ctx->nodeInfo[node].type = t;
+    if (n->kind == N_UNARY || n->kind == N_BINARY || n->kind == N_CAST)
+        foldConst(ctx, node, t);
+    return t;
+}
+
+// The type of an expression checked by checkExpr
+Type *nodeType(Context *ctx, int node)
+{
+    switch (ctx->nodes[node].kind)
+    {
+    case N_ID:
+    case N_CALL:
+    case N_MEMBER:
+        return ctx->nodeInfo[node].symbol->type;
+    default:
+        return ctx->nodeInfo[node].type;
+    }
+}
+
+void checkDomain(Context *ctx, int node);
+
+// Adds the symbol declared by an N_VAR or N_PARAM node to the list, which
+// must not already have a symbol with its name at the current depth
+Symbol *domainVar(Context *ctx, Symbols *symbols, int node, int mem)
+{
+    Node *n = &ctx->nodes[node];
+    const char *name = tkName(ctx, n->tk);
+    Symbol *s = symbols == &ctx->symbols ? findSymbol(ctx, name) : findSymbolIn(symbols, name);
+    Type *t;
+    if (ctx->nodes[n->a].a)
+        checkValue(ctx, ctx->nodes[n->a].a); // the array size
+    t = domainType(ctx, n->a);
+    if (s && s->depth == ctx->crtDepth)
+        tkerr(ctx, n->tk, "symbol redefinition: %s", name);
+    if (t->nElements == 0 && mem != MEM_ARG)
+        tkerr(ctx, n->tk, "a vector variable must have a specified dimension");
+    s = addSymbol(ctx, symbols, name, CLS_VAR);
+    s->mem = mem;
+    s->type = t;
+    ctx->nodeInfo[node].symbol = s;
+    return s;
+}
+
+// Checks the declarations and the statements in the node and in the nodes
+// which follow it: adds the declared symbols to the table, resolves the
+// names used and checks the types of the expressions
+void checkDomain(Context *ctx, int node)
+{
+    for (; node; node = ctx->nodes[node].next)
+    {
+        Node *n = &ctx->nodes[node];
+        const char *name;
+        Symbol *s;
+        int param;
+        switch (n->kind)
+        {
+        case N_UNIT:
+            ctx->nodeInfo = (NodeInfo *)calloc(ctx->nNodes, sizeof(NodeInfo));
+            if (ctx->nodeInfo == NULL)
+                err("not enough memory");
+            addBuiltins(ctx);
+            checkDomain(ctx, n->a);
+            break;
+        case N_STRUCT:
+            name = tkName(ctx, n->tk);
+            if (findSymbol(ctx, name))
+                tkerr(ctx, n->tk, "symbol redefinition: %s", name);
+            s = addSymbol(ctx, &ctx->symbols, name, CLS_STRUCT);
+            ctx->nodeInfo[node].symbol = s;
+            for (param = n->a; param; param = ctx->nodes[param].next)
             {
-                pCrtCh++;
-                state = 8;
+                Type *t = domainVar(ctx, &s->members, param, MEM_GLOBAL)->type;
+                if (t->s == s)
+                    tkerr(ctx, ctx->nodes[param].tk, "struct %s cannot contain itself", name);
             }
-            else if (ch == 'e' || ch == 'E')
+            layoutStruct(ctx, s, n->tk);
+            break;
+        case N_VAR:
+            domainVar(ctx, &ctx->symbols, node, ctx->crtDepth ? MEM_LOCAL : MEM_GLOBAL);
+            break;
+        case N_FUNC:
+            name = tkName(ctx, n->tk);
+            if (findSymbol(ctx, name))
+                tkerr(ctx, n->tk, "symbol redefinition: %s", name);
+            s = addSymbol(ctx, &ctx->symbols, name, CLS_FUNC);
+            s->type = domainType(ctx, n->a);
+            ctx->nodeInfo[node].symbol = s;
+            ctx->crtFunc = s;
+            enterScope(ctx);
+            for (param = n->b; param; param = ctx->nodes[param].next)
+                pushSymbol(ctx, &s->args, domainVar(ctx, &ctx->symbols, param, MEM_ARG));
+            checkDomain(ctx, ctx->nodes[n->c].a); // the body is in the scope of the args, which it cannot redefine
+            deleteSymbolsAfter(ctx, 0);
+            ctx->crtFunc = NULL;
+            break;
+        case N_BLOCK:
+            enterScope(ctx);
+            checkDomain(ctx, n->a);
+            deleteSymbolsAfter(ctx, ctx->crtDepth - 1);
+            break;
+        case N_IF:
+            checkCondition(ctx, n->a);
+            checkDomain(ctx, n->b);
+            checkDomain(ctx, n->c);
+            break;
+        case N_WHILE:
+            checkCondition(ctx, n->a);
+            ctx->loopDepth++;
+            checkDomain(ctx, n->b);
+            ctx->loopDepth--;
+            break;
+        case N_FOR:
+            param = n->a; // initialization, condition and step
+            if (ctx->nodes[param].kind != N_EMPTY)
+                checkExpr(ctx, param);
+            param = ctx->nodes[param].next;
+            if (ctx->nodes[param].kind != N_EMPTY)
+                checkCondition(ctx, param);
+            param = ctx->nodes[param].next;
+            if (ctx->nodes[param].kind != N_EMPTY)
+                checkExpr(ctx, param);
+            ctx->loopDepth++;
+            checkDomain(ctx, n->b);
+            ctx->loopDepth--;
+            break;
+        case N_BREAK:
+            if (!ctx->loopDepth)
+                tkerr(ctx, n->tk, "break outside of a loop");
+            break;
+        case N_RETURN:
+            if (n->a)
             {
-                pCrtCh++;
-                state = 10;
+                if (ctx->crtFunc->type->typeBase == TB_VOID)
+                    tkerr(ctx, n->tk, "a void function cannot return a value");
+                cast(ctx, n->tk, ctx->crtFunc->type, checkValue(ctx, n->a));
+            }
+            else if (ctx->crtFunc->type->typeBase != TB_VOID)
+                tkerr(ctx, n->tk, "a non-void function must return a value");
+            break;
+        case N_EMPTY:
+            break;
+        default: // an expression statement
+            checkExpr(ctx, node);
+        }
+    }
+}
+
+// Code generation: the checked tree is translated to the instructions of the
+// virtual machine. The globals are laid out in one block allocated before
+// the code is generated, so their addresses are constants of the code. The
+// locals and the arguments are at offsets in the frame of their function; the
+// locals of sibling blocks share the same bytes. An array argument is passed
+// as the address of the array, and a struct argument is copied in the frame.
+
+#define OP_STACK(name, arg, stack) stack,
+const signed char opStack[] = {OPCODES(OP_STACK)};
+
+int emit(Context *ctx, int op)
+{
+    if (ctx->nCode >= ctx->codeCapacity)
+        ctx->code = (Instr *)growArray(ctx->code, &ctx->codeCapacity, 1024, sizeof(Instr));
+    memset(&ctx->code[ctx->nCode], 0, sizeof(Instr));
+    ctx->code[ctx->nCode].op = op;
+    ctx->stackDepth += opStack[op];
+    if (ctx->stackDepth > ctx->maxStackDepth)
+        ctx->maxStackDepth = ctx->stackDepth;
+    return ctx->nCode++;
+}
+
+int emitI(Context *ctx, int op, long i)
+{
+    int k = emit(ctx, op);
+    ctx->code[k].i = i;
+    return k;
+}
+
+int emitD(Context *ctx, int op, double d)
+{
+    int k = emit(ctx, op);
+    ctx->code[k].d = d;
+    return k;
+}
+
+int emitP(Context *ctx, int op, char *p)
+{
+    int k = emit(ctx, op);
+    ctx->code[k].p = p;
+    return k;
+}
+
+// Makes the jump at k go to the next instruction to be emitted
+void patchJump(Context *ctx, int k)
+{
+    ctx->code[k].i = ctx->nCode;
+}
+
+// Returns the offset of a new local in the frame
+int allocLocal(Context *ctx, long size, int align)
+{
+    long offset = (ctx->frameOffset + align - 1) & -align;
+    if (offset + size > INT_MAX)
+        err("the frame of a function is too large");
+    ctx->frameOffset = offset + size;
+    if (ctx->frameOffset > ctx->frameSize)
+        ctx->frameSize = ctx->frameOffset;
+    return offset;
+}
+
+// An array argument holds the address of the array
+int isArrayArg(Symbol *s)
+{
+    return s->mem == MEM_ARG && s->type->nElements >= 0;
+}
+
+// Converts the value on the stack between scalar types
+void genConvert(Context *ctx, Type *from, Type *to)
+{
+    if (from == to || from->nElements >= 0 || from->typeBase == TB_STRUCT || to->typeBase == TB_VOID)
+        return;
+    if (to->typeBase == TB_DOUBLE)
+    {
+        if (from->typeBase != TB_DOUBLE)
+            emit(ctx, OP_I2D);
+        return;
+    }
+    if (from->typeBase == TB_DOUBLE)
+        emit(ctx, OP_D2I);
+    if (to->typeBase == TB_CHAR && from->typeBase != TB_CHAR)
+        emit(ctx, OP_I2C);
+}
+
+// Replaces the address on the stack by the value of type t at it
+void genLoad(Context *ctx, Type *t)
+{
+    if (t->nElements >= 0 || t->typeBase == TB_STRUCT)
+        return; // handled by address
+    emit(ctx, t->typeBase == TB_DOUBLE ? OP_LOAD_D : t->typeBase == TB_CHAR ? OP_LOAD_C : OP_LOAD_I);
+}
+
+// Emits a jump taken if the value of type t on the stack is true, or false
+int genJumpIf(Context *ctx, Type *t, int ifTrue)
+{
+    int isDouble = t->typeBase == TB_DOUBLE;
+    return emitI(ctx, ifTrue ? (isDouble ? OP_JT_D : OP_JT_I) : (isDouble ? OP_JF_D : OP_JF_I), -1);
+}
+
+void genExpr(Context *ctx, int node);
+
+// Pushes the address of an N_ID, N_INDEX or N_MEMBER node
+void genAddr(Context *ctx, int node)
+{
+    Node *n = &ctx->nodes[node];
+    Symbol *s;
+    switch (n->kind)
+    {
+    case N_ID:
+        s = ctx->nodeInfo[node].symbol;
+        if (s->mem == MEM_GLOBAL)
+            emitP(ctx, OP_PUSH_A, ctx->globals + s->offset);
+        else
+            emitI(ctx, OP_ADDR_L, s->offset);
+        break;
+    case N_INDEX:
+        genExpr(ctx, n->a);
+        genExpr(ctx, n->b);
+        genConvert(ctx, nodeType(ctx, n->b), createType(ctx, TB_INT, -1));
+        emitI(ctx, OP_INDEX, typeSize(nodeType(ctx, node)));
+        break;
+    default:
+        genExpr(ctx, n->a);
+        if (ctx->nodeInfo[node].symbol->offset)
+            emitI(ctx, OP_OFFSET, ctx->nodeInfo[node].symbol->offset);
+    }
+}
+
+void genCall(Context *ctx, int node)
+{
+    Node *n = &ctx->nodes[node];
+    Symbol *s = ctx->nodeInfo[node].symbol, **param;
+    int arg, isStruct = s->type->typeBase == TB_STRUCT && s->type->nElements < 0;
+    if (isStruct) // the result is copied from the frame of the function in a local
+        emitI(ctx, OP_ADDR_L, allocLocal(ctx, typeSize(s->type), typeAlign(s->type)));
+    for (arg = n->a, param = s->args.begin; arg; arg = ctx->nodes[arg].next, param++)
+    {
+        genExpr(ctx, arg);
+        genConvert(ctx, nodeType(ctx, arg), (*param)->type);
+    }
+    if (s->cls == CLS_EXTFUNC)
+        emit(ctx, s->code);
+    else
+    {
+        emitI(ctx, OP_CALL, s->code);
+        ctx->stackDepth -= s->args.end - s->args.begin;
+        ctx->stackDepth += s->type->typeBase != TB_VOID;
+    }
+    if (isStruct)
+        emitI(ctx, OP_COPY, typeSize(s->type));
+}
+
+// && and || push 1 or 0, and evaluate their second operand only if needed
+void genLogic(Context *ctx, int node)
+{
+    Node *n = &ctx->nodes[node];
+    int isAnd = n->op == AND, first, second, end;
+    genExpr(ctx, n->a);
+    first = genJumpIf(ctx, nodeType(ctx, n->a), !isAnd);
+    genExpr(ctx, n->b);
+    second = genJumpIf(ctx, nodeType(ctx, n->b), !isAnd);
+    emitI(ctx, OP_PUSH_I, isAnd);
+    end = emitI(ctx, OP_JMP, -1);
+    patchJump(ctx, first);
+    patchJump(ctx, second);
+    ctx->stackDepth--; // the jumps come here without the value pushed before the JMP
+    emitI(ctx, OP_PUSH_I, !isAnd);
+    patchJump(ctx, end);
+}
+
+const int binaryOps[] = {
+    [ADD] = OP_ADD_I, [SUB] = OP_SUB_I, [MUL] = OP_MUL_I, [DIV] = OP_DIV_I,
+    [EQUAL] = OP_EQ_I, [NOTEQ] = OP_NE_I, [LESS] = OP_LT_I, [LESSEQ] = OP_LE_I,
+    [GREATER] = OP_GT_I, [GREATEREQ] = OP_GE_I};
+
+// Pushes the value of the expression; a struct or an array by its address
+void genExpr(Context *ctx, int node)
+{
+    Node *n = &ctx->nodes[node];
+    Literal *literal;
+    Type *t = nodeType(ctx, node), *operands;
+    switch (n->kind)
+    {
+    case N_CONST:
+        literal = &ctx->literals[ctx->tokens.aux[n->tk]];
+        if (n->op == CT_REAL)
+            emitD(ctx, OP_PUSH_D, literal->r);
+        else if (n->op == CT_STRING)
+            emitP(ctx, OP_PUSH_A, (char *)tkName(ctx, n->tk));
+        else
+            emitI(ctx, OP_PUSH_I, literal->i);
+        break;
+    case N_ID:
+    case N_INDEX:
+    case N_MEMBER:
+        genAddr(ctx, node);
+        if (n->kind == N_ID && isArrayArg(ctx->nodeInfo[node].symbol))
+            emit(ctx, OP_LOAD_I);
+        else
+            genLoad(ctx, t);
+        break;
+    case N_CALL:
+        genCall(ctx, node);
+        break;
+    case N_CAST:
+        genExpr(ctx, n->b);
+        genConvert(ctx, nodeType(ctx, n->b), t);
+        break;
+    case N_UNARY:
+        genExpr(ctx, n->a);
+        if (n->op == NOT)
+            emit(ctx, nodeType(ctx, n->a)->typeBase == TB_DOUBLE ? OP_NOT_D : OP_NOT_I);
+        else if (t->typeBase == TB_DOUBLE)
+            emit(ctx, OP_NEG_D);
+        else
+        {
+            emit(ctx, OP_NEG_I);
+            if (t->typeBase == TB_CHAR)
+                emit(ctx, OP_I2C);
+        }
+        break;
+    case N_BINARY:
+        if (n->op == AND || n->op == OR)
+        {
+            genLogic(ctx, node);
+            break;
+        }
+        operands = arithType(ctx, nodeType(ctx, n->a), nodeType(ctx, n->b));
+        genExpr(ctx, n->a);
+        genConvert(ctx, nodeType(ctx, n->a), operands);
+        genExpr(ctx, n->b);
+        genConvert(ctx, nodeType(ctx, n->b), operands);
+        emit(ctx, binaryOps[n->op] + (operands->typeBase == TB_DOUBLE));
+        if (t->typeBase == TB_CHAR)
+            emit(ctx, OP_I2C);
+        break;
+    default: // N_ASSIGN
+        genAddr(ctx, n->a);
+        genExpr(ctx, n->b);
+        if (t->typeBase == TB_STRUCT)
+            emitI(ctx, OP_COPY, typeSize(t));
+        else
+        {
+            genConvert(ctx, nodeType(ctx, n->b), t);
+            emit(ctx, t->typeBase == TB_DOUBLE ? OP_STORE_D : t->typeBase == TB_CHAR ? OP_STORE_C : OP_STORE_I);
+        }
+    }
+}
+
+// An expression whose value is not used. The value assigned to a local
+// scalar is popped into it, without pushing its address.
+void genDiscard(Context *ctx, int node)
+{
+    Node *n = &ctx->nodes[node];
+    Type *t = nodeType(ctx, node);
+    if (n->kind == N_ASSIGN && ctx->nodes[n->a].kind == N_ID && t->typeBase != TB_STRUCT &&
+        ctx->nodeInfo[n->a].symbol->mem != MEM_GLOBAL)
+    {
+        genExpr(ctx, n->b);
+        genConvert(ctx, nodeType(ctx, n->b), t);
+        emitI(ctx, t->typeBase == TB_CHAR ? OP_POP_L_C : OP_POP_L, ctx->nodeInfo[n->a].symbol->offset);
+        return;
+    }
+    genExpr(ctx, node);
+    if (t->typeBase != TB_VOID)
+        emit(ctx, OP_DROP);
+}
+
+void genStm(Context *ctx, int node);
+
+// Emits the body of a loop, and then patches its break statements to jump after the loop
+void genLoopBody(Context *ctx, int body, int start, int step)
+{
+    int firstBreak = ctx->nBreaks;
+    genStm(ctx, body);
+    if (step && ctx->nodes[step].kind != N_EMPTY)
+        genDiscard(ctx, step);
+    emitI(ctx, OP_JMP, start);
+    while (ctx->nBreaks > firstBreak)
+        patchJump(ctx, ctx->breaks[--ctx->nBreaks]);
+}
+
+void genStm(Context *ctx, int node)
+{
+    for (; node; node = ctx->nodes[node].next)
+    {
+        Node *n = &ctx->nodes[node];
+        Symbol *s;
+        int jump, start, cond, offset;
+        switch (n->kind)
+        {
+        case N_BLOCK:
+            offset = ctx->frameOffset;
+            genStm(ctx, n->a);
+            ctx->frameOffset = offset;
+            break;
+        case N_VAR:
+            s = ctx->nodeInfo[node].symbol;
+            s->offset = allocLocal(ctx, typeSize(s->type), typeAlign(s->type));
+            break;
+        case N_IF:
+            genExpr(ctx, n->a);
+            jump = genJumpIf(ctx, nodeType(ctx, n->a), 0);
+            genStm(ctx, n->b);
+            if (n->c)
+            {
+                int end = emitI(ctx, OP_JMP, -1);
+                patchJump(ctx, jump);
+                genStm(ctx, n->c);
+                jump = end;
             }
-            else if (ch >= 8 && ch <= 9)
+            patchJump(ctx, jump);
+            break;
+        case N_WHILE:
+            start = ctx->nCode;
+            genExpr(ctx, n->a);
+            jump = genJumpIf(ctx, nodeType(ctx, n->a), 0);
+            genLoopBody(ctx, n->b, start, 0);
+            patchJump(ctx, jump);
+            break;
+        case N_FOR:
+            if (ctx->nodes[n->a].kind != N_EMPTY)
+                genDiscard(ctx, n->a);
+            start = ctx->nCode;
+            cond = ctx->nodes[n->a].next;
+            jump = -1;
+            if (ctx->nodes[cond].kind != N_EMPTY)
             {
-                pCrtCh++;
-                state = 7;
+                genExpr(ctx, cond);
+                jump = genJumpIf(ctx, nodeType(ctx, cond), 0);
             }
-            else
-                state = 4;
+            genLoopBody(ctx, n->b, start, ctx->nodes[cond].next);
+            if (jump >= 0)
+                patchJump(ctx, jump);
+            break;
+        case N_BREAK:
+            if (ctx->nBreaks >= ctx->breaksCapacity)
+                ctx->breaks = (int *)growArray(ctx->breaks, &ctx->breaksCapacity, 64, sizeof(int));
+            ctx->breaks[ctx->nBreaks++] = emitI(ctx, OP_JMP, -1);
+            break;
+        case N_RETURN:
+            if (n->a)
+            {
+                genExpr(ctx, n->a);
+                genConvert(ctx, nodeType(ctx, n->a), ctx->crtFunc->type);
+                ctx->stackDepth--; // popped by the caller
+            }
+            emit(ctx, OP_RET);
+            break;
+        case N_EMPTY:
+            break;
+        default:
+            genDiscard(ctx, node);
+        }
+    }
+}
+
+void genFunc(Context *ctx, int node)
+{
+    Node *n = &ctx->nodes[node];
+    Symbol *s = ctx->nodeInfo[node].symbol, **arg;
+    int enter, end;
+    s->code = ctx->nCode;
+    ctx->crtFunc = s;
+    ctx->frameOffset = ctx->frameSize = 0;
+    ctx->stackDepth = ctx->maxStackDepth = 0;
+    enter = emit(ctx, OP_ENTER);
+    for (arg = s->args.begin; arg != s->args.end; arg++)
+    {
+        if (isArrayArg(*arg))
+            (*arg)->offset = allocLocal(ctx, 8, 8);
+        else
+            (*arg)->offset = allocLocal(ctx, typeSize((*arg)->type), typeAlign((*arg)->type));
+    }
+    for (arg = s->args.end; arg != s->args.begin;) // the last argument is on the top of the stack
+    {
+        Symbol *a = *--arg;
+        if (a->type->typeBase == TB_STRUCT && !isArrayArg(a))
+        {
+            int k = emit(ctx, OP_POP_L_S);
+            ctx->code[k].n[0] = a->offset;
+            ctx->code[k].n[1] = typeSize(a->type);
+        }
+        else
+            emitI(ctx, a->type->typeBase == TB_CHAR && !isArrayArg(a) ? OP_POP_L_C : OP_POP_L, a->offset);
+    }
+    genStm(ctx, n->c);
+    if (s->type->typeBase == TB_VOID)
+        emit(ctx, OP_RET);
+    else
+    {
+        end = emit(ctx, OP_FALLOFF);
+        ctx->code[end].s = s;
+    }
+    ctx->code[enter].n[0] = (ctx->frameSize + 7) & -8;
+    ctx->code[enter].n[1] = ctx->maxStackDepth;
+    ctx->crtFunc = NULL;
+}
+
+// Allocates the globals, and returns the main function
+Symbol *layoutGlobals(Context *ctx)
+{
+    Symbol *s, *main = findSymbol(ctx, internText(ctx, "main"));
+    int node;
+    if (main == NULL || main->cls != CLS_FUNC)
+        err("the program has no main function");
+    if (main->args.begin != main->args.end)
+        err("main must have no arguments");
+    for (node = ctx->nodes[ctx->root].a; node; node = ctx->nodes[node].next)
+    {
+        if (ctx->nodes[node].kind != N_VAR)
+            continue;
+        s = ctx->nodeInfo[node].symbol;
+        ctx->globalsSize = (ctx->globalsSize + typeAlign(s->type) - 1) & -typeAlign(s->type);
+        s->offset = ctx->globalsSize;
+        ctx->globalsSize += typeSize(s->type);
+    }
+    if ((ctx->globals = (char *)calloc(ctx->globalsSize + 1, 1)) == NULL)
+        err("not enough memory for the globals");
+    return main;
+}
+
+// Generates the code of the checked program, which starts by calling main
+void genProgram(Context *ctx)
+{
+    Symbol *main = layoutGlobals(ctx);
+    int node, call;
+    call = emit(ctx, OP_CALL);
+    emit(ctx, OP_HALT);
+    for (node = ctx->nodes[ctx->root].a; node; node = ctx->nodes[node].next)
+    {
+        if (ctx->nodes[node].kind == N_FUNC)
+            genFunc(ctx, node);
+    }
+    ctx->code[call].i = main->code;
+}
+
+#define OP_NAME(name, arg, stack) #name,
+const char *opNames[] = {OPCODES(OP_NAME)};
+#define OP_ARG(name, arg, stack) arg,
+const unsigned char opArgs[] = {OPCODES(OP_ARG)};
+
+// Peephole optimization: the sequences of instructions which are frequent in
+// the loops are replaced by superinstructions, so that fewer instructions are
+// dispatched. The code is compacted in place, and each instruction added to
+// it is fused with the ones before it while a pattern matches. A jump target
+// starts a new sequence, so no jump goes inside a superinstruction.
+
+// The jumps made by a comparison EQ_I..GE_I followed by JT_I or JF_I
+const int jumpsIfTrue[] = {OP_JEQ_I, OP_JNE_I, OP_JLT_I, OP_JLE_I, OP_JGT_I, OP_JGE_I};
+const int jumpsIfFalse[] = {OP_JNE_I, OP_JEQ_I, OP_JGE_I, OP_JGT_I, OP_JLE_I, OP_JLT_I};
+
+int fitsInt(long i)
+{
+    return i >= INT_MIN && i <= INT_MAX;
+}
+
+// An instruction which only pushes a value
+int isPush(int op)
+{
+    return op == OP_PUSH_I || op == OP_LOAD_L || op == OP_LOAD_L_C || op == OP_LOAD_ELEM_L || op == OP_LOAD_ELEM_A;
+}
+
+// Fuses the last instructions of code[first..*n) into one, if they match a
+// pattern; returns 1 if they did
+int fuseLast(Instr *code, int first, int *n)
+{
+    Instr *a = &code[*n - 1], *b = a - 1, *c = a - 2, *d = a - 3;
+    int len = *n - first, x, y;
+    if (len < 2)
+        return 0;
+    switch (a->op)
+    {
+    case OP_LOAD_I:
+    case OP_LOAD_D:
+    case OP_LOAD_C:
+        if (b->op == OP_ADDR_L)
+            b->op = a->op == OP_LOAD_C ? OP_LOAD_L_C : OP_LOAD_L;
+        else if (a->op != OP_LOAD_C && (b->op == OP_ELEM_L || b->op == OP_ELEM_A))
+            b->op = b->op == OP_ELEM_L ? OP_LOAD_ELEM_L : OP_LOAD_ELEM_A;
+        else
+            return 0;
+        break;
+    case OP_ADD_I:
+    case OP_SUB_I: // x+k, x-k
+        if (b->op != OP_PUSH_I || b->i == LONG_MIN)
+            return 0;
+        b->op = OP_ADD_I_K;
+        if (a->op == OP_SUB_I)
+            b->i = -b->i;
+        break;
+    case OP_INDEX: // v[i], with v a local array or an array arg
+        if (a->i != 8 || len < 3 || b->op != OP_LOAD_L || (c->op != OP_ADDR_L && c->op != OP_LOAD_L))
+            return 0;
+        x = c->i;
+        y = b->i;
+        c->op = c->op == OP_ADDR_L ? OP_ELEM_L : OP_ELEM_A;
+        c->n[0] = x;
+        c->n[1] = y;
+        *n -= 2;
+        return 1;
+    case OP_DROP:
+        if (b->op == OP_STORE_I || b->op == OP_STORE_D)
+            b->op = OP_STOREP;
+        else if (b->op == OP_STORE_C)
+            b->op = OP_STOREP_C;
+        else
+            return 0;
+        break;
+    case OP_JF_I:
+    case OP_JT_I:
+        if (b->op < OP_EQ_I || b->op > OP_GE_I || (b->op - OP_EQ_I) % 2)
+            return 0;
+        b->op = (a->op == OP_JT_I ? jumpsIfTrue : jumpsIfFalse)[(b->op - OP_EQ_I) / 2];
+        b->i = a->i;
+        break;
+    case OP_JEQ_I:
+    case OP_JNE_I:
+    case OP_JLT_I:
+    case OP_JLE_I:
+    case OP_JGT_I:
+    case OP_JGE_I: // a comparison with a constant
+        if (b->op != OP_PUSH_I || !fitsInt(b->i))
+            return 0;
+        x = b->i;
+        b->op = a->op - OP_JEQ_I + OP_JEQ_I_K;
+        b->n[0] = x;
+        b->n[1] = a->i;
+        break;
+    case OP_POP_L:
+        if (b->op == OP_PUSH_I && fitsInt(b->i)) // x=k
+        {
+            x = b->i;
+            b->op = OP_SET_L;
+            b->n[0] = a->i;
+            b->n[1] = x;
+            break;
+        }
+        if (len >= 3 && b->op == OP_ADD_I_K && c->op == OP_LOAD_L && c->i == a->i && fitsInt(b->i)) // x=x+k
+        {
+            x = b->i;
+            c->op = OP_INC_L;
+            c->n[0] = a->i;
+            c->n[1] = x;
+            *n -= 2;
+            return 1;
+        }
+        if (len >= 4 && b->op == OP_ADD_I && d->op == OP_LOAD_L && d->i == a->i && isPush(c->op)) // x=x+e
+        {
+            *d = *c;
+            c->op = OP_ADDTO_L;
+            c->i = a->i;
+            *n -= 2;
+            return 1;
+        }
+        return 0;
+    default:
+        return 0;
+    }
+    (*n)--;
+    return 1;
+}
+
+void fuseCode(Context *ctx)
+{
+    Instr *code = ctx->code;
+    int *map = (int *)malloc((ctx->nCode + 1) * sizeof(int)), k, n = 0, first = 0;
+    char *isTarget = (char *)calloc(ctx->nCode + 1, 1);
+    if (map == NULL || isTarget == NULL)
+        err("not enough memory");
+    for (k = 0; k < ctx->nCode; k++)
+    {
+        if (opArgs[code[k].op] == A_TARGET)
+            isTarget[code[k].i] = 1;
+    }
+    for (k = 0; k < ctx->nCode; k++)
+    {
+        if (isTarget[k])
+            first = n;
+        map[k] = n;
+        code[n++] = code[k];
+        while (fuseLast(code, first, &n))
+            ;
+    }
+    map[ctx->nCode] = n;
+    for (k = 0; k < n; k++)
+    {
+        if (opArgs[code[k].op] == A_TARGET)
+            code[k].i = map[code[k].i];
+        else if (opArgs[code[k].op] == A_KTARGET)
+            code[k].n[1] = map[code[k].n[1]];
+    }
+    ctx->nCode = n;
+    free(map);
+    free(isTarget);
+}
+
+// Prints the code, before it is threaded
+void printCode(Context *ctx)
+{
+    int k;
+    for (k = 0; k < ctx->nCode; k++)
+    {
+        Instr *in = &ctx->code[k];
+        printf("%5d %-8s", k, opNames[in->op]);
+        switch (opArgs[in->op])
+        {
+        case A_INT:
+        case A_TARGET:
+            printf(" %ld", in->i);
+            break;
+        case A_REAL:
+            printf(" %g", in->d);
             break;
-        case 6:
-            if ((ch >= '0' && ch <= '9') || (ch >= 'a' && ch <= 'f') || (ch >= 'A' && ch <= 'F'))
-            {
-                pCrtCh++;
-                state = 6;
-            }
+        case A_ADDR:
+            if (in->p >= ctx->globals && in->p < ctx->globals + ctx->globalsSize)
+                printf(" globals+%ld", (long)(in->p - ctx->globals));
             else
-            {
-                state = 4;
-            }
-            break;
-        case 7:
-            if(ch == '.')
-            {
-                pCrtCh++;
-                state = 8;
-            }
-            else if (ch == 'e' || ch == 'E')
-            {
-                pCrtCh++;
-                state = 10;
-            }
-        case 8:
-            if (ch >= '0' && ch <= '9') {
-                pCrtCh++;
-                state = 9;
-            } else {
-                tkerr(tk, "After '.' a digit is expected");
-            }
+                printf(" \"%s\"", in->p);
             break;
-        case 9:
-            if (ch >= '0' && ch <= '9') {
-                pCrtCh++;
-            } else if (ch == 'e' || ch == 'E') {
-                pCrtCh++;
-                state = 10;
-            } else {
-                state = 13;
-            }
+        case A_PAIR:
+        case A_KTARGET:
+            printf(" %d %d", in->n[0], in->n[1]);
             break;
-        case 10:
-            if (ch == '+' || ch == '-') {
-                pCrtCh++;
-                state = 11;
-            } else if (ch >= '0' && ch <= '9') {
-                pCrtCh++;
-                state = 12;
-            } else {
-                tkerr(tk, "State 10: Expected number, + or - sign");
-            }
+        case A_FUNC:
+            printf(" %s", in->s->name);
             break;
-        case 11:
-            if (ch >= '0' && ch <= '9') {
-                pCrtCh++;
-                state = 12;
-            } else {
-                tkerr(tk, "State 11: Expected digit after exponent sign");
-            }
+        }
+        printf("\n");
+    }
+}
+
+// The virtual machine. The code is threaded first: the opcode of each
+// instruction is replaced by the address of its code in runCode, so each
+// instruction jumps directly to the next one (computed goto, a GCC extension
+// also supported by clang) instead of going back to a switch.
+
+#define VM_STACK (1 << 20)       // values in the stack of the operands
+#define VM_MEMORY (64 << 20)     // bytes of the stack of frames
+#define VM_CALLS (1 << 20)       // calls in progress
+
+typedef struct
+{
+    Instr *ip; // where to return
+    char *fp;  // the frame of the caller
+} Call;
+
+// Reads a line in s, without its newline, for get_s
+void readLine(char *s)
+{
+    int c;
+    while ((c = getchar()) != EOF && c != '\n')
+        *s++ = c;
+    *s = '\0';
+}
+
+Value readValue(const char *p)
+{
+    Value v;
+    memcpy(&v, p, sizeof(Value));
+    return v;
+}
+
+// GCC merges the jumps to the next instruction into a few shared ones, which
+// the processor predicts worse; these options keep a jump in each instruction
+#if defined(__GNUC__) && !defined(__clang__)
+#define THREADED __attribute__((optimize("no-gcse", "no-crossjumping")))
+#else
+#define THREADED
+#endif
+
+// Runs the code from its first instruction
+THREADED void runCode(Context *ctx)
+{
+#define OP_LABEL(name, arg, stack) &&L_##name,
+    static const void *labels[] = {OPCODES(OP_LABEL)};
+    Instr *code = ctx->code, *ip = code;
+    Value *stack = (Value *)malloc(VM_STACK * sizeof(Value)), *sp = stack;
+    Value *stackEnd = stack + VM_STACK - 1; // the last value, as sp points to the top one
+    char *memory = (char *)malloc(VM_MEMORY), *fp = memory, *msp = memory;
+    Call *calls = (Call *)malloc(VM_CALLS * sizeof(Call)), *call = calls;
+    long steps = 0;
+    Value value;
+    int k;
+    if (stack == NULL || memory == NULL || calls == NULL)
+        err("not enough memory for the virtual machine");
+    for (k = 0; k < ctx->nCode; k++)
+        code[k].label = labels[code[k].op];
+
+// ip is the instruction running; sp the top of the stack, and stack[0] is not used
+#define NEXT()               \
+    do                       \
+    {                        \
+        ip++;                \
+        steps++;             \
+        goto *ip->label;     \
+    } while (0)
+#define JUMP(target)             \
+    do                           \
+    {                            \
+        ip = code + (target);    \
+        steps++;                 \
+        goto *ip->label;         \
+    } while (0)
+#define BINARY_I(op) sp[-1].i = (long)((unsigned long)sp[-1].i op (unsigned long)sp->i); sp--; NEXT()
+#define BINARY_D(op) sp[-1].d = sp[-1].d op sp->d; sp--; NEXT()
+#define COMPARE(field, op) sp[-1].i = sp[-1].field op sp->field; sp--; NEXT()
+#define JUMP_IF(op) sp -= 2; if (sp[1].i op sp[2].i) JUMP(ip->i); NEXT()
+#define JUMP_IF_K(op) if ((sp--)->i op ip->n[0]) JUMP(ip->n[1]); NEXT()
+// The index of ELEM_* is in the local n[1], and the address of ELEM_A in the local n[0]
+#define ELEM_INDEX() readValue(fp + ip->n[1]).i
+#define ELEM_ARRAY() readValue(fp + ip->n[0]).p
+
+    goto *ip->label;
+L_HALT:
+    ctx->vmSteps = steps + 1;
+    fflush(stdout);
+    free(stack);
+    free(memory);
+    free(calls);
+    return;
+L_PUSH_I: (++sp)->i = ip->i; NEXT();
+L_PUSH_D: (++sp)->d = ip->d; NEXT();
+L_PUSH_A: (++sp)->p = ip->p; NEXT();
+L_ADDR_L: (++sp)->p = fp + ip->i; NEXT();
+L_DROP: sp--; NEXT();
+L_LOAD_I: memcpy(&sp->i, sp->p, sizeof(long)); NEXT();
+L_LOAD_D: memcpy(&sp->d, sp->p, sizeof(double)); NEXT();
+L_LOAD_C: sp->i = *(char *)sp->p; NEXT();
+L_STORE_I:
+L_STORE_D:
+    memcpy(sp[-1].p, sp, sizeof(Value));
+    sp[-1] = *sp;
+    sp--;
+    NEXT();
+L_STORE_C:
+    *sp[-1].p = (char)sp->i;
+    sp[-1].i = (char)sp->i;
+    sp--;
+    NEXT();
+L_COPY: memmove(sp[-1].p, sp->p, ip->i); sp--; NEXT();
+L_POP_L: memcpy(fp + ip->i, sp, sizeof(Value)); sp--; NEXT();
+L_POP_L_C: fp[ip->i] = (char)sp->i; sp--; NEXT();
+L_POP_L_S: memcpy(fp + ip->n[0], sp->p, ip->n[1]); sp--; NEXT();
+L_ADD_I: BINARY_I(+);
+L_ADD_D: BINARY_D(+);
+L_SUB_I: BINARY_I(-);
+L_SUB_D: BINARY_D(-);
+L_MUL_I: BINARY_I(*);
+L_MUL_D: BINARY_D(*);
+L_DIV_I:
+    if (sp->i == 0)
+        err("division by zero");
+    sp[-1].i = sp->i == -1 ? (long)-(unsigned long)sp[-1].i : sp[-1].i / sp->i;
+    sp--;
+    NEXT();
+L_DIV_D: BINARY_D(/);
+L_EQ_I: COMPARE(i, ==);
+L_EQ_D: COMPARE(d, ==);
+L_NE_I: COMPARE(i, !=);
+L_NE_D: COMPARE(d, !=);
+L_LT_I: COMPARE(i, <);
+L_LT_D: COMPARE(d, <);
+L_LE_I: COMPARE(i, <=);
+L_LE_D: COMPARE(d, <=);
+L_GT_I: COMPARE(i, >);
+L_GT_D: COMPARE(d, >);
+L_GE_I: COMPARE(i, >=);
+L_GE_D: COMPARE(d, >=);
+L_NEG_I: sp->i = (long)-(unsigned long)sp->i; NEXT();
+L_NEG_D: sp->d = -sp->d; NEXT();
+L_NOT_I: sp->i = !sp->i; NEXT();
+L_NOT_D: sp->i = !sp->d; NEXT();
+L_I2D: sp->d = (double)sp->i; NEXT();
+L_D2I: sp->i = (long)sp->d; NEXT();
+L_I2C: sp->i = (char)sp->i; NEXT();
+L_INDEX: sp[-1].p += sp->i * ip->i; sp--; NEXT();
+L_OFFSET: sp->p += ip->i; NEXT();
+L_JMP: JUMP(ip->i);
+L_JF_I: if (!(sp--)->i) JUMP(ip->i); NEXT();
+L_JF_D: if (!(sp--)->d) JUMP(ip->i); NEXT();
+L_JT_I: if ((sp--)->i) JUMP(ip->i); NEXT();
+L_JT_D: if ((sp--)->d) JUMP(ip->i); NEXT();
+L_CALL:
+    if (call == calls + VM_CALLS)
+        err("too many nested calls");
+    call->ip = ip + 1;
+    call->fp = fp;
+    call++;
+    JUMP(ip->i);
+L_ENTER:
+    fp = msp;
+    msp += ip->n[0];
+    if (msp > memory + VM_MEMORY || ip->n[1] > stackEnd - sp)
+        err("stack overflow");
+    NEXT();
+L_RET:
+    msp = fp;
+    call--;
+    fp = call->fp;
+    ip = call->ip;
+    steps++;
+    goto *ip->label;
+L_FALLOFF: err("the function %s ended without returning a value", ip->s->name);
+L_LOAD_L: memcpy(++sp, fp + ip->i, sizeof(Value)); NEXT();
+L_LOAD_L_C: (++sp)->i = fp[ip->i]; NEXT();
+L_SET_L:
+    value.i = ip->n[1];
+    memcpy(fp + ip->n[0], &value, sizeof(Value));
+    NEXT();
+L_ADD_I_K: sp->i = (long)((unsigned long)sp->i + (unsigned long)ip->i); NEXT();
+L_INC_L:
+    value.i = (long)((unsigned long)readValue(fp + ip->n[0]).i + (unsigned long)(long)ip->n[1]);
+    memcpy(fp + ip->n[0], &value, sizeof(Value));
+    NEXT();
+L_ADDTO_L:
+    value.i = (long)((unsigned long)readValue(fp + ip->i).i + (unsigned long)(sp--)->i);
+    memcpy(fp + ip->i, &value, sizeof(Value));
+    NEXT();
+L_ELEM_L: (++sp)->p = fp + ip->n[0] + ELEM_INDEX() * 8; NEXT();
+L_ELEM_A: (++sp)->p = ELEM_ARRAY() + ELEM_INDEX() * 8; NEXT();
+L_LOAD_ELEM_L: memcpy(++sp, fp + ip->n[0] + ELEM_INDEX() * 8, sizeof(Value)); NEXT();
+L_LOAD_ELEM_A: memcpy(++sp, ELEM_ARRAY() + ELEM_INDEX() * 8, sizeof(Value)); NEXT();
+L_STOREP: memcpy(sp[-1].p, sp, sizeof(Value)); sp -= 2; NEXT();
+L_STOREP_C: *sp[-1].p = (char)sp->i; sp -= 2; NEXT();
+L_JEQ_I: JUMP_IF(==);
+L_JNE_I: JUMP_IF(!=);
+L_JLT_I: JUMP_IF(<);
+L_JLE_I: JUMP_IF(<=);
+L_JGT_I: JUMP_IF(>);
+L_JGE_I: JUMP_IF(>=);
+L_JEQ_I_K: JUMP_IF_K(==);
+L_JNE_I_K: JUMP_IF_K(!=);
+L_JLT_I_K: JUMP_IF_K(<);
+L_JLE_I_K: JUMP_IF_K(<=);
+L_JGT_I_K: JUMP_IF_K(>);
+L_JGE_I_K: JUMP_IF_K(>=);
+L_PUT_S: fputs(sp->p, stdout); sp--; NEXT();
+L_GET_S: readLine(sp->p); sp--; NEXT();
+L_PUT_I: printf("%ld", sp->i); sp--; NEXT();
+L_GET_I:
+    if (scanf("%ld", &(++sp)->i) != 1)
+        sp->i = 0;
+    NEXT();
+L_PUT_D: printf("%g", sp->d); sp--; NEXT();
+L_GET_D:
+    if (scanf("%lf", &(++sp)->d) != 1)
+        sp->d = 0;
+    NEXT();
+L_PUT_C: putchar((char)sp->i); sp--; NEXT();
+L_GET_C: (++sp)->i = (char)getchar(); NEXT();
+L_SECONDS: (++sp)->d = seconds(); NEXT();
+#undef NEXT
+#undef JUMP
+#undef BINARY_I
+#undef BINARY_D
+#undef COMPARE
+#undef JUMP_IF
+#undef JUMP_IF_K
+#undef ELEM_INDEX
+#undef ELEM_ARRAY
+}
+
+// The register machine: the code generator for -vm reg. Each scalar local
+// and argument has a register of 8 bytes in the frame; a char is kept in it
+// as an int. The temporary values of an expression get the registers which
+// follow the locals, and are freed at the end of the statement. An
+// instruction writes its result directly in the register of its destination
+// when there is one, as for i=i+1. The arguments of a call are written at
+// the end of the frame of the caller, where the frame of the callee begins.
+
+int regEmit(Context *ctx, int op, int a, int b, int c)
+{
+    RInstr *in;
+    if (ctx->nRCode >= ctx->rcodeCapacity)
+        ctx->rcode = (RInstr *)growArray(ctx->rcode, &ctx->rcodeCapacity, 1024, sizeof(RInstr));
+    in = &ctx->rcode[ctx->nRCode];
+    memset(in, 0, sizeof(RInstr));
+    in->op = op;
+    in->a = a;
+    in->b = b;
+    in->c = c;
+    return ctx->nRCode++;
+}
+
+int regEmitI(Context *ctx, int op, int a, long i)
+{
+    int k = regEmit(ctx, op, a, 0, 0);
+    ctx->rcode[k].i = i;
+    return k;
+}
+
+int regEmitD(Context *ctx, int op, int a, double d)
+{
+    int k = regEmit(ctx, op, a, 0, 0);
+    ctx->rcode[k].d = d;
+    return k;
+}
+
+int regEmitP(Context *ctx, int op, int a, char *p)
+{
+    int k = regEmit(ctx, op, a, 0, 0);
+    ctx->rcode[k].p = p;
+    return k;
+}
+
+// The jumps not yet patched are chained by their targets, which are the
+// index of the previous jump of the chain, or -1
+int regJump(Context *ctx, int op, int b, int c)
+{
+    return regEmit(ctx, op, -1, b, c);
+}
+
+int mergeJumps(Context *ctx, int first, int second)
+{
+    int k = first;
+    if (first < 0)
+        return second;
+    while (ctx->rcode[k].a >= 0)
+        k = ctx->rcode[k].a;
+    ctx->rcode[k].a = second;
+    return first;
+}
+
+void patchJumps(Context *ctx, int k, int target)
+{
+    while (k >= 0)
+    {
+        int next = ctx->rcode[k].a;
+        ctx->rcode[k].a = target;
+        k = next;
+    }
+}
+
+// Marks with F_ASSIGN the nodes of the list which contain an assignment, and
+// returns 1 if any of them does
+int markAssigns(Context *ctx, int node)
+{
+    int any = 0;
+    for (; node; node = ctx->nodes[node].next)
+    {
+        int has = ctx->nodes[node].kind == N_ASSIGN;
+        has |= markAssigns(ctx, ctx->nodes[node].a);
+        has |= markAssigns(ctx, ctx->nodes[node].b);
+        has |= markAssigns(ctx, ctx->nodes[node].c);
+        if (has)
+            ctx->nodes[node].flags |= F_ASSIGN;
+        any |= has;
+    }
+    return any;
+}
+
+int newTemp(Context *ctx)
+{
+    return allocLocal(ctx, 8, 8);
+}
+
+// The register for a result: the destination if there is one (>= 0)
+int regTarget(Context *ctx, int dst)
+{
+    return dst >= 0 ? dst : newTemp(ctx);
+}
+
+// A register of a variable which holds an operand is copied to a temporary
+// if the operands evaluated after it may assign the variable
+int protect(Context *ctx, int r, int later)
+{
+    int t;
+    if (r >= ctx->tempStart || !(ctx->nodes[later].flags & F_ASSIGN))
+        return r;
+    t = newTemp(ctx);
+    regEmit(ctx, ROP_MOV, t, r, 0);
+    return t;
+}
+
+int isScalar(Type *t)
+{
+    return t->nElements < 0 && t->typeBase != TB_STRUCT;
+}
+
+// The size of a local or of an argument in the frame of the register machine
+int regSize(Symbol *s)
+{
+    return isScalar(s->type) || isArrayArg(s) ? 8 : (int)typeSize(s->type);
+}
+
+// Where the value of an N_ID, N_INDEX or N_MEMBER node is
+enum
+{
+    PL_REG,    // in the register base
+    PL_FRAME,  // in the frame at the offset base: a member of a local struct
+    PL_GLOBAL, // at the address p
+    PL_ELEM_L, // in the local array at the offset base, at the index in the register index
+    PL_ELEM,   // in the array at the address in the register base, at the index in index
+    PL_MEM     // at the address in the register base, plus offset
+};
+
+typedef struct
+{
+    int kind, base, index, offset;
+    char *p;
+} Place;
+
+int genReg(Context *ctx, int node, int dst);
+int genRegAs(Context *ctx, int node, Type *t, int dst);
+
+// The address of a place which holds a struct or an array
+int placeAddr(Context *ctx, Place *pl, long elemSize, int dst)
+{
+    int d, t;
+    switch (pl->kind)
+    {
+    case PL_REG: // an array argument
+        if (dst < 0)
+            return pl->base;
+        regEmit(ctx, ROP_MOV, dst, pl->base, 0);
+        return dst;
+    case PL_FRAME:
+        d = regTarget(ctx, dst);
+        regEmit(ctx, ROP_LADDR, d, pl->base, 0);
+        return d;
+    case PL_GLOBAL:
+        d = regTarget(ctx, dst);
+        regEmitP(ctx, ROP_LI_A, d, pl->p);
+        return d;
+    case PL_ELEM_L:
+    case PL_ELEM:
+        t = newTemp(ctx);
+        regEmit(ctx, ROP_MUL_IK, t, pl->index, elemSize);
+        if (pl->kind == PL_ELEM_L)
+        {
+            int base = newTemp(ctx);
+            regEmit(ctx, ROP_LADDR, base, pl->base, 0);
+            pl->base = base;
+        }
+        d = regTarget(ctx, dst);
+        regEmit(ctx, ROP_ADD_I, d, pl->base, t);
+        return d;
+    default:
+        if (pl->offset == 0 && dst < 0)
+            return pl->base;
+        d = regTarget(ctx, dst);
+        regEmit(ctx, ROP_ADD_IK, d, pl->base, pl->offset);
+        return d;
+    }
+}
+
+// Finds the place of an N_ID, N_INDEX or N_MEMBER node, evaluating the
+// registers it needs
+void genPlace(Context *ctx, int node, Place *pl)
+{
+    Node *n = &ctx->nodes[node];
+    Symbol *s = ctx->nodeInfo[node].symbol;
+    Type *t;
+    long size;
+    Place array;
+    pl->offset = 0;
+    switch (n->kind)
+    {
+    case N_ID:
+        if (s->mem == MEM_GLOBAL)
+        {
+            pl->kind = PL_GLOBAL;
+            pl->p = ctx->globals + s->offset;
+        }
+        else
+        {
+            pl->kind = isScalar(s->type) || isArrayArg(s) ? PL_REG : PL_FRAME;
+            pl->base = s->offset;
+        }
+        break;
+    case N_MEMBER:
+        if (isLValue(ctx, n->a))
+            genPlace(ctx, n->a, pl);
+        else
+        {
+            pl->kind = PL_MEM;
+            pl->base = genReg(ctx, n->a, -1);
+        }
+        switch (pl->kind)
+        {
+        case PL_FRAME:
+            pl->base += s->offset;
             break;
-        case 12:
-            if (ch >= '0' && ch <= '9') {
-                pCrtCh++;
-                state = 12;
-            } else {
-                state = 13;
-            }
+        case PL_GLOBAL:
+            pl->p += s->offset;
             break;
-        case 13:
-            tk = addTk(CT_REAL);
-            tk->r = strtod(pStartCh, NULL);
-            state = 0;
+        case PL_MEM:
+            pl->offset += s->offset;
             break;
-        case 14:
-            if (ch == '\\')
-            {
-                pCrtCh++;
-                state = 15;
-            }
-            else if (ch != '\\' && ch != '\'')
+        default: // an element of an array of structs
+            pl->base = placeAddr(ctx, pl, typeSize(nodeType(ctx, n->a)), -1);
+            pl->kind = PL_MEM;
+            pl->offset = s->offset;
+        }
+        break;
+    default: // N_INDEX
+        t = nodeType(ctx, node);
+        size = typeSize(t);
+        genPlace(ctx, n->a, &array);
+        if (array.kind == PL_GLOBAL || array.kind == PL_MEM)
+        {
+            array.base = placeAddr(ctx, &array, 0, -1);
+            array.kind = PL_REG;
+        }
+        if (array.kind == PL_REG)
+            array.base = protect(ctx, array.base, n->b);
+        pl->index = genRegAs(ctx, n->b, createType(ctx, TB_INT, -1), -1);
+        pl->base = array.base;
+        pl->kind = array.kind == PL_FRAME ? PL_ELEM_L : PL_ELEM;
+        if ((size != 8 && size != 1) || !isScalar(t))
+        {
+            pl->base = placeAddr(ctx, pl, size, -1);
+            pl->kind = PL_MEM;
+        }
+    }
+}
+
+// Loads the value of a place of type t: the address of a struct or array
+int loadPlace(Context *ctx, Place *pl, Type *t, int dst)
+{
+    int isChar = t->typeBase == TB_CHAR, d;
+    static const int loads[][2] = {
+        [PL_GLOBAL] = {ROP_GLD8, ROP_GLDC}, [PL_ELEM_L] = {ROP_LDXL8, ROP_LDXLC},
+        [PL_ELEM] = {ROP_LDX8, ROP_LDXC}, [PL_MEM] = {ROP_LD8, ROP_LDC}};
+    if (!isScalar(t))
+        return placeAddr(ctx, pl, 0, dst);
+    if (pl->kind == PL_REG || (pl->kind == PL_FRAME && !isChar))
+    {
+        if (dst < 0)
+            return pl->base;
+        regEmit(ctx, ROP_MOV, dst, pl->base, 0);
+        return dst;
+    }
+    d = regTarget(ctx, dst);
+    if (pl->kind == PL_FRAME)
+        regEmit(ctx, ROP_LDLC, d, pl->base, 0);
+    else if (pl->kind == PL_GLOBAL)
+        regEmitP(ctx, loads[PL_GLOBAL][isChar], d, pl->p);
+    else if (pl->kind == PL_MEM)
+        regEmit(ctx, loads[PL_MEM][isChar], d, pl->base, pl->offset);
+    else
+        regEmit(ctx, loads[pl->kind][isChar], d, pl->base, pl->index);
+    return d;
+}
+
+// Stores the value in the register r in a place of type t
+void storePlace(Context *ctx, Place *pl, Type *t, int r)
+{
+    int isChar = t->typeBase == TB_CHAR;
+    if (!isScalar(t))
+        regEmit(ctx, ROP_COPY, placeAddr(ctx, pl, 0, -1), r, typeSize(t));
+    else if (pl->kind == PL_REG || (pl->kind == PL_FRAME && !isChar))
+    {
+        if (r != pl->base)
+            regEmit(ctx, ROP_MOV, pl->base, r, 0);
+    }
+    else if (pl->kind == PL_FRAME)
+        regEmit(ctx, ROP_STLC, pl->base, r, 0);
+    else if (pl->kind == PL_GLOBAL)
+        regEmitP(ctx, isChar ? ROP_GSTC : ROP_GST8, r, pl->p);
+    else if (pl->kind == PL_MEM)
+        regEmit(ctx, isChar ? ROP_STC : ROP_ST8, pl->base, r, pl->offset);
+    else if (pl->kind == PL_ELEM_L)
+        regEmit(ctx, isChar ? ROP_STXLC : ROP_STXL8, pl->base, pl->index, r);
+    else
+        regEmit(ctx, isChar ? ROP_STXC : ROP_STX8, pl->base, pl->index, r);
+}
+
+// The value of the node converted to the type t
+int genRegAs(Context *ctx, int node, Type *t, int dst)
+{
+    Type *from = nodeType(ctx, node);
+    int r, d;
+    if (from == t || !isScalar(from) || !isScalar(t) || t->typeBase == TB_VOID ||
+        (from->typeBase == TB_CHAR && t->typeBase == TB_INT))
+        return genReg(ctx, node, dst);
+    r = genReg(ctx, node, -1);
+    d = regTarget(ctx, dst);
+    if (t->typeBase == TB_DOUBLE)
+        regEmit(ctx, ROP_I2D, d, r, 0);
+    else if (from->typeBase == TB_DOUBLE)
+    {
+        regEmit(ctx, ROP_D2I, d, r, 0);
+        if (t->typeBase == TB_CHAR)
+            regEmit(ctx, ROP_I2C, d, d, 0);
+    }
+    else
+        regEmit(ctx, ROP_I2C, d, r, 0);
+    return d;
+}
+
+// The size of the args of a function in its frame
+int regArgsSize(Symbol *s)
+{
+    Symbol *last = s->args.end == s->args.begin ? NULL : s->args.end[-1];
+    return last ? (last->offset + regSize(last) + 7) & -8 : 0;
+}
+
+int genRegCall(Context *ctx, int node, int dst)
+{
+    Node *n = &ctx->nodes[node];
+    Symbol *s = ctx->nodeInfo[node].symbol, **param;
+    int arg, dest = 0, base, isStruct = s->type->typeBase == TB_STRUCT && s->type->nElements < 0;
+    if (s->cls == CLS_EXTFUNC) // the runtime functions have one argument or a result
+    {
+        int r = n->a ? genRegAs(ctx, n->a, s->args.begin[0]->type, -1) : regTarget(ctx, dst);
+        regEmit(ctx, ROP_PUT_S + s->code - OP_PUT_S, r, 0, 0);
+        return r;
+    }
+    if (isStruct)
+        dest = allocLocal(ctx, typeSize(s->type), typeAlign(s->type));
+    else if (s->type->typeBase != TB_VOID)
+        dest = regTarget(ctx, dst);
+    base = allocLocal(ctx, regArgsSize(s), 8);
+    for (arg = n->a, param = s->args.begin; arg; arg = ctx->nodes[arg].next, param++)
+    {
+        int slot = base + (*param)->offset;
+        if (isScalar((*param)->type) || isArrayArg(*param))
+            genRegAs(ctx, arg, (*param)->type, slot);
+        else
+            regEmit(ctx, ROP_COPY_L, slot, genReg(ctx, arg, -1), typeSize((*param)->type));
+    }
+    regEmit(ctx, ROP_CALL, s->code, base, dest);
+    ctx->frameOffset = base;
+    if (!isStruct)
+        return dest;
+    base = regTarget(ctx, dst);
+    regEmit(ctx, ROP_LADDR, base, dest, 0);
+    return base;
+}
+
+int genRegCond(Context *ctx, int node, int ifTrue);
+
+// && and || give 1 or 0
+int genRegLogic(Context *ctx, int node, int dst)
+{
+    int d = regTarget(ctx, dst), ifFalse = genRegCond(ctx, node, 0), end;
+    regEmitI(ctx, ROP_LI, d, 1);
+    end = regJump(ctx, ROP_JMP, 0, 0);
+    patchJumps(ctx, ifFalse, ctx->nRCode);
+    regEmitI(ctx, ROP_LI, d, 0);
+    patchJumps(ctx, end, ctx->nRCode);
+    return d;
+}
+
+// Evaluates the node and returns the register of its value, which is dst if
+// dst >= 0. dst is written only by the last instruction, so the value may
+// use the variable of dst.
+int genReg(Context *ctx, int node, int dst)
+{
+    Node *n = &ctx->nodes[node];
+    Type *t = nodeType(ctx, node), *operands;
+    Literal *literal;
+    Place place;
+    int a, b, d;
+    switch (n->kind)
+    {
+    case N_CONST:
+        literal = &ctx->literals[ctx->tokens.aux[n->tk]];
+        d = regTarget(ctx, dst);
+        if (n->op == CT_REAL)
+            regEmitD(ctx, ROP_LI_D, d, literal->r);
+        else if (n->op == CT_STRING)
+            regEmitP(ctx, ROP_LI_A, d, (char *)tkName(ctx, n->tk));
+        else
+            regEmitI(ctx, ROP_LI, d, literal->i);
+        return d;
+    case N_ID:
+    case N_INDEX:
+    case N_MEMBER:
+        genPlace(ctx, node, &place);
+        return loadPlace(ctx, &place, t, dst);
+    case N_CALL:
+        return genRegCall(ctx, node, dst);
+    case N_CAST:
+        return genRegAs(ctx, n->b, t, dst);
+    case N_UNARY:
+        a = genReg(ctx, n->a, -1);
+        d = regTarget(ctx, dst);
+        if (n->op == NOT)
+            regEmit(ctx, nodeType(ctx, n->a)->typeBase == TB_DOUBLE ? ROP_NOT_D : ROP_NOT_I, d, a, 0);
+        else
+        {
+            regEmit(ctx, t->typeBase == TB_DOUBLE ? ROP_NEG_D : ROP_NEG_I, d, a, 0);
+            if (t->typeBase == TB_CHAR)
+                regEmit(ctx, ROP_I2C, d, d, 0);
+        }
+        return d;
+    case N_BINARY:
+        if (n->op == AND || n->op == OR)
+            return genRegLogic(ctx, node, dst);
+        operands = arithType(ctx, nodeType(ctx, n->a), nodeType(ctx, n->b));
+        a = protect(ctx, genRegAs(ctx, n->a, operands, -1), n->b);
+        if ((n->op == ADD || n->op == SUB) && operands->typeBase != TB_DOUBLE && isConstNode(ctx, n->b) &&
+            fitsInt(constValue(ctx, n->b, TB_INT).i) && constValue(ctx, n->b, TB_INT).i != INT_MIN)
+        {
+            b = (int)constValue(ctx, n->b, TB_INT).i;
+            d = regTarget(ctx, dst);
+            regEmit(ctx, ROP_ADD_IK, d, a, n->op == ADD ? b : -b);
+        }
+        else
+        {
+            b = genRegAs(ctx, n->b, operands, -1);
+            d = regTarget(ctx, dst);
+            regEmit(ctx, ROP_ADD_I + binaryOps[n->op] - OP_ADD_I + (operands->typeBase == TB_DOUBLE), d, a, b);
+        }
+        if (t->typeBase == TB_CHAR)
+            regEmit(ctx, ROP_I2C, d, d, 0);
+        return d;
+    default: // N_ASSIGN
+        genPlace(ctx, n->a, &place);
+        if (isScalar(t) && (place.kind == PL_REG || (place.kind == PL_FRAME && t->typeBase != TB_CHAR)))
+            d = genRegAs(ctx, n->b, t, place.base); // directly in the register of the variable
+        else
+        {
+            if (place.kind == PL_ELEM || place.kind == PL_MEM)
+                place.base = protect(ctx, place.base, n->b);
+            if (place.kind == PL_ELEM_L || place.kind == PL_ELEM)
+                place.index = protect(ctx, place.index, n->b);
+            d = genRegAs(ctx, n->b, t, -1);
+            storePlace(ctx, &place, t, d);
+        }
+        if (dst < 0 || dst == d)
+            return d;
+        regEmit(ctx, ROP_MOV, dst, d, 0);
+        return dst;
+    }
+}
+
+// Emits the jumps taken if the truth of the condition is ifTrue, and returns
+// their chain
+int genRegCond(Context *ctx, int node, int ifTrue)
+{
+    static const int negated[] = {1, 0, 5, 4, 3, 2}; // of EQ, NE, LT, LE, GT, GE
+    Node *n = &ctx->nodes[node];
+    Type *operands;
+    int a, b, compare, skip, jumps;
+    switch (n->kind)
+    {
+    case N_CONST:
+        return isTrue(ctx, node) == ifTrue ? regJump(ctx, ROP_JMP, 0, 0) : -1;
+    case N_UNARY:
+        if (n->op == NOT)
+            return genRegCond(ctx, n->a, !ifTrue);
+        break;
+    case N_BINARY:
+        if (n->op == AND || n->op == OR)
+        {
+            if ((n->op == AND) != ifTrue) // either operand decides
             {
-                pCrtCh++;
-                state = 16;
+                a = genRegCond(ctx, n->a, ifTrue);
+                return mergeJumps(ctx, a, genRegCond(ctx, n->b, ifTrue));
             }
+            skip = genRegCond(ctx, n->a, !ifTrue);
+            jumps = genRegCond(ctx, n->b, ifTrue);
+            patchJumps(ctx, skip, ctx->nRCode);
+            return jumps;
+        }
+        operands = arithType(ctx, nodeType(ctx, n->a), nodeType(ctx, n->b));
+        if (binaryOps[n->op] < OP_EQ_I || operands->typeBase == TB_DOUBLE)
             break;
-        case 15:
-            if (strchr("abfnrtv'?\"\\0", ch))
-            {
-                pCrtCh++;
-                state = 16;
-            }
-            else
-            {
-                tkerr(tk, "State 15: Char expected\n");
-            }
+        compare = (binaryOps[n->op] - OP_EQ_I) / 2;
+        if (!ifTrue)
+            compare = negated[compare];
+        a = protect(ctx, genRegAs(ctx, n->a, operands, -1), n->b);
+        if (isConstNode(ctx, n->b) && fitsInt(constValue(ctx, n->b, TB_INT).i))
+            return regJump(ctx, ROP_JEQ_IK + compare, a, (int)constValue(ctx, n->b, TB_INT).i);
+        b = genRegAs(ctx, n->b, operands, -1);
+        return regJump(ctx, ROP_JEQ_I + compare, a, b);
+    }
+    a = genReg(ctx, node, -1);
+    if (nodeType(ctx, node)->typeBase == TB_DOUBLE)
+        return regJump(ctx, ifTrue ? ROP_JT_D : ROP_JF_D, a, 0);
+    return regJump(ctx, ifTrue ? ROP_JT_I : ROP_JF_I, a, 0);
+}
+
+// Evaluates an expression whose temporaries are freed after it
+int genRegRoot(Context *ctx, int node, int ifTrue, int isCond)
+{
+    int offset = ctx->frameOffset, jumps = -1;
+    ctx->tempStart = offset;
+    if (isCond)
+        jumps = genRegCond(ctx, node, ifTrue);
+    else
+        genReg(ctx, node, -1);
+    ctx->frameOffset = offset;
+    return jumps;
+}
+
+void genRegStm(Context *ctx, int node);
+
+// The loops are generated with their condition after their body:
+//     JMP cond; body: ...; step; cond: jumps to body if true
+void genRegLoop(Context *ctx, int cond, int body, int step)
+{
+    int firstBreak = ctx->nBreaks, start, jump = regJump(ctx, ROP_JMP, 0, 0);
+    start = ctx->nRCode;
+    genRegStm(ctx, body);
+    if (step && ctx->nodes[step].kind != N_EMPTY)
+        genRegRoot(ctx, step, 0, 0);
+    patchJumps(ctx, jump, ctx->nRCode);
+    if (ctx->nodes[cond].kind != N_EMPTY)
+        patchJumps(ctx, genRegRoot(ctx, cond, 1, 1), start);
+    else
+        regEmit(ctx, ROP_JMP, start, 0, 0);
+    while (ctx->nBreaks > firstBreak)
+        ctx->rcode[ctx->breaks[--ctx->nBreaks]].a = ctx->nRCode;
+}
+
+void genRegStm(Context *ctx, int node)
+{
+    for (; node; node = ctx->nodes[node].next)
+    {
+        Node *n = &ctx->nodes[node];
+        Symbol *s;
+        int jump, offset, r;
+        switch (n->kind)
+        {
+        case N_BLOCK:
+            offset = ctx->frameOffset;
+            genRegStm(ctx, n->a);
+            ctx->frameOffset = offset;
             break;
-        case 16:
-            if (ch == '\'')
-            {
-                pCrtCh++;
-                state = 0;
-                tk = addTk(CT_CHAR);
-                char c[2];
-                c[0] = *(pCrtCh - 2);
-                c[1] = '\0';
-                char *p;
-                if ((p = strchr(c, '\\')) != NULL)
-                {
-                    memmove(p, p + 1, strlen(p));
-                    if ((*p != '\'') && (*p != '\?') && (*p != '\"') && (*p != '\\'))
-                        *p = escaped(*p);
-                }
-                tk->text = c;
-                char *str = createString(pStartCh + 1, pCrtCh - 1);
-            }
-            else
-                tkerr(tk, "State 16: Expected character");
+        case N_VAR:
+            s = ctx->nodeInfo[node].symbol;
+            s->offset = allocLocal(ctx, regSize(s), isScalar(s->type) ? 8 : typeAlign(s->type));
             break;
-
-        case 17:
-            if (ch == '\\')
+        case N_IF:
+            jump = genRegRoot(ctx, n->a, 0, 1);
+            genRegStm(ctx, n->b);
+            if (n->c)
             {
-                pCrtCh++;
-                state = 18;
-            }
-            else if (ch != '\\' && ch != '\'')
-            {
-                state = 19;
+                int end = regJump(ctx, ROP_JMP, 0, 0);
+                patchJumps(ctx, jump, ctx->nRCode);
+                genRegStm(ctx, n->c);
+                jump = end;
             }
+            patchJumps(ctx, jump, ctx->nRCode);
             break;
-        case 18:
-            if (strchr("abfnrtv'?\"\\0", ch))
-            {
-                pCrtCh++;
-                state = 19;
-            }
-            else
-                tkerr(tk, "Not escaped char\n");
+        case N_WHILE:
+            genRegLoop(ctx, n->a, n->b, 0);
             break;
-        case 19:
-            if (ch == '\"')
+        case N_FOR:
+            if (ctx->nodes[n->a].kind != N_EMPTY)
+                genRegRoot(ctx, n->a, 0, 0);
+            genRegLoop(ctx, ctx->nodes[n->a].next, n->b, ctx->nodes[ctx->nodes[n->a].next].next);
+            break;
+        case N_BREAK:
+            if (ctx->nBreaks >= ctx->breaksCapacity)
+                ctx->breaks = (int *)growArray(ctx->breaks, &ctx->breaksCapacity, 64, sizeof(int));
+            ctx->breaks[ctx->nBreaks++] = regJump(ctx, ROP_JMP, 0, 0);
+            break;
+        case N_RETURN:
+            if (!n->a)
             {
-                tk = addTk(CT_STRING);
-                char *str = createString(pStartCh + 1, pCrtCh);
-                char *p;
-                while ((p = strchr(str, '\\')) != NULL)
-                {
-                    memmove(p, p + 1, strlen(p));
-                    if ((*p != '\'') && (*p != '\?') && (*p != '\"') && (*p != '\\'))
-                        *p = escaped(*p);
-                }
-                pCrtCh++;
-                tk->text = str;
-                state = 0;
-
+                regEmit(ctx, ROP_RET_V, 0, 0, 0);
+                break;
             }
+            offset = ctx->frameOffset;
+            ctx->tempStart = offset;
+            if (isScalar(ctx->crtFunc->type))
+                regEmit(ctx, ROP_RET, genRegAs(ctx, n->a, ctx->crtFunc->type, -1), 0, 0);
             else
             {
-                state = 17;
-                pCrtCh++;
+                r = genReg(ctx, n->a, -1);
+                regEmit(ctx, ROP_RET_S, r, typeSize(ctx->crtFunc->type), 0);
             }
+            ctx->frameOffset = offset;
+            break;
+        case N_EMPTY:
             break;
-        
-        case 20:
-				if(ch == '*') {
-					pCrtCh++;
-					state = 21; 
-				}
-				else if(ch == '/'){
-					pCrtCh++;
-					state = 23; 
-				}
-				else {
-					addTk(DIV);
-					state = 0;
-				}
-				break;
-			case 21:
-				if(ch == '*'){
-					pCrtCh++;
-					state = 22;
-				}
-				else if (ch == '\n'){
-					pCrtCh++;
-					line++;
-				}
-				else{
-					pCrtCh++;
-                    state = 21;
-                }
-				break;
-			case 22:
-				if(ch == '/') {
-					pCrtCh++;
-					state = 0; 
-				}
-				else if(ch == '*') {
-					pCrtCh++;
-                    state = 22;
-				}
-				else if (ch != '*' && ch != '/'){
-					pCrtCh++;
-					state = 21;
-				}
-				else
-					tkerr(tk, "Error from state 22");
-				break;
-			case 23:
-				if(ch !='\n' && ch !='\r' && ch !='\0'){
-					pCrtCh++;
-				}
-				else if(ch=='\n') {
-					pCrtCh++;
-					state = 0;
-					line++;
-				}
-				else
-				{
-					pCrtCh++;
-					state = 0;
-				} 
-				break;
         default:
-            printf("Error state %i value %c", state, ch);
-            tkerr(tk, "Error\n");
+            genRegRoot(ctx, node, 0, 0);
         }
     }
-    return 0;
 }
 
-int open_file(char *filename)
+void genRegFunc(Context *ctx, int node)
 {
-    int file = open(filename, O_RDWR);
-    if (file == -1)
+    Node *n = &ctx->nodes[node];
+    Symbol *s = ctx->nodeInfo[node].symbol, **arg;
+    int enter, end;
+    s->code = ctx->nRCode;
+    ctx->crtFunc = s;
+    ctx->frameOffset = ctx->frameSize = 0;
+    enter = regEmit(ctx, ROP_ENTER, 0, 0, 0);
+    ctx->rcode[enter].s = s;
+    for (arg = s->args.begin; arg != s->args.end; arg++)
+        (*arg)->offset = allocLocal(ctx, regSize(*arg), isScalar((*arg)->type) || isArrayArg(*arg) ? 8 : typeAlign((*arg)->type));
+    genRegStm(ctx, n->c);
+    if (s->type->typeBase == TB_VOID)
+        regEmit(ctx, ROP_RET_V, 0, 0, 0);
+    else
     {
-        perror("Error opening file");
-        return -1;
+        end = regEmit(ctx, ROP_FALLOFF, 0, 0, 0);
+        ctx->rcode[end].s = s;
     }
-    return file;
+    ctx->rcode[enter].a = (ctx->frameSize + 7) & -8;
+    ctx->crtFunc = NULL;
 }
 
-
-int consume(int code)
+// Generates the code of the program for the register machine
+void genRegProgram(Context *ctx)
 {
-    if (crtTk->code == code)
+    Symbol *main = layoutGlobals(ctx);
+    int node, call;
+    markAssigns(ctx, ctx->root);
+    call = regEmit(ctx, ROP_CALL, 0, 0, 0);
+    regEmit(ctx, ROP_HALT, 0, 0, 0);
+    for (node = ctx->nodes[ctx->root].a; node; node = ctx->nodes[node].next)
     {
-        consumedTk = crtTk;
-        crtTk = crtTk->next;
-        return 1;
+        if (ctx->nodes[node].kind == N_FUNC)
+            genRegFunc(ctx, node);
     }
-    return 0;
+    ctx->rcode[call].a = main->code;
 }
 
-// unit: ( declStruct | declFunc | declVar )* END
-int unit()
+#define ROP_NAME(name, format) #name,
+const char *ropNames[] = {ROPCODES(ROP_NAME)};
+#define ROP_FORMAT(name, format) format,
+const char *ropFormats[] = {ROPCODES(ROP_FORMAT)};
+
+// Prints the code of the register machine; a register is printed as [offset]
+void printRegCode(Context *ctx)
 {
-    crtTk = tokens;
-    while (1)
+    int k;
+    for (k = 0; k < ctx->nRCode; k++)
     {
-        if (declStruct())
+        RInstr *in = &ctx->rcode[k];
+        const char *format;
+        int operand = 0;
+        printf("%5d %-8s", k, ropNames[in->op]);
+        for (format = ropFormats[in->op]; *format; format++)
         {
+            int value = operand == 0 ? in->a : operand == 1 ? in->b : in->c;
+            switch (*format)
+            {
+            case 'r':
+                printf(" [%d]", value);
+                break;
+            case 'k':
+            case 't':
+                printf(" %d", value);
+                break;
+            case 'i':
+                printf(" %ld", in->i);
+                break;
+            case 'd':
+                printf(" %g", in->d);
+                break;
+            case 'p':
+                if (in->p >= ctx->globals && in->p < ctx->globals + ctx->globalsSize)
+                    printf(" globals+%ld", (long)(in->p - ctx->globals));
+                else
+                    printf(" \"%s\"", in->p);
+                break;
+            case 's':
+                printf(" %s", in->s->name);
+                break;
+            }
+            operand++;
         }
-        else if (declFunc())
+        printf("\n");
+    }
+}
+
+// A template JIT for the register machine, for Linux on x86-64. When a
+// function has been called JIT_THRESHOLD times, its instructions are
+// translated one by one, by copying the machine code of the template of each
+// opcode and patching in its frame offsets, constants and jump targets. There
+// is no register allocation: as in the interpreter, each register of the
+// machine is a slot of the frame, at [rbx+offset]. The functions it calls are
+// translated first, so the native code only calls native code. If anything
+// cannot be translated, the function is left to the interpreter.
+//
+// The native code keeps the frame pointer in rbx and the JitState in r12,
+// which the C functions it calls preserve. A call passes the frame of the
+// callee in rbx, and the callee returns with rbx unchanged and its result in
+// rax: a scalar, or the address of a struct, which the caller copies.
+
+#define JIT_THRESHOLD 100    // calls of a function before it is translated
+#define JIT_BUFFER (16 << 20) // bytes of machine code
+#define JIT_STACK_MARGIN (256 << 10) // bytes of the machine stack left for the C functions
+// The native code runs on its own stack, with room for as many nested calls
+// as the interpreter, as a call takes 16 bytes of it
+#define JIT_STACK (VM_CALLS * 16L + JIT_STACK_MARGIN)
+
+// What the native code finds at r12; the templates call the functions at
+// their offsets, as call [r12+0x10] for memmove
+typedef struct
+{
+    char *memoryEnd;  // 0x00: the end of the stack of frames
+    char *stackLimit; // 0x08: the lowest rsp allowed, which limits the nested calls
+    void *helpers[14]; // 0x10: memmove, 0x18: division by zero, 0x20: too many calls,
+                       // 0x28: stack overflow, 0x30: falloff, 0x38..0x78: the runtime from PUT_S to SECONDS
+} JitState;
+
+typedef struct
+{
+    Symbol *s;
+    int start, end;        // its instructions
+    int calls;
+    int failed;            // it cannot be translated, or is being translated
+    unsigned char *native; // its machine code, or NULL
+} JitFunc;
+
+typedef struct
+{
+    unsigned char *buffer;
+    long used;
+    JitFunc *funcs;
+    int nFuncs;
+    int *ops;                // the opcodes, as the interpreter replaces them by labels
+    JitFunc **funcAt;        // the function which starts at each instruction
+    unsigned char **nativeAt; // the machine code of each instruction translated
+    int *fixups;             // where to patch the jumps of the function being translated
+    int nFixups, fixupsCapacity;
+    unsigned char *stack;
+    long (*run)(unsigned char *native, char *fp, JitState *state, unsigned char *stackTop);
+    JitState state;
+    FILE *perfMap;
+} Jit;
+
+// A template is written as the hex bytes of its machine code. a, b and c
+// stand for the 32 bits of the operand, x for the 32 bits of an extra
+// value, i for the 64 bits of the constant, and t for the 32-bit offset to
+// the target in a.
+#define J_LOAD_B "48 8B 83 b "      // mov rax, [rbx+b]
+#define J_STORE_A "48 89 83 a "     // mov [rbx+a], rax
+#define J_LOADD_B "F2 0F 10 83 b "  // movsd xmm0, [rbx+b]
+#define J_STORED_A "F2 0F 11 83 a " // movsd [rbx+a], xmm0
+#define J_CALL(offset) "41 FF 54 24 " offset " " // call [r12+offset]
+#define J_SETCC_I(cc) J_LOAD_B "48 3B 83 c 0F " cc " C0 0F B6 C0 " J_STORE_A
+#define J_SETCC_D(first, second, cc) "F2 0F 10 83 " first " 66 0F 2E 83 " second " 0F " cc " C0 0F B6 C0 " J_STORE_A
+#define J_JCC(cc) J_LOAD_B "48 3B 83 c 0F " cc " t"
+#define J_JCC_K(cc) J_LOAD_B "48 3D c 0F " cc " t"
+#define J_RUNTIME(op, offset) [ROP_##op] = "48 8B BB a " J_CALL(offset)
+
+// The variants of CALL for the functions which return nothing or a struct
+enum { JIT_CALL_V = N_ROPCODES, JIT_CALL_S, N_JIT_TEMPLATES };
+
+const char *jitTemplates[N_JIT_TEMPLATES] = {
+    [ROP_MOV] = J_LOAD_B J_STORE_A,
+    [ROP_LI] = "48 B8 i " J_STORE_A,
+    [ROP_LI_D] = "48 B8 i " J_STORE_A,
+    [ROP_LI_A] = "48 B8 i " J_STORE_A,
+    [ROP_LADDR] = "48 8D 83 b " J_STORE_A,
+    [ROP_GLD8] = "48 B8 i 48 8B 00 " J_STORE_A,
+    [ROP_GLDC] = "48 B8 i 48 0F BE 00 " J_STORE_A,
+    [ROP_GST8] = "48 B8 i 48 8B 8B a 48 89 08",
+    [ROP_GSTC] = "48 B8 i 48 8B 8B a 88 08",
+    [ROP_LD8] = J_LOAD_B "48 8B 80 c " J_STORE_A,
+    [ROP_LDC] = J_LOAD_B "48 0F BE 80 c " J_STORE_A,
+    [ROP_ST8] = "48 8B 83 a 48 8B 8B b 48 89 88 c",
+    [ROP_STC] = "48 8B 83 a 48 8B 8B b 88 88 c",
+    [ROP_LDLC] = "48 0F BE 83 b " J_STORE_A,
+    [ROP_STLC] = J_LOAD_B "88 83 a",
+    [ROP_LDX8] = J_LOAD_B "48 8B 8B c 48 8B 04 C8 " J_STORE_A,
+    [ROP_LDXC] = J_LOAD_B "48 8B 8B c 48 0F BE 04 08 " J_STORE_A,
+    [ROP_STX8] = "48 8B 83 a 48 8B 8B b 48 8B 93 c 48 89 14 C8",
+    [ROP_STXC] = "48 8B 83 a 48 8B 8B b 48 8B 93 c 88 14 08",
+    [ROP_LDXL8] = "48 8B 8B c 48 8B 84 CB b " J_STORE_A,
+    [ROP_LDXLC] = "48 8B 8B c 48 0F BE 84 0B b " J_STORE_A,
+    [ROP_STXL8] = "48 8B 8B b 48 8B 83 c 48 89 84 CB a",
+    [ROP_STXLC] = "48 8B 8B b 48 8B 83 c 88 84 0B a",
+    [ROP_COPY] = "48 8B BB a 48 8B B3 b BA c " J_CALL("10"),
+    [ROP_COPY_L] = "48 8D BB a 48 8B B3 b BA c " J_CALL("10"),
+    [ROP_ADD_I] = J_LOAD_B "48 03 83 c " J_STORE_A,
+    [ROP_ADD_D] = J_LOADD_B "F2 0F 58 83 c " J_STORED_A,
+    [ROP_SUB_I] = J_LOAD_B "48 2B 83 c " J_STORE_A,
+    [ROP_SUB_D] = J_LOADD_B "F2 0F 5C 83 c " J_STORED_A,
+    [ROP_MUL_I] = J_LOAD_B "48 0F AF 83 c " J_STORE_A,
+    [ROP_MUL_D] = J_LOADD_B "F2 0F 59 83 c " J_STORED_A,
+    // rcx==0: error; rcx==-1: neg rax, as idiv traps on LONG_MIN/-1
+    [ROP_DIV_I] = "48 8B 8B c " J_LOAD_B "48 85 C9 75 05 " J_CALL("18")
+                  "48 83 F9 FF 75 05 48 F7 D8 EB 05 48 99 48 F7 F9 " J_STORE_A,
+    [ROP_DIV_D] = J_LOADD_B "F2 0F 5E 83 c " J_STORED_A,
+    [ROP_EQ_I] = J_SETCC_I("94"),
+    [ROP_NE_I] = J_SETCC_I("95"),
+    [ROP_LT_I] = J_SETCC_I("9C"),
+    [ROP_LE_I] = J_SETCC_I("9E"),
+    [ROP_GT_I] = J_SETCC_I("9F"),
+    [ROP_GE_I] = J_SETCC_I("9D"),
+    // ucomisd sets ZF, PF and CF for NaN, so EQ also needs setnp and NE setp
+    [ROP_EQ_D] = J_LOADD_B "66 0F 2E 83 c 0F 94 C0 0F 9B C1 20 C8 0F B6 C0 " J_STORE_A,
+    [ROP_NE_D] = J_LOADD_B "66 0F 2E 83 c 0F 95 C0 0F 9A C1 08 C8 0F B6 C0 " J_STORE_A,
+    [ROP_LT_D] = J_SETCC_D("c", "b", "97"),
+    [ROP_LE_D] = J_SETCC_D("c", "b", "93"),
+    [ROP_GT_D] = J_SETCC_D("b", "c", "97"),
+    [ROP_GE_D] = J_SETCC_D("b", "c", "93"),
+    [ROP_ADD_IK] = J_LOAD_B "48 05 c " J_STORE_A,
+    [ROP_MUL_IK] = J_LOAD_B "48 69 C0 c " J_STORE_A,
+    [ROP_NEG_I] = J_LOAD_B "48 F7 D8 " J_STORE_A,
+    [ROP_NEG_D] = J_LOAD_B "48 0F BA F8 3F " J_STORE_A,
+    [ROP_NOT_I] = J_LOAD_B "48 85 C0 0F 94 C0 0F B6 C0 " J_STORE_A,
+    [ROP_NOT_D] = J_LOADD_B "66 0F 57 C9 66 0F 2E C1 0F 94 C0 0F 9B C1 20 C8 0F B6 C0 " J_STORE_A,
+    [ROP_I2D] = "F2 48 0F 2A 83 b " J_STORED_A,
+    [ROP_D2I] = "F2 48 0F 2C 83 b " J_STORE_A,
+    [ROP_I2C] = "48 0F BE 83 b " J_STORE_A,
+    [ROP_JMP] = "E9 t",
+    [ROP_JT_I] = J_LOAD_B "48 85 C0 0F 85 t",
+    [ROP_JF_I] = J_LOAD_B "48 85 C0 0F 84 t",
+    [ROP_JT_D] = J_LOADD_B "66 0F 57 C9 66 0F 2E C1 0F 85 t 0F 8A t",
+    [ROP_JF_D] = J_LOADD_B "66 0F 57 C9 66 0F 2E C1 7A 06 0F 84 t",
+    [ROP_JEQ_I] = J_JCC("84"),
+    [ROP_JNE_I] = J_JCC("85"),
+    [ROP_JLT_I] = J_JCC("8C"),
+    [ROP_JLE_I] = J_JCC("8E"),
+    [ROP_JGT_I] = J_JCC("8F"),
+    [ROP_JGE_I] = J_JCC("8D"),
+    [ROP_JEQ_IK] = J_JCC_K("84"),
+    [ROP_JNE_IK] = J_JCC_K("85"),
+    [ROP_JLT_IK] = J_JCC_K("8C"),
+    [ROP_JLE_IK] = J_JCC_K("8E"),
+    [ROP_JGT_IK] = J_JCC_K("8F"),
+    [ROP_JGE_IK] = J_JCC_K("8D"),
+    [ROP_CALL] = "48 8D 9B b E8 t 48 81 EB b 48 89 83 c",
+    [JIT_CALL_V] = "48 8D 9B b E8 t 48 81 EB b",
+    [JIT_CALL_S] = "48 8D 9B b E8 t 48 81 EB b 48 8D BB c 48 89 C6 BA x " J_CALL("10"),
+    // keeps rsp aligned to 16 for the calls; checks the machine stack and the frame
+    [ROP_ENTER] = "48 83 EC 08 49 3B 64 24 08 73 05 " J_CALL("20")
+                  "48 8D 83 a 49 3B 04 24 76 05 " J_CALL("28"),
+    [ROP_RET] = "48 8B 83 a 48 83 C4 08 C3",
+    [ROP_RET_S] = "48 8B 83 a 48 83 C4 08 C3",
+    [ROP_RET_V] = "48 83 C4 08 C3",
+    [ROP_FALLOFF] = "48 BF i " J_CALL("30"),
+    J_RUNTIME(PUT_S, "38"),
+    J_RUNTIME(GET_S, "40"),
+    J_RUNTIME(PUT_I, "48"),
+    [ROP_GET_I] = J_CALL("50") J_STORE_A,
+    [ROP_PUT_D] = "F2 0F 10 83 a " J_CALL("58"),
+    [ROP_GET_D] = J_CALL("60") J_STORED_A,
+    J_RUNTIME(PUT_C, "68"),
+    [ROP_GET_C] = J_CALL("70") J_STORE_A,
+    [ROP_SECONDS] = J_CALL("78") J_STORED_A};
+
+// Called from C with the native code, the frame, the state and the top of
+// the stack for the native code, where rsp+8 is a multiple of 16 at the entry
+// of a function
+const char *jitTrampoline = "53 41 54 55 48 89 E5 48 89 F3 49 89 D4 48 89 CC FF D7 48 89 EC 5D 41 5C 5B C3";
+
+typedef struct
+{
+    unsigned char bytes[64];
+    int size;
+    char patchKind[8]; // a, b, c, x, i or t
+    unsigned char patchAt[8];
+    int nPatches;
+} Template;
+
+Template jitParsed[N_JIT_TEMPLATES];
+
+void parseTemplate(const char *text, Template *t)
+{
+    memset(t, 0, sizeof(*t));
+    while (text && *text)
+    {
+        if (*text == ' ')
+            text++;
+        else if (isxdigit((unsigned char)text[0]) && isxdigit((unsigned char)text[1]))
         {
+            t->bytes[t->size++] = (unsigned char)strtol((char[]){text[0], text[1], 0}, NULL, 16);
+            text += 2;
         }
-        else if (declVar())
+        else
         {
+            t->patchKind[t->nPatches] = *text;
+            t->patchAt[t->nPatches++] = t->size;
+            t->size += *text++ == 'i' ? 8 : 4;
         }
-        else
-            break;
     }
-    if (!consume(END))
-        tkerr(crtTk, "missing END token");
-    return 1;
 }
 
-// declStruct: STRUCT ID LACC declVar* RACC SEMICOLON
-int declStruct()
+void putInt32(unsigned char *p, long value)
 {
-    Token *startTk = crtTk;
-    if (!consume(STRUCT))
-        return 0;
-    if (!consume(ID))
-        tkerr(crtTk, "ID expected after struct");
-    if (!consume(LACC))
+    int32_t v = (int32_t)value;
+    memcpy(p, &v, 4);
+}
+
+void jitPutS(char *s) { fputs(s, stdout); }
+void jitGetS(char *s) { readLine(s); }
+void jitPutI(long i) { printf("%ld", i); }
+long jitGetI()
+{
+    long i;
+    return scanf("%ld", &i) == 1 ? i : 0;
+}
+void jitPutD(double d) { printf("%g", d); }
+double jitGetD()
+{
+    double d;
+    return scanf("%lf", &d) == 1 ? d : 0;
+}
+void jitPutC(long c) { putchar((char)c); }
+long jitGetC() { return (char)getchar(); }
+void jitDivisionByZero() { err("division by zero"); }
+void jitTooManyCalls() { err("too many nested calls"); }
+void jitStackOverflow() { err("stack overflow"); }
+void jitFallOff(Symbol *s) { err("the function %s ended without returning a value", s->name); }
+
+#if defined(__x86_64__) && defined(__linux__)
+
+// Prepares the JIT for the code of ctx, whose frames are in memory; returns
+// 0 if it cannot be used
+int jitStart(Context *ctx, Jit *jit, char *memory)
+{
+    void *helpers[] = {(void *)memmove, (void *)jitDivisionByZero, (void *)jitTooManyCalls,
+                       (void *)jitStackOverflow, (void *)jitFallOff, (void *)jitPutS, (void *)jitGetS,
+                       (void *)jitPutI, (void *)jitGetI, (void *)jitPutD, (void *)jitGetD,
+                       (void *)jitPutC, (void *)jitGetC, (void *)seconds};
+    char path[64];
+    Template trampoline;
+    int k;
+    memset(jit, 0, sizeof(*jit));
+    jit->buffer = (unsigned char *)mmap(NULL, JIT_BUFFER, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    jit->stack = (unsigned char *)mmap(NULL, JIT_STACK, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (jit->buffer == MAP_FAILED || jit->stack == MAP_FAILED)
     {
-        crtTk = startTk;
+        if (jit->buffer != MAP_FAILED)
+            munmap(jit->buffer, JIT_BUFFER);
+        if (jit->stack != MAP_FAILED)
+            munmap(jit->stack, JIT_STACK);
         return 0;
     }
-    while (1)
+    for (k = 0; k < N_JIT_TEMPLATES; k++)
+        parseTemplate(jitTemplates[k], &jitParsed[k]);
+    parseTemplate(jitTrampoline, &trampoline);
+    memcpy(jit->buffer, trampoline.bytes, trampoline.size);
+    jit->run = (long (*)(unsigned char *, char *, JitState *, unsigned char *))jit->buffer;
+    jit->used = (trampoline.size + 15) & -16;
+    mprotect(jit->buffer, JIT_BUFFER, PROT_READ | PROT_EXEC);
+    jit->state.memoryEnd = memory + VM_MEMORY;
+    jit->state.stackLimit = (char *)jit->stack + JIT_STACK_MARGIN;
+    memcpy(jit->state.helpers, helpers, sizeof(helpers));
+
+    jit->ops = (int *)malloc(ctx->nRCode * sizeof(int));
+    jit->funcAt = (JitFunc **)calloc(ctx->nRCode, sizeof(JitFunc *));
+    jit->nativeAt = (unsigned char **)calloc(ctx->nRCode, sizeof(unsigned char *));
+    jit->funcs = (JitFunc *)calloc(ctx->nRCode, sizeof(JitFunc));
+    if (jit->ops == NULL || jit->funcAt == NULL || jit->nativeAt == NULL || jit->funcs == NULL)
+        err("not enough memory for the JIT");
+    for (k = 0; k < ctx->nRCode; k++)
     {
-        if (declVar())
-        {
-        }
-        else
-            break;
+        jit->ops[k] = ctx->rcode[k].op;
+        if (jit->ops[k] != ROP_ENTER)
+            continue;
+        if (jit->nFuncs)
+            jit->funcs[jit->nFuncs - 1].end = k;
+        jit->funcs[jit->nFuncs].s = ctx->rcode[k].s;
+        jit->funcs[jit->nFuncs].start = k;
+        jit->funcAt[k] = &jit->funcs[jit->nFuncs++];
     }
-    if (!consume(RACC))
-        tkerr(crtTk, "Missing { in struct declaration");
-    if (!consume(SEMICOLON))
-        tkerr(crtTk, "Missing ; in struct declaration");
+    if (jit->nFuncs)
+        jit->funcs[jit->nFuncs - 1].end = ctx->nRCode;
+    snprintf(path, sizeof(path), "/tmp/perf-%d.map", (int)getpid());
+    jit->perfMap = fopen(path, "w");
     return 1;
 }
 
-// declVar:  typeBase ID arrayDecl? ( COMMA ID arrayDecl? )* SEMICOLON
-int declVar()
+// Translates the instructions of f, and before them the functions it calls
+int jitFunc(Context *ctx, Jit *jit, JitFunc *f)
 {
-    Token *startTk = crtTk;
-    if (!typeBase())
+    unsigned char *start, *p;
+    int k, n;
+    if (f->native)
+        return 1;
+    if (f->failed) // also while it is being translated, against cycles
         return 0;
-    if (!consume(ID))
-        tkerr(crtTk, "ID expected after type base");
-    if (!arrayDecl())
+    f->failed = 1;
+    for (k = f->start; k < f->end; k++)
     {
+        RInstr *in = &ctx->rcode[k];
+        if (jit->ops[k] == ROP_CALL && in->a != f->start && !jitFunc(ctx, jit, jit->funcAt[in->a]))
+            return 0;
     }
-    while (1)
+    start = p = jit->buffer + jit->used;
+    jit->nFixups = 0;
+    for (k = f->start; k < f->end; k++)
     {
-        if (!consume(COMMA))
-            break;
-        if (!consume(ID))
-            tkerr(crtTk, "ID expected");
-        if (!arrayDecl())
+        RInstr *in = &ctx->rcode[k];
+        int op = jit->ops[k];
+        long extra = 0;
+        Template *t;
+        if (op == ROP_CALL)
+        {
+            Type *result = jit->funcAt[in->a]->s->type;
+            if (result->typeBase == TB_VOID)
+                op = JIT_CALL_V;
+            else if (!isScalar(result))
+            {
+                op = JIT_CALL_S;
+                extra = typeSize(result);
+            }
+        }
+        t = &jitParsed[op];
+        if (t->size == 0 || p + t->size > jit->buffer + JIT_BUFFER)
+            return 0;
+        jit->nativeAt[k] = p;
+        memcpy(p, t->bytes, t->size);
+        for (n = 0; n < t->nPatches; n++)
         {
+            unsigned char *at = p + t->patchAt[n];
+            switch (t->patchKind[n])
+            {
+            case 'a':
+                putInt32(at, in->a);
+                break;
+            case 'b':
+                putInt32(at, in->b);
+                break;
+            case 'c':
+                putInt32(at, in->c);
+                break;
+            case 'x':
+                putInt32(at, extra);
+                break;
+            case 'i':
+                memcpy(at, &in->i, 8);
+                break;
+            default: // t
+                if (jit->nFixups >= jit->fixupsCapacity)
+                    jit->fixups = (int *)growArray(jit->fixups, &jit->fixupsCapacity, 64, 2 * sizeof(int));
+                jit->fixups[2 * jit->nFixups] = (int)(at - jit->buffer);
+                jit->fixups[2 * jit->nFixups++ + 1] = in->a;
+            }
         }
+        p += t->size;
     }
-    if (!consume(SEMICOLON))
+    // the targets are in f, or are the functions it calls
+    for (n = 0; n < jit->nFixups; n++)
     {
-        crtTk = startTk;
-        return 0;
+        unsigned char *at = jit->buffer + jit->fixups[2 * n];
+        putInt32(at, jit->nativeAt[jit->fixups[2 * n + 1]] - (at + 4));
+    }
+    f->native = start;
+    f->failed = 0;
+    jit->used = (p - jit->buffer + 15) & -16;
+    ctx->nJitted++;
+    ctx->jitBytes += p - start;
+    if (jit->perfMap)
+    {
+        fprintf(jit->perfMap, "%lx %lx %s\n", (unsigned long)start, (unsigned long)(p - start), f->s->name);
+        fflush(jit->perfMap);
     }
     return 1;
 }
 
-// typeBase: INT | DOUBLE | CHAR | STRUCT ID
-int typeBase()
+// Translates the function f; returns 0 if it is left to the interpreter
+int jitCompile(Context *ctx, Jit *jit, JitFunc *f)
 {
-    if (consume(INT))
-    {
-    }
-    else if (consume(DOUBLE))
-    {
-    }
-    else if (consume(CT_CHAR))
+    int done;
+    if (mprotect(jit->buffer, JIT_BUFFER, PROT_READ | PROT_WRITE))
+        return 0;
+    done = jitFunc(ctx, jit, f);
+    mprotect(jit->buffer, JIT_BUFFER, PROT_READ | PROT_EXEC);
+    return done;
+}
+
+void jitEnd(Jit *jit)
+{
+    munmap(jit->buffer, JIT_BUFFER);
+    munmap(jit->stack, JIT_STACK);
+    if (jit->perfMap)
+        fclose(jit->perfMap);
+    free(jit->ops);
+    free(jit->funcs);
+    free(jit->funcAt);
+    free(jit->nativeAt);
+    free(jit->fixups);
+}
+
+#else
+
+int jitStart(Context *ctx, Jit *jit, char *memory)
+{
+    (void)ctx, (void)jit, (void)memory;
+    return 0;
+}
+
+int jitCompile(Context *ctx, Jit *jit, JitFunc *f)
+{
+    (void)ctx, (void)jit, (void)f;
+    return 0;
+}
+
+void jitEnd(Jit *jit)
+{
+    (void)jit;
+}
+
+#endif
+
+typedef struct
+{
+    RInstr *ip; // where to return
+    char *fp;   // the frame of the caller
+    int dest;   // the register of the caller for the result
+} RCall;
+
+// Runs the code of the register machine from its first instruction
+THREADED void runRegCode(Context *ctx)
+{
+#define ROP_LABEL(name, format) &&R_##name,
+    static const void *labels[] = {ROPCODES(ROP_LABEL)};
+    RInstr *code = ctx->rcode, *ip = code;
+    char *memory = (char *)malloc(VM_MEMORY), *fp = memory;
+    RCall *calls = (RCall *)malloc(VM_CALLS * sizeof(RCall)), *call = calls;
+    long steps = 0;
+    Value value;
+    Jit jit;
+    JitFunc *f;
+    int k, useJit;
+    if (memory == NULL || calls == NULL)
+        err("not enough memory for the virtual machine");
+    useJit = ctx->useJit && jitStart(ctx, &jit, memory);
+    for (k = 0; k < ctx->nRCode; k++)
+        code[k].label = labels[code[k].op];
+    // with the JIT, the functions count their calls until they are translated
+    for (k = 0; k < ctx->nRCode && useJit; k++)
     {
+        if (jit.funcAt[k])
+            code[k].label = &&R_ENTER_COUNT;
     }
-    else if (consume(STRUCT))
+
+#define NEXT()               \
+    do                       \
+    {                        \
+        ip++;                \
+        steps++;             \
+        goto *ip->label;     \
+    } while (0)
+#define JUMP(target)             \
+    do                           \
+    {                            \
+        ip = code + (target);    \
+        steps++;                 \
+        goto *ip->label;         \
+    } while (0)
+#define REG(x) (*(Value *)(fp + ip->x))
+#define AT(address) (*(Value *)(address))
+#define BINARY_I(op) REG(a).i = (long)((unsigned long)REG(b).i op (unsigned long)REG(c).i); NEXT()
+#define BINARY_D(op) REG(a).d = REG(b).d op REG(c).d; NEXT()
+#define COMPARE(field, op) REG(a).i = REG(b).field op REG(c).field; NEXT()
+#define JUMP_IF(op) if (REG(b).i op REG(c).i) JUMP(ip->a); NEXT()
+#define JUMP_IF_K(op) if (REG(b).i op ip->c) JUMP(ip->a); NEXT()
+
+    goto *ip->label;
+R_HALT:
+    ctx->vmSteps = steps + 1;
+    fflush(stdout);
+    if (useJit)
+        jitEnd(&jit);
+    free(memory);
+    free(calls);
+    return;
+R_MOV: REG(a) = REG(b); NEXT();
+R_LI:
+R_LI_D:
+R_LI_A:
+    REG(a).i = ip->i;
+    NEXT();
+R_LADDR: REG(a).p = fp + ip->b; NEXT();
+R_GLD8: REG(a) = AT(ip->p); NEXT();
+R_GLDC: REG(a).i = *ip->p; NEXT();
+R_GST8: AT(ip->p) = REG(a); NEXT();
+R_GSTC: *ip->p = (char)REG(a).i; NEXT();
+R_LD8: REG(a) = AT(REG(b).p + ip->c); NEXT();
+R_LDC: REG(a).i = REG(b).p[ip->c]; NEXT();
+R_ST8: AT(REG(a).p + ip->c) = REG(b); NEXT();
+R_STC: REG(a).p[ip->c] = (char)REG(b).i; NEXT();
+R_LDLC: REG(a).i = fp[ip->b]; NEXT();
+R_STLC: fp[ip->a] = (char)REG(b).i; NEXT();
+R_LDX8: REG(a) = AT(REG(b).p + REG(c).i * 8); NEXT();
+R_LDXC: REG(a).i = REG(b).p[REG(c).i]; NEXT();
+R_STX8: AT(REG(a).p + REG(b).i * 8) = REG(c); NEXT();
+R_STXC: REG(a).p[REG(b).i] = (char)REG(c).i; NEXT();
+R_LDXL8: REG(a) = AT(fp + ip->b + REG(c).i * 8); NEXT();
+R_LDXLC: REG(a).i = fp[ip->b + REG(c).i]; NEXT();
+R_STXL8: AT(fp + ip->a + REG(b).i * 8) = REG(c); NEXT();
+R_STXLC: fp[ip->a + REG(b).i] = (char)REG(c).i; NEXT();
+R_COPY: memmove(REG(a).p, REG(b).p, ip->c); NEXT();
+R_COPY_L: memmove(fp + ip->a, REG(b).p, ip->c); NEXT();
+R_ADD_I: BINARY_I(+);
+R_ADD_D: BINARY_D(+);
+R_SUB_I: BINARY_I(-);
+R_SUB_D: BINARY_D(-);
+R_MUL_I: BINARY_I(*);
+R_MUL_D: BINARY_D(*);
+R_DIV_I:
+    if (REG(c).i == 0)
+        err("division by zero");
+    REG(a).i = REG(c).i == -1 ? (long)-(unsigned long)REG(b).i : REG(b).i / REG(c).i;
+    NEXT();
+R_DIV_D: BINARY_D(/);
+R_EQ_I: COMPARE(i, ==);
+R_EQ_D: COMPARE(d, ==);
+R_NE_I: COMPARE(i, !=);
+R_NE_D: COMPARE(d, !=);
+R_LT_I: COMPARE(i, <);
+R_LT_D: COMPARE(d, <);
+R_LE_I: COMPARE(i, <=);
+R_LE_D: COMPARE(d, <=);
+R_GT_I: COMPARE(i, >);
+R_GT_D: COMPARE(d, >);
+R_GE_I: COMPARE(i, >=);
+R_GE_D: COMPARE(d, >=);
+R_ADD_IK: REG(a).i = (long)((unsigned long)REG(b).i + (unsigned long)(long)ip->c); NEXT();
+R_MUL_IK: REG(a).i = (long)((unsigned long)REG(b).i * (unsigned long)(long)ip->c); NEXT();
+R_NEG_I: REG(a).i = (long)-(unsigned long)REG(b).i; NEXT();
+R_NEG_D: REG(a).d = -REG(b).d; NEXT();
+R_NOT_I: REG(a).i = !REG(b).i; NEXT();
+R_NOT_D: REG(a).i = !REG(b).d; NEXT();
+R_I2D: REG(a).d = (double)REG(b).i; NEXT();
+R_D2I: REG(a).i = (long)REG(b).d; NEXT();
+R_I2C: REG(a).i = (char)REG(b).i; NEXT();
+R_JMP: JUMP(ip->a);
+R_JT_I: if (REG(b).i) JUMP(ip->a); NEXT();
+R_JF_I: if (!REG(b).i) JUMP(ip->a); NEXT();
+R_JT_D: if (REG(b).d) JUMP(ip->a); NEXT();
+R_JF_D: if (!REG(b).d) JUMP(ip->a); NEXT();
+R_JEQ_I: JUMP_IF(==);
+R_JNE_I: JUMP_IF(!=);
+R_JLT_I: JUMP_IF(<);
+R_JLE_I: JUMP_IF(<=);
+R_JGT_I: JUMP_IF(>);
+R_JGE_I: JUMP_IF(>=);
+R_JEQ_IK: JUMP_IF_K(==);
+R_JNE_IK: JUMP_IF_K(!=);
+R_JLT_IK: JUMP_IF_K(<);
+R_JLE_IK: JUMP_IF_K(<=);
+R_JGT_IK: JUMP_IF_K(>);
+R_JGE_IK: JUMP_IF_K(>=);
+R_CALL:
+    if (call == calls + VM_CALLS)
+        err("too many nested calls");
+    call->ip = ip + 1;
+    call->fp = fp;
+    call->dest = ip->c;
+    call++;
+    fp += ip->b;
+    JUMP(ip->a);
+R_ENTER:
+    if (fp + ip->a > memory + VM_MEMORY)
+        err("stack overflow");
+    NEXT();
+R_ENTER_COUNT:
+    f = jit.funcAt[ip - code];
+    if (f->native || (++f->calls >= JIT_THRESHOLD && jitCompile(ctx, &jit, f)))
     {
-        if (!consume(ID))
-            tkerr(crtTk, "ID expected after struct");
+        ip->label = &&R_NATIVE;
+        goto R_NATIVE;
     }
-    else
-        return 0;
-    return 1;
+    if (f->failed)
+        ip->label = &&R_ENTER;
+    goto R_ENTER;
+R_NATIVE: // runs the whole call, and returns as RET, RET_S or RET_V
+    f = jit.funcAt[ip - code];
+    value.i = jit.run(f->native, fp, &jit.state, jit.stack + JIT_STACK);
+    call--;
+    fp = call->fp;
+    if (f->s->type->typeBase != TB_VOID && isScalar(f->s->type))
+        AT(fp + call->dest) = value;
+    else if (f->s->type->typeBase != TB_VOID)
+        memmove(fp + call->dest, value.p, typeSize(f->s->type));
+    ip = call->ip;
+    steps++;
+    goto *ip->label;
+R_RET:
+    value = REG(a);
+    call--;
+    fp = call->fp;
+    AT(fp + call->dest) = value;
+    ip = call->ip;
+    steps++;
+    goto *ip->label;
+R_RET_S:
+    memmove(call[-1].fp + call[-1].dest, REG(a).p, ip->b);
+R_RET_V:
+    call--;
+    fp = call->fp;
+    ip = call->ip;
+    steps++;
+    goto *ip->label;
+R_FALLOFF: err("the function %s ended without returning a value", ip->s->name);
+R_PUT_S: fputs(REG(a).p, stdout); NEXT();
+R_GET_S: readLine(REG(a).p); NEXT();
+R_PUT_I: printf("%ld", REG(a).i); NEXT();
+R_GET_I:
+    if (scanf("%ld", &REG(a).i) != 1)
+        REG(a).i = 0;
+    NEXT();
+R_PUT_D: printf("%g", REG(a).d); NEXT();
+R_GET_D:
+    if (scanf("%lf", &REG(a).d) != 1)
+        REG(a).d = 0;
+    NEXT();
+R_PUT_C: putchar((char)REG(a).i); NEXT();
+R_GET_C: REG(a).i = (char)getchar(); NEXT();
+R_SECONDS: REG(a).d = seconds(); NEXT();
+#undef NEXT
+#undef JUMP
+#undef REG
+#undef AT
+#undef BINARY_I
+#undef BINARY_D
+#undef COMPARE
+#undef JUMP_IF
+#undef JUMP_IF_K
 }
 
-// arrayDecl: LBRACKET expr? RBRACKET
-int arrayDecl()
+// Ahead-of-time compilation of the register machine to x86-64 assembly for
+// the GNU assembler and the System V ABI. The frames keep the layout of the
+// register machine, in a stack of frames addressed by rbx, and each
+// instruction is written from a template. A linear scan allocates the
+// machine registers to the registers of the machine which are scalar slots
+// of the frame: each gets one live interval, from its first to its last
+// mention, which covers the loops it overlaps. The intervals which contain a
+// call get the registers saved by the callee. The others stay in the frame,
+// as do the slots which are addressed, such as the arrays, the structs and
+// the args of the calls.
+
+#define AOT_STACK (VM_CALLS * 64L + JIT_STACK_MARGIN) // a call takes at most 64 bytes of it
+
+// With a register or a frame slot for @a, @b and @c when their operand is a
+// register, or a number when it is a constant; @t is the label of the target
+// in a, @i the 64-bit constant, @p the address in p, @s the message of
+// FALLOFF, @f the function called, @n the offset of its struct result and @x
+// its size. ; separates the instructions.
+#define A_SETCC_I(cc) "movq @b, %rax; cmpq @c, %rax; set" cc " %al; movzbq %al, %rax; movq %rax, @a"
+#define A_UCOMI(first, second) "movq " first ", %xmm0; movq " second ", %xmm1; ucomisd %xmm1, %xmm0; "
+#define A_SETCC_D(first, second, cc) A_UCOMI(first, second) "set" cc " %al; movzbq %al, %rax; movq %rax, @a"
+#define A_BINARY_D(op) "movq @b, %xmm0; movq @c, %xmm1; " op " %xmm1, %xmm0; movq %xmm0, @a"
+#define A_JCC(cc) "movq @b, %rax; cmpq @c, %rax; j" cc " @t"
+#define A_JCC_K(cc) "cmpq $@c, @b; j" cc " @t"
+#define A_RUNTIME(op, name) [ROP_##op] = "movq @a, %rdi; call atomc_" name
+
+enum { AOT_CALL_V = N_ROPCODES, AOT_CALL_S, N_AOT_TEMPLATES };
+
+const char *aotTemplates[N_AOT_TEMPLATES] = {
+    [ROP_MOV] = "movq @b, %rax; movq %rax, @a",
+    [ROP_LI] = "movabsq $@i, %rax; movq %rax, @a",
+    [ROP_LI_D] = "movabsq $@i, %rax; movq %rax, @a",
+    [ROP_LI_A] = "leaq @p(%rip), %rax; movq %rax, @a",
+    [ROP_LADDR] = "leaq @b(%rbx), %rax; movq %rax, @a",
+    [ROP_GLD8] = "movq @p(%rip), %rax; movq %rax, @a",
+    [ROP_GLDC] = "movsbq @p(%rip), %rax; movq %rax, @a",
+    [ROP_GST8] = "movq @a, %rax; movq %rax, @p(%rip)",
+    [ROP_GSTC] = "movq @a, %rax; movb %al, @p(%rip)",
+    [ROP_LD8] = "movq @b, %rax; movq @c(%rax), %rax; movq %rax, @a",
+    [ROP_LDC] = "movq @b, %rax; movsbq @c(%rax), %rax; movq %rax, @a",
+    [ROP_ST8] = "movq @a, %rax; movq @b, %rcx; movq %rcx, @c(%rax)",
+    [ROP_STC] = "movq @a, %rax; movq @b, %rcx; movb %cl, @c(%rax)",
+    [ROP_LDLC] = "movsbq @b(%rbx), %rax; movq %rax, @a",
+    [ROP_STLC] = "movq @b, %rax; movb %al, @a(%rbx)",
+    [ROP_LDX8] = "movq @b, %rax; movq @c, %rcx; movq (%rax,%rcx,8), %rax; movq %rax, @a",
+    [ROP_LDXC] = "movq @b, %rax; movq @c, %rcx; movsbq (%rax,%rcx), %rax; movq %rax, @a",
+    [ROP_STX8] = "movq @a, %rax; movq @b, %rcx; movq @c, %rdx; movq %rdx, (%rax,%rcx,8)",
+    [ROP_STXC] = "movq @a, %rax; movq @b, %rcx; movq @c, %rdx; movb %dl, (%rax,%rcx)",
+    [ROP_LDXL8] = "movq @c, %rcx; movq @b(%rbx,%rcx,8), %rax; movq %rax, @a",
+    [ROP_LDXLC] = "movq @c, %rcx; movsbq @b(%rbx,%rcx), %rax; movq %rax, @a",
+    [ROP_STXL8] = "movq @b, %rcx; movq @c, %rax; movq %rax, @a(%rbx,%rcx,8)",
+    [ROP_STXLC] = "movq @b, %rcx; movq @c, %rax; movb %al, @a(%rbx,%rcx)",
+    // the operands are read before rdi and rsi, which may hold one of them, are written
+    [ROP_COPY] = "movq @a, %rax; movq @b, %rsi; movq %rax, %rdi; movq $@c, %rdx; call memmove",
+    [ROP_COPY_L] = "movq @b, %rsi; leaq @a(%rbx), %rdi; movq $@c, %rdx; call memmove",
+    [ROP_ADD_I] = "movq @b, %rax; addq @c, %rax; movq %rax, @a",
+    [ROP_ADD_D] = A_BINARY_D("addsd"),
+    [ROP_SUB_I] = "movq @b, %rax; subq @c, %rax; movq %rax, @a",
+    [ROP_SUB_D] = A_BINARY_D("subsd"),
+    [ROP_MUL_I] = "movq @b, %rax; imulq @c, %rax; movq %rax, @a",
+    [ROP_MUL_D] = A_BINARY_D("mulsd"),
+    [ROP_DIV_I] = "movq @c, %rcx; movq @b, %rax; testq %rcx, %rcx; jne 1f; leaq .Ldivzero(%rip), %rdi; "
+                  "call atomc_error; 1: cmpq $-1, %rcx; jne 2f; negq %rax; jmp 3f; 2: cqto; idivq %rcx; "
+                  "3: movq %rax, @a",
+    [ROP_DIV_D] = A_BINARY_D("divsd"),
+    [ROP_EQ_I] = A_SETCC_I("e"),
+    [ROP_NE_I] = A_SETCC_I("ne"),
+    [ROP_LT_I] = A_SETCC_I("l"),
+    [ROP_LE_I] = A_SETCC_I("le"),
+    [ROP_GT_I] = A_SETCC_I("g"),
+    [ROP_GE_I] = A_SETCC_I("ge"),
+    [ROP_EQ_D] = A_UCOMI("@b", "@c") "sete %al; setnp %cl; andb %cl, %al; movzbq %al, %rax; movq %rax, @a",
+    [ROP_NE_D] = A_UCOMI("@b", "@c") "setne %al; setp %cl; orb %cl, %al; movzbq %al, %rax; movq %rax, @a",
+    [ROP_LT_D] = A_SETCC_D("@c", "@b", "a"),
+    [ROP_LE_D] = A_SETCC_D("@c", "@b", "ae"),
+    [ROP_GT_D] = A_SETCC_D("@b", "@c", "a"),
+    [ROP_GE_D] = A_SETCC_D("@b", "@c", "ae"),
+    [ROP_ADD_IK] = "movq @b, %rax; addq $@c, %rax; movq %rax, @a",
+    [ROP_MUL_IK] = "imulq $@c, @b, %rax; movq %rax, @a",
+    [ROP_NEG_I] = "movq @b, %rax; negq %rax; movq %rax, @a",
+    [ROP_NEG_D] = "movq @b, %rax; btcq $63, %rax; movq %rax, @a",
+    [ROP_NOT_I] = "cmpq $0, @b; sete %al; movzbq %al, %rax; movq %rax, @a",
+    [ROP_NOT_D] = "movq @b, %xmm0; xorpd %xmm1, %xmm1; ucomisd %xmm1, %xmm0; sete %al; setnp %cl; andb %cl, %al; "
+                  "movzbq %al, %rax; movq %rax, @a",
+    [ROP_I2D] = "cvtsi2sdq @b, %xmm0; movq %xmm0, @a",
+    [ROP_D2I] = "movq @b, %xmm0; cvttsd2siq %xmm0, %rax; movq %rax, @a",
+    [ROP_I2C] = "movq @b, %rax; movsbq %al, %rax; movq %rax, @a",
+    [ROP_JMP] = "jmp @t",
+    [ROP_JT_I] = "cmpq $0, @b; jne @t",
+    [ROP_JF_I] = "cmpq $0, @b; je @t",
+    [ROP_JT_D] = "movq @b, %xmm0; xorpd %xmm1, %xmm1; ucomisd %xmm1, %xmm0; jne @t; jp @t",
+    [ROP_JF_D] = "movq @b, %xmm0; xorpd %xmm1, %xmm1; ucomisd %xmm1, %xmm0; jp 1f; je @t; 1:",
+    [ROP_JEQ_I] = A_JCC("e"),
+    [ROP_JNE_I] = A_JCC("ne"),
+    [ROP_JLT_I] = A_JCC("l"),
+    [ROP_JLE_I] = A_JCC("le"),
+    [ROP_JGT_I] = A_JCC("g"),
+    [ROP_JGE_I] = A_JCC("ge"),
+    [ROP_JEQ_IK] = A_JCC_K("e"),
+    [ROP_JNE_IK] = A_JCC_K("ne"),
+    [ROP_JLT_IK] = A_JCC_K("l"),
+    [ROP_JLE_IK] = A_JCC_K("le"),
+    [ROP_JGT_IK] = A_JCC_K("g"),
+    [ROP_JGE_IK] = A_JCC_K("ge"),
+    [ROP_CALL] = "leaq @b(%rbx), %rbx; call @f; subq $@b, %rbx; movq %rax, @c",
+    [AOT_CALL_V] = "leaq @b(%rbx), %rbx; call @f; subq $@b, %rbx",
+    [AOT_CALL_S] = "leaq @b(%rbx), %rbx; call @f; subq $@b, %rbx; movq %rax, %rsi; leaq @n(%rbx), %rdi; "
+                   "movq $@x, %rdx; call memmove",
+    [ROP_RET] = "movq @a, %rax; jmp @r",
+    [ROP_RET_S] = "movq @a, %rax; jmp @r",
+    [ROP_RET_V] = "jmp @r",
+    [ROP_FALLOFF] = "leaq @s(%rip), %rdi; call atomc_error",
+    A_RUNTIME(PUT_S, "put_s"),
+    A_RUNTIME(GET_S, "get_s"),
+    A_RUNTIME(PUT_I, "put_i"),
+    [ROP_GET_I] = "call atomc_get_i; movq %rax, @a",
+    [ROP_PUT_D] = "movq @a, %xmm0; call atomc_put_d",
+    [ROP_GET_D] = "call atomc_get_d; movq %xmm0, @a",
+    A_RUNTIME(PUT_C, "put_c"),
+    [ROP_GET_C] = "call atomc_get_c; movq %rax, @a",
+    [ROP_SECONDS] = "call atomc_seconds; movq %xmm0, @a"};
+
+// The runtime: the functions of AtomC and the errors, on top of the C library
+const char *aotRuntime =
+    "atomc_put_s:\n\tmovq stdout(%rip), %rsi\n\tjmp fputs\n"
+    "atomc_put_c:\n\tmovsbl %dil, %edi\n\tjmp putchar\n"
+    "atomc_put_i:\n\tsubq $8, %rsp\n\tmovq %rdi, %rsi\n\tleaq .Lfmt_i(%rip), %rdi\n\txorl %eax, %eax\n"
+    "\tcall printf\n\taddq $8, %rsp\n\tret\n"
+    "atomc_put_d:\n\tsubq $8, %rsp\n\tleaq .Lfmt_d(%rip), %rdi\n\tmovl $1, %eax\n\tcall printf\n"
+    "\taddq $8, %rsp\n\tret\n"
+    "atomc_get_i:\n\tsubq $24, %rsp\n\tmovq $0, 8(%rsp)\n\tleaq 8(%rsp), %rsi\n\tleaq .Lfmt_i(%rip), %rdi\n"
+    "\txorl %eax, %eax\n\tcall scanf\n\tcmpl $1, %eax\n\tmovl $0, %eax\n\tcmove 8(%rsp), %rax\n"
+    "\taddq $24, %rsp\n\tret\n"
+    "atomc_get_d:\n\tsubq $24, %rsp\n\tmovq $0, 8(%rsp)\n\tleaq 8(%rsp), %rsi\n\tleaq .Lfmt_lf(%rip), %rdi\n"
+    "\txorl %eax, %eax\n\tcall scanf\n\tcmpl $1, %eax\n\tmovl $0, %eax\n\tcmove 8(%rsp), %rax\n"
+    "\tmovq %rax, %xmm0\n\taddq $24, %rsp\n\tret\n"
+    "atomc_get_c:\n\tsubq $8, %rsp\n\tcall getchar\n\tmovsbq %al, %rax\n\taddq $8, %rsp\n\tret\n"
+    "atomc_get_s:\n\tpushq %rbx\n\tmovq %rdi, %rbx\n"
+    "1:\n\tcall getchar\n\tcmpl $-1, %eax\n\tje 2f\n\tcmpl $10, %eax\n\tje 2f\n\tmovb %al, (%rbx)\n"
+    "\tincq %rbx\n\tjmp 1b\n2:\n\tmovb $0, (%rbx)\n\tpopq %rbx\n\tret\n"
+    "atomc_seconds:\n\tsubq $24, %rsp\n\tmovl $1, %edi\n\tmovq %rsp, %rsi\n\tcall clock_gettime\n"
+    "\tcvtsi2sdq 8(%rsp), %xmm0\n\tmulsd .Lnano(%rip), %xmm0\n\tcvtsi2sdq (%rsp), %xmm1\n"
+    "\taddsd %xmm1, %xmm0\n\taddq $24, %rsp\n\tret\n"
+    "atomc_error:\n\tsubq $8, %rsp\n\tmovq %rdi, %rdx\n\tmovq stderr(%rip), %rdi\n\tleaq .Lfmt_error(%rip), %rsi\n"
+    "\txorl %eax, %eax\n\tcall fprintf\n\tmovl $-1, %edi\n\tcall exit\n"
+    "\t.section .rodata\n"
+    "\t.p2align 3\n.Lnano:\n\t.double 1e-9\n"
+    ".Lfmt_i:\n\t.string \"%ld\"\n.Lfmt_d:\n\t.string \"%g\"\n.Lfmt_lf:\n\t.string \"%lf\"\n"
+    ".Lfmt_error:\n\t.string \"error: %s\\n\"\n"
+    ".Ldivzero:\n\t.string \"division by zero\"\n.Lcalls:\n\t.string \"too many nested calls\"\n"
+    ".Loverflow:\n\t.string \"stack overflow\"\n";
+
+// The registers for the intervals without calls, then those saved by the callee
+const char *aotRegs[] = {"%rsi", "%rdi", "%r8", "%r9", "%r10", "%r11", "%r12", "%r13", "%r14", "%r15"};
+#define AOT_CALLER_SAVED 6
+#define AOT_REGS 10
+
+typedef struct
 {
-    if (!consume(LBRACKET))
-        return 0;
-    if (expr())
-    {
-    }
-    if (!consume(RBRACKET))
-        tkerr(crtTk, "missing ] from array declaration");
-    return 1;
+    int slot;        // offset / 8
+    int start, end;  // the instructions where it is live
+    int hasCall;     // a call inside the interval, which would clobber the registers of the caller
+    int reg;         // in aotRegs, or -1 in the frame
+} Interval;
+
+typedef struct
+{
+    FILE *out;
+    Context *ctx;
+    char *addressed;     // the slots of the function which must stay in the frame
+    int *regOf;          // the register of each slot of the function, or -1
+    Interval *intervals;
+    int nIntervals;
+    int *isTarget;       // the instructions which are jumped to
+    const char **strings; // the string constants, labeled .LS<index>
+    int nStrings, stringsCapacity;
+} Aot;
+
+int isCallOp(int op)
+{
+    return op == ROP_CALL || op == ROP_COPY || op == ROP_COPY_L || (op >= ROP_PUT_S && op <= ROP_SECONDS);
 }
 
-// typeName: typeBase arrayDecl?
-int typeName()
+// The operand at position k of the format of an instruction
+int operandOf(RInstr *in, int k)
 {
-    if (!typeBase())
-        return 0;
-    if (!arrayDecl())
+    return k == 0 ? in->a : k == 1 ? in->b : in->c;
+}
+
+void markAddressed(Aot *aot, int frameSize, long offset, long size)
+{
+    long k;
+    for (k = offset / 8; k < (offset + size + 7) / 8 && k < frameSize / 8; k++)
+        aot->addressed[k] = 1;
+}
+
+// The locals which are structs or arrays are in the frame
+void markAreas(Aot *aot, int frameSize, int node)
+{
+    Context *ctx = aot->ctx;
+    for (; node; node = ctx->nodes[node].next)
     {
+        Node *n = &ctx->nodes[node];
+        Symbol *s = ctx->nodeInfo[node].symbol;
+        if (n->kind == N_VAR && s && !isScalar(s->type))
+            markAddressed(aot, frameSize, s->offset, typeSize(s->type));
+        markAreas(aot, frameSize, n->a);
+        markAreas(aot, frameSize, n->b);
+        markAreas(aot, frameSize, n->c);
     }
-    return 1;
 }
 
-// declFunc: ( typeBase MUL? | VOID ) ID
-//                         LPAR ( funcArg ( COMMA funcArg )* )? RPAR
-//                         stmCompound
-int declFunc()
+int compareIntervals(const void *a, const void *b)
 {
-    Token *startTk = crtTk;
+    return ((const Interval *)a)->start - ((const Interval *)b)->start;
+}
 
-    if (typeBase())
+// Allocates the registers for the function whose code is [start, end)
+void allocRegs(Aot *aot, Symbol *s, int body, int start, int end)
+{
+    Context *ctx = aot->ctx;
+    int frameSize = ctx->rcode[start].a, nSlots = frameSize / 8, k, n, changed;
+    int *first, *active, nActive = 0;
+    Symbol **arg;
+    aot->addressed = (char *)calloc(nSlots + 1, 1);
+    aot->regOf = (int *)malloc((nSlots + 1) * sizeof(int));
+    first = (int *)malloc((nSlots + 1) * sizeof(int));
+    aot->intervals = (Interval *)malloc((nSlots + 1) * sizeof(Interval));
+    active = (int *)malloc((nSlots + 1) * sizeof(int));
+    if (!aot->addressed || !aot->regOf || !first || !aot->intervals || !active)
+        err("not enough memory");
+    for (arg = s->args.begin; arg != s->args.end; arg++)
     {
-        if (consume(MUL))
+        if (!isScalar((*arg)->type) && !isArrayArg(*arg))
+            markAddressed(aot, frameSize, (*arg)->offset, typeSize((*arg)->type));
+    }
+    markAreas(aot, frameSize, body);
+    for (k = start; k < end; k++)
+    {
+        RInstr *in = &ctx->rcode[k];
+        if (in->op == ROP_CALL)
         {
+            Symbol *f = ctx->rcode[in->a].s;
+            markAddressed(aot, frameSize, in->b, regArgsSize(f));
+            if (f->type->typeBase == TB_STRUCT && f->type->nElements < 0)
+                markAddressed(aot, frameSize, in->c, typeSize(f->type));
         }
     }
-    else if (consume(VOID))
+
+    // the intervals, from the first to the last mention of each slot
+    for (k = 0; k < nSlots; k++)
+        first[k] = aot->regOf[k] = -1;
+    aot->nIntervals = 0;
+    for (k = start; k < end; k++)
     {
+        RInstr *in = &ctx->rcode[k];
+        const char *format = ropFormats[in->op];
+        for (n = 0; format[n] && n < 3; n++)
+        {
+            int slot = operandOf(in, n) / 8;
+            if (format[n] != 'r' || slot >= nSlots || aot->addressed[slot])
+                continue;
+            if (first[slot] < 0)
+            {
+                Interval *i = &aot->intervals[aot->nIntervals];
+                first[slot] = aot->nIntervals++;
+                i->slot = slot;
+                i->start = i->end = k;
+                // the scalar args are loaded by the prologue
+                if (operandOf(in, n) < regArgsSize(s))
+                    i->start = start;
+            }
+            aot->intervals[first[slot]].end = k;
+        }
     }
-    else
-        return 0;
-    if (!consume(ID))
+    // a value which is live in a loop is kept over all of it
+    do
     {
-        crtTk = startTk;
-        return 0;
-    }
-    if (!consume(LPAR))
+        changed = 0;
+        for (k = start; k < end; k++)
+        {
+            RInstr *in = &ctx->rcode[k];
+            if (ropFormats[in->op][0] != 't' || in->op == ROP_CALL || in->a > k)
+                continue;
+            for (n = 0; n < aot->nIntervals; n++)
+            {
+                Interval *i = &aot->intervals[n];
+                if (i->start <= k && i->end >= in->a && (i->start > in->a || i->end < k))
+                {
+                    i->start = i->start < in->a ? i->start : in->a;
+                    i->end = i->end > k ? i->end : k;
+                    changed = 1;
+                }
+            }
+        }
+    } while (changed);
+    for (n = 0; n < aot->nIntervals; n++)
     {
-        crtTk = startTk;
-        return 0;
+        Interval *i = &aot->intervals[n];
+        i->hasCall = 0;
+        i->reg = -1;
+        for (k = i->start + 1; k < i->end && !i->hasCall; k++)
+            i->hasCall = isCallOp(ctx->rcode[k].op);
     }
-    if (funcArg())
+    qsort(aot->intervals, aot->nIntervals, sizeof(Interval), compareIntervals);
+
+    // the linear scan; active is sorted by the end of the intervals
+    for (n = 0; n < aot->nIntervals; n++)
     {
-        while (1)
+        Interval *i = &aot->intervals[n];
+        int used[AOT_REGS] = {0}, r, j, spill = -1;
+        for (j = 0; j < nActive && aot->intervals[active[j]].end < i->start; j++)
+            ;
+        memmove(active, active + j, (nActive - j) * sizeof(int));
+        nActive -= j;
+        for (j = 0; j < nActive; j++)
+            used[aot->intervals[active[j]].reg] = 1;
+        for (r = i->hasCall ? AOT_CALLER_SAVED : 0; r < AOT_REGS && used[r]; r++)
+            ;
+        if (r == AOT_REGS)
         {
-            if (consume(COMMA))
+            // takes the register of the active interval which ends last, if it ends after i
+            for (j = nActive - 1; j >= 0 && spill < 0; j--)
             {
-                if (!funcArg())
-                    tkerr(crtTk, "missing func arg in stm");
+                if (aot->intervals[active[j]].end > i->end && (!i->hasCall || aot->intervals[active[j]].reg >= AOT_CALLER_SAVED))
+                    spill = j;
             }
-            else
-                break;
+            if (spill < 0)
+                continue;
+            r = aot->intervals[active[spill]].reg;
+            aot->intervals[active[spill]].reg = -1;
+            memmove(active + spill, active + spill + 1, (nActive - spill - 1) * sizeof(int));
+            nActive--;
         }
+        i->reg = r;
+        for (j = nActive; j > 0 && aot->intervals[active[j - 1]].end > i->end; j--)
+            active[j] = active[j - 1];
+        active[j] = n;
+        nActive++;
     }
-    if (!consume(RPAR))
-        tkerr(crtTk, "missing ) in func declaration");
-    if (!stmCompound())
-        tkerr(crtTk, "compound statement expected");
-
-    return 1;
+    for (n = 0; n < aot->nIntervals; n++)
+    {
+        Interval *i = &aot->intervals[n];
+        aot->regOf[i->slot] = i->reg;
+        if (i->reg >= 0)
+            ctx->nAllocated++;
+        else
+            ctx->nSpilled++;
+    }
+    free(first);
+    free(active);
 }
 
-// funcArg: typeBase ID arrayDecl?
-int funcArg()
+// Writes the operand at position k of the format of the instruction
+void aotOperand(Aot *aot, RInstr *in, int k)
 {
-    if (!typeBase())
-        return 0;
-    if (!consume(ID))
-        tkerr(crtTk, "ID missing in function declaration");
-    if (!arrayDecl())
+    int value = operandOf(in, k);
+    switch (ropFormats[in->op][k])
     {
+    case 'r':
+        if (aot->regOf[value / 8] >= 0)
+            fputs(aotRegs[aot->regOf[value / 8]], aot->out);
+        else
+            fprintf(aot->out, "%d(%%rbx)", value);
+        break;
+    case 't':
+        fprintf(aot->out, ".L%d", value);
+        break;
+    default: // k
+        fprintf(aot->out, "%d", value);
     }
-    return 1;
 }
 
-// stm: stmCompound
-//            | IF LPAR expr RPAR stm ( ELSE stm )?
-//            | WHILE LPAR expr RPAR stm
-//            | FOR LPAR expr? SEMICOLON expr? SEMICOLON expr? RPAR stm
-//            | BREAK SEMICOLON
-//            | RETURN expr? SEMICOLON
-//            | expr? SEMICOLON
-int stm()
+// The label of a string constant
+int aotString(Aot *aot, const char *s)
 {
-    if (stmCompound())
-    {
-    }
-    else if (consume(IF))
+    if (aot->nStrings >= aot->stringsCapacity)
+        aot->strings = (const char **)growArray(aot->strings, &aot->stringsCapacity, 64, sizeof(char *));
+    aot->strings[aot->nStrings] = s;
+    return aot->nStrings++;
+}
+
+void aotInstr(Aot *aot, Symbol *s, int k, int op, long extra)
+{
+    Context *ctx = aot->ctx;
+    RInstr *in = &ctx->rcode[k];
+    const char *p;
+    fputc('\t', aot->out);
+    for (p = aotTemplates[op]; *p; p++)
     {
-        if (!consume(LPAR))
-            tkerr(crtTk, "missing ( after if");
-        if (!expr())
-            tkerr(crtTk, "Expected expression after ( ");
-        if (!consume(RPAR))
-            tkerr(crtTk, "missing ) after if");
-        if (!stm())
-            tkerr(crtTk, "Expected statement after if ");
-        if (consume(ELSE))
+        if (*p == ';')
         {
-            if (!stm())
-                tkerr(crtTk, "Expected statement after else ");
+            fputs("\n\t", aot->out);
+            p++; // the space after it
+        }
+        else if (*p != '@')
+            fputc(*p, aot->out);
+        else
+        {
+            switch (*++p)
+            {
+            case 'a':
+            case 'b':
+            case 'c':
+                aotOperand(aot, in, *p - 'a');
+                break;
+            case 't':
+                fprintf(aot->out, ".L%d", in->a);
+                break;
+            case 'i':
+                fprintf(aot->out, "%ld", in->i);
+                break;
+            case 'p':
+                if (in->p >= ctx->globals && in->p <= ctx->globals + ctx->globalsSize)
+                    fprintf(aot->out, "atomc_globals+%ld", (long)(in->p - ctx->globals));
+                else
+                    fprintf(aot->out, ".LS%d", aotString(aot, in->p));
+                break;
+            case 's':
+                fprintf(aot->out, ".Lfalloff_%s", in->s->name);
+                break;
+            case 'n':
+                fprintf(aot->out, "%d", in->c);
+                break;
+            case 'f':
+                fprintf(aot->out, "atomc_f_%s", ctx->rcode[in->a].s->name);
+                break;
+            case 'x':
+                fprintf(aot->out, "%ld", extra);
+                break;
+            case 'r':
+                fprintf(aot->out, ".Lret_%s", s->name);
+                break;
+            }
         }
     }
-    else if (consume(WHILE))
-    {
-        if (!consume(LPAR))
-            tkerr(crtTk, "missing ( after while");
-        if (!expr())
-            tkerr(crtTk, "Expected expression after ( ");
-        if (!consume(RPAR))
-            tkerr(crtTk, "missing ) after while");
-        if (!stm())
-            tkerr(crtTk, "Expected statement after while ");
-    }
-    else if (consume(FOR))
+    fputc('\n', aot->out);
+}
+
+void aotFunc(Aot *aot, Symbol *s, int body, int start, int end)
+{
+    Context *ctx = aot->ctx;
+    int saved[AOT_REGS] = {0}, nSaved = 0, k, r;
+    Symbol **arg;
+    allocRegs(aot, s, body, start, end);
+    for (k = 0; k < aot->nIntervals; k++)
     {
-        if (!consume(LPAR))
-            tkerr(crtTk, "missing ( after for");
-        expr();
-        if (!consume(SEMICOLON))
-            tkerr(crtTk, "missing ; in for");
-        expr();
-        if (!consume(SEMICOLON))
-            tkerr(crtTk, "missing ; in for");
-        expr();
-        if (!consume(RPAR))
-            tkerr(crtTk, "missing ) after for");
-        if (!stm())
-            tkerr(crtTk, "Expected statement after for ");
+        r = aot->intervals[k].reg;
+        if (r >= AOT_CALLER_SAVED && !saved[r])
+            saved[r] = 1, nSaved++;
     }
-    else if (consume(BREAK))
+    fprintf(aot->out, "\n\t.p2align 4\natomc_f_%s:\n", s->name);
+    for (r = AOT_CALLER_SAVED; r < AOT_REGS; r++)
     {
-        if (!consume(SEMICOLON))
-            tkerr(crtTk, "missing ; after break");
+        if (saved[r])
+            fprintf(aot->out, "\tpushq %s\n", aotRegs[r]);
     }
-    else if (consume(RETURN))
+    if (nSaved % 2 == 0) // rsp+8 is a multiple of 16 at the entry
+        fputs("\tsubq $8, %rsp\n", aot->out);
+    fprintf(aot->out, "\tleaq atomc_stack+%d(%%rip), %%rax\n\tcmpq %%rax, %%rsp\n\tjae 1f\n"
+                      "\tleaq .Lcalls(%%rip), %%rdi\n\tcall atomc_error\n1:\n",
+            JIT_STACK_MARGIN);
+    fprintf(aot->out, "\tleaq %d(%%rbx), %%rax\n\tleaq atomc_memory+%d(%%rip), %%rcx\n\tcmpq %%rcx, %%rax\n\tjbe 1f\n"
+                      "\tleaq .Loverflow(%%rip), %%rdi\n\tcall atomc_error\n1:\n",
+            ctx->rcode[start].a, VM_MEMORY);
+    for (arg = s->args.begin; arg != s->args.end; arg++)
     {
-        expr();
-        if (!consume(SEMICOLON))
-            tkerr(crtTk, "missing ; after return");
+        r = aot->regOf[(*arg)->offset / 8];
+        if ((isScalar((*arg)->type) || isArrayArg(*arg)) && r >= 0)
+            fprintf(aot->out, "\tmovq %d(%%rbx), %s\n", (*arg)->offset, aotRegs[r]);
     }
-    else if (expr())
+    for (k = start + 1; k < end; k++)
     {
-        if (!consume(SEMICOLON))
-            tkerr(crtTk, "missing ; after expression in statement");
+        int op = ctx->rcode[k].op;
+        long extra = 0;
+        if (aot->isTarget[k])
+            fprintf(aot->out, ".L%d:\n", k);
+        if (op == ROP_CALL)
+        {
+            Type *result = ctx->rcode[ctx->rcode[k].a].s->type;
+            if (result->typeBase == TB_VOID)
+                op = AOT_CALL_V;
+            else if (!isScalar(result))
+            {
+                op = AOT_CALL_S;
+                extra = typeSize(result);
+            }
+        }
+        aotInstr(aot, s, k, op, extra);
     }
-    else if (consume(SEMICOLON))
+    fprintf(aot->out, ".Lret_%s:\n", s->name);
+    if (nSaved % 2 == 0)
+        fputs("\taddq $8, %rsp\n", aot->out);
+    for (r = AOT_REGS - 1; r >= AOT_CALLER_SAVED; r--)
     {
+        if (saved[r])
+            fprintf(aot->out, "\tpopq %s\n", aotRegs[r]);
     }
-    else
-        return 0;
-    return 1;
+    fputs("\tret\n", aot->out);
+    if (ctx->rcode[end - 1].op == ROP_FALLOFF)
+        fprintf(aot->out, "\t.section .rodata\n.Lfalloff_%s:\n\t.string \"the function %s ended without returning a value\"\n\t.text\n",
+                s->name, s->name);
+    free(aot->addressed);
+    free(aot->regOf);
+    free(aot->intervals);
 }
 
-// stmCompound: LACC ( declVar | stm )* RACC
-int stmCompound()
+// Writes the string as the operand of .string
+void aotStringText(FILE *out, const char *s)
 {
-    if (!consume(LACC))
-        return 0;
-    while (1)
+    fputc('"', out);
+    for (; *s; s++)
     {
-        if (declVar())
-        {
-        }
-        else if (stm())
-        {
-        }
+        if (*s == '"' || *s == '\\' || !isprint((unsigned char)*s))
+            fprintf(out, "\\%03o", (unsigned char)*s);
         else
-            break;
+            fputc(*s, out);
     }
-    if (!consume(RACC))
-        tkerr(crtTk, "Expected } in compound statement");
-    return 1;
-}
-
-// expr: exprAssign
-int expr()
-{
-    if (!exprAssign())
-        return 0;
-    return 1;
+    fputc('"', out);
 }
 
-// exprAssign: exprUnary ASSIGN exprAssign | exprOr
-int exprAssign()
+// Writes the assembly of the program, whose code was generated for the
+// register machine
+void genAsm(Context *ctx, const char *filename)
 {
-    Token *startTk = crtTk;
-    if (exprUnary())
+    Aot aot;
+    int node, k;
+    memset(&aot, 0, sizeof(aot));
+    aot.ctx = ctx;
+    if ((aot.out = fopen(filename, "w")) == NULL)
+        err("cannot write the file %s", filename);
+    if ((aot.isTarget = (int *)calloc(ctx->nRCode + 1, sizeof(int))) == NULL)
+        err("not enough memory");
+    for (k = 0; k < ctx->nRCode; k++)
     {
-        if (consume(ASSIGN))
-        {
-            if (!exprAssign())
-                tkerr(crtTk, "Expected assign in expression");
-            return 1;
-        }
-        crtTk = startTk;
+        if (ropFormats[ctx->rcode[k].op][0] == 't' && ctx->rcode[k].op != ROP_CALL)
+            aot.isTarget[ctx->rcode[k].a] = 1;
     }
-    if (exprOr())
+    fputs("# generated by the AtomC compiler\n\t.text\n\t.globl main\n", aot.out);
+    // main switches to the stacks of the program, and calls its main
+    fprintf(aot.out, "main:\n\tpushq %%rbx\n\tpushq %%rbp\n\tmovq %%rsp, %%rbp\n"
+                     "\tleaq atomc_stack+%ld(%%rip), %%rsp\n\tleaq atomc_memory(%%rip), %%rbx\n"
+                     "\tcall atomc_f_main\n\tmovq %%rbp, %%rsp\n\tpopq %%rbp\n\tpopq %%rbx\n\txorl %%eax, %%eax\n\tret\n",
+            AOT_STACK);
+    for (node = ctx->nodes[ctx->root].a; node; node = ctx->nodes[node].next)
     {
+        Symbol *s = ctx->nodeInfo[node].symbol;
+        if (ctx->nodes[node].kind != N_FUNC)
+            continue;
+        for (k = s->code + 1; k < ctx->nRCode && ctx->rcode[k].op != ROP_ENTER; k++)
+            ;
+        aotFunc(&aot, s, ctx->nodes[node].c, s->code, k);
     }
-    else
-        return 0;
-    return 1;
-}
-
-// exprOr: exprOr OR exprAnd | exprAnd
-// Remove left recursion:
-//     exprOr: exprAnd exprOr1
-//     exprOr1: OR exprAnd exprOr1
-int exprOr()
-{
-    if (!exprAnd())
-        return 0;
-    exprOr1();
-    return 1;
+    fputs("\n", aot.out);
+    fputs(aotRuntime, aot.out);
+    for (k = 0; k < aot.nStrings; k++)
+    {
+        fprintf(aot.out, ".LS%d:\n\t.string ", k);
+        aotStringText(aot.out, aot.strings[k]);
+        fputc('\n', aot.out);
+    }
+    fprintf(aot.out, "\t.bss\n\t.p2align 4\natomc_globals:\n\t.zero %ld\n", ctx->globalsSize + 1);
+    fprintf(aot.out, "\t.p2align 4\natomc_memory:\n\t.zero %d\n", VM_MEMORY);
+    fprintf(aot.out, "\t.p2align 4\natomc_stack:\n\t.zero %ld\n", AOT_STACK);
+    fputs("\t.section .note.GNU-stack,\"\",@progbits\n", aot.out);
+    if (fclose(aot.out))
+        err("cannot write the file %s", filename);
+    free(aot.isTarget);
+    free(aot.strings);
 }
 
-void exprOr1()
+// Assembles and links the assembly to a static executable with the C compiler
+void linkAsm(const char *asmFile, const char *exeFile)
 {
-    if (consume(OR))
+    int status;
+    pid_t pid = fork();
+    if (pid == 0)
     {
-        if (!exprAnd())
-            tkerr(crtTk, "missing expression after OR");
-        exprOr1();
+        execlp("cc", "cc", "-static", "-o", exeFile, asmFile, (char *)NULL);
+        _exit(127);
     }
+    if (pid < 0 || waitpid(pid, &status, 0) < 0 || !WIFEXITED(status) || WEXITSTATUS(status))
+        err("cannot link %s with cc -static", exeFile);
 }
 
-// exprAnd: exprAnd AND exprEq | exprEq
-// Remove left recursion:
-//     exprAnd: exprEq exprAnd1
-//     exprAnd1: AND exprEq exprAnd1
-int exprAnd()
-{
-    if (!exprEq())
-        return 0;
-    exprAnd1();
-    return 1;
-}
+const char *nodeNames[] = {
+    "none", "unit", "struct", "var", "func", "param", "type", "block", "if", "while", "for",
+    "break", "return", "empty", "assign", "binary", "unary", "cast", "index", "member", "call",
+    "id", "const"};
 
-void exprAnd1()
+// Prints the node and the nodes which follow it, with their children indented
+void printNodes(Context *ctx, int node, int depth)
 {
-    if (consume(AND))
+    for (; node; node = ctx->nodes[node].next)
     {
-        if (!exprEq())
-            tkerr(crtTk, "missing expression after AND");
-        exprAnd1();
+        Node *n = &ctx->nodes[node];
+        Literal *literal = &ctx->literals[ctx->tokens.aux[n->tk]];
+        printf("%*s%s", depth * 2, "", nodeNames[n->kind]);
+        switch (n->kind)
+        {
+        case N_STRUCT:
+        case N_VAR:
+        case N_FUNC:
+        case N_PARAM:
+        case N_MEMBER:
+        case N_CALL:
+        case N_ID:
+            printf(" %s", ctx->names[ctx->tokens.aux[n->tk]].text);
+            break;
+        case N_TYPE:
+            printf(" %s", tkTexts[n->op]);
+            if (n->op == STRUCT)
+                printf(" %s", ctx->names[ctx->tokens.aux[n->tk + 1]].text);
+            printf("%s%s", n->flags & F_POINTER ? " *" : "", n->flags & F_ARRAY ? " []" : "");
+            break;
+        case N_BINARY:
+        case N_UNARY:
+            printf(" %s", tkTexts[n->op]);
+            break;
+        case N_CONST:
+            if (n->op == CT_INT)
+                printf(" %ld", literal->i);
+            else if (n->op == CT_REAL)
+                printf(" %g", literal->r);
+            else if (n->op == CT_CHAR)
+                printf(" '%c'", (char)literal->i);
+            else
+                printf(" \"%s\"", ctx->names[ctx->tokens.aux[n->tk]].text);
+            break;
+        }
+        printf(" (line %d)\n", tkLine(ctx, n->tk));
+        printNodes(ctx, n->a, depth + 1);
+        printNodes(ctx, n->b, depth + 1);
+        printNodes(ctx, n->c, depth + 1);
     }
 }
 
-// exprEq: exprEq ( EQUAL | NOTEQ ) exprRel | exprRel
-// Remove left recursion:
-//     exprEq: exprRel exprEq1
-//     exprEq1: ( EQUAL | NOTEQ ) exprRel exprEq1
-int exprEq()
+// The binary dump of the tree has this header, followed by the arrays of the
+// tokens, lines, literals and nodes and by the names, each as its length and
+// text, so a tool can load the tree without the input. The numbers are in
+// the byte order of the machine.
+typedef struct
 {
-    if (!exprRel())
-        return 0;
-    exprEq1();
-    return 1;
-}
+    char magic[8];
+    int nTokens, nLines, nLiterals, nNames, nNodes, root;
+} AstHeader;
+
+#define AST_MAGIC "AtomCAS1"
 
-void exprEq1()
+void writeBytes(FILE *file, const void *p, size_t size)
 {
-    if (consume(EQUAL))
-    {
-    }
-    else if (consume(NOTEQ))
-    {
-    }
-    else
-        return;
-    if (!exprRel())
-        tkerr(crtTk, "missing expressiong after =");
-    exprEq1();
+    if (size && fwrite(p, 1, size, file) != size)
+        err("cannot write the tree");
 }
 
-// exprRel: exprRel ( LESS | LESSEQ | GREATER | GREATEREQ ) exprAdd | exprAdd
-// Remove left recursion:
-//     exprRel: exprAdd exprRel1
-//     exprRel1: ( LESS | LESSEQ | GREATER | GREATEREQ ) exprAdd exprRel1
-int exprRel()
+void readBytes(FILE *file, void *p, size_t size)
 {
-    if (!exprAdd())
-        return 0;
-    exprRel1();
-    return 1;
+    if (size && fread(p, 1, size, file) != size)
+        err("cannot read the tree");
 }
 
-void exprRel1()
+void dumpAst(Context *ctx, const char *filename)
 {
-    if (consume(LESS))
+    FILE *file = fopen(filename, "wb");
+    AstHeader h;
+    Literal none = {0}; // literals[0], when there are no literals
+    int i;
+    if (file == NULL)
+        err("cannot create %s", filename);
+    memcpy(h.magic, AST_MAGIC, sizeof(h.magic));
+    h.nTokens = ctx->tokens.n;
+    h.nLines = ctx->nLines;
+    h.nLiterals = ctx->nLiterals;
+    h.nNames = ctx->nNames;
+    h.nNodes = ctx->nNodes;
+    h.root = ctx->root;
+    writeBytes(file, &h, sizeof(h));
+    writeBytes(file, ctx->tokens.code, h.nTokens * sizeof(*ctx->tokens.code));
+    writeBytes(file, ctx->tokens.offset, h.nTokens * sizeof(*ctx->tokens.offset));
+    writeBytes(file, ctx->tokens.length, h.nTokens * sizeof(*ctx->tokens.length));
+    writeBytes(file, ctx->tokens.aux, h.nTokens * sizeof(*ctx->tokens.aux));
+    writeBytes(file, ctx->lines, h.nLines * sizeof(*ctx->lines));
+    writeBytes(file, ctx->literals ? ctx->literals : &none, h.nLiterals * sizeof(Literal));
+    writeBytes(file, ctx->nodes, h.nNodes * sizeof(Node));
+    for (i = 1; i < h.nNames; i++)
     {
+        writeBytes(file, &ctx->names[i].length, sizeof(ctx->names[i].length));
+        writeBytes(file, ctx->names[i].text, ctx->names[i].length);
     }
-    else if (consume(LESSEQ))
+    if (fclose(file))
+        err("cannot write the tree");
+}
+
+// Loads a tree written by dumpAst in a new context
+void loadAst(Context *ctx, const char *filename)
+{
+    FILE *file = fopen(filename, "rb");
+    AstHeader h;
+    char *text = NULL;
+    int i, textCapacity = 0;
+    if (file == NULL)
+        err("cannot open %s", filename);
+    readBytes(file, &h, sizeof(h));
+    if (memcmp(h.magic, AST_MAGIC, sizeof(h.magic)) || h.nTokens < 1 || h.nLines < 0 ||
+        h.nLiterals < 1 || h.nNames < 1 || h.nNodes < 2 || h.root < 1 || h.root >= h.nNodes)
+        err("%s is not a tree", filename);
+    reserveTokens(ctx, h.nTokens);
+    readBytes(file, ctx->tokens.code, h.nTokens * sizeof(*ctx->tokens.code));
+    readBytes(file, ctx->tokens.offset, h.nTokens * sizeof(*ctx->tokens.offset));
+    readBytes(file, ctx->tokens.length, h.nTokens * sizeof(*ctx->tokens.length));
+    readBytes(file, ctx->tokens.aux, h.nTokens * sizeof(*ctx->tokens.aux));
+    ctx->tokens.n = h.nTokens;
+    ctx->lines = (unsigned int *)malloc(h.nLines * sizeof(*ctx->lines) + 1);
+    ctx->literals = (Literal *)malloc(h.nLiterals * sizeof(Literal));
+    ctx->nodes = (Node *)malloc(h.nNodes * sizeof(Node));
+    if (ctx->lines == NULL || ctx->literals == NULL || ctx->nodes == NULL)
+        err("not enough memory");
+    readBytes(file, ctx->lines, h.nLines * sizeof(*ctx->lines));
+    readBytes(file, ctx->literals, h.nLiterals * sizeof(Literal));
+    readBytes(file, ctx->nodes, h.nNodes * sizeof(Node));
+    ctx->nLines = ctx->linesCapacity = h.nLines;
+    ctx->nLiterals = ctx->literalsCapacity = h.nLiterals;
+    ctx->nNodes = ctx->nodesCapacity = h.nNodes;
+    ctx->root = h.root;
+    for (i = 1; i < h.nNames; i++)
     {
+        unsigned int length;
+        readBytes(file, &length, sizeof(length));
+        while (length >= (unsigned int)textCapacity)
+            text = (char *)growArray(text, &textCapacity, 256, sizeof(char));
+        readBytes(file, text, length);
+        if (intern(ctx, text, length) != i)
+            err("%s is not a tree", filename);
     }
-    else if (consume(GREATER))
+    free(text);
+    fclose(file);
+    for (i = 0; i < h.nTokens; i++) // so that the printing and the later phases stay inside the arrays
     {
+        int code = ctx->tokens.code[i];
+        unsigned int aux = ctx->tokens.aux[i];
+        if (code > CHAR || ((code == ID || code == CT_STRING) ? aux >= (unsigned int)h.nNames
+                                                               : isLiteral(code) ? aux >= (unsigned int)h.nLiterals : aux != 0))
+            err("%s is not a tree", filename);
     }
-    else if (consume(GREATEREQ))
+    for (i = 1; i < h.nNodes; i++) // the children are added before their parent and the lists in order
     {
+        Node *n = &ctx->nodes[i];
+        if (n->kind > N_CONST || n->op > CHAR || n->tk >= (unsigned int)h.nTokens ||
+            (n->kind == N_TYPE && n->op == STRUCT && n->tk + 1 >= (unsigned int)h.nTokens) ||
+            n->a >= (unsigned int)i || n->b >= (unsigned int)i || n->c >= (unsigned int)i ||
+            (n->next && (n->next <= (unsigned int)i || n->next >= (unsigned int)h.nNodes)))
+            err("%s is not a tree", filename);
     }
-    else
-        return;
-    if (!exprAdd())
-        tkerr(crtTk, "missing expression after relationship");
-    exprRel1();
 }
 
-// exprAdd: exprAdd ( ADD | SUB ) exprMul | exprMul
-// Remove left recursion:
-//     exprAdd: exprMul exprAdd1
-//     exprAdd1: ( ADD | SUB ) exprMul exprAdd1
-int exprAdd()
+void printStats(Context *ctx)
 {
-    if (!exprMul())
-        return 0;
-    exprAdd1();
-    return 1;
+    printf("lexer kernels: %s\n", lexKernels);
+    printf("names: %d distinct, %ld lookups, %.1f%% hits, %ld bytes saved\n",
+           ctx->nNames - 1, ctx->internLookups,
+           ctx->internLookups ? 100.0 * ctx->internHits / ctx->internLookups : 0.0, ctx->internBytesSaved);
+    printf("parser: %ld tokens consumed again after backtracking\n", ctx->reconsumedTk);
+    if (ctx->keepNodes)
+        printf("ast: %d nodes, %zu bytes\n", ctx->nNodes - 1, ctx->nNodes * sizeof(Node));
+    if (ctx->nSymbolsAdded)
+        printf("symbols: %d added, %ld lookups, %d names indexed in %d slots, %zu bytes in the arena\n",
+               ctx->nSymbolsAdded, ctx->symbolLookups, ctx->nSymbolsHash, ctx->symbolsHashSize, ctx->arenaSize);
+    if (ctx->nTypes)
+        printf("types: %d distinct, %d constant expressions folded\n", ctx->nTypes, ctx->nFolded);
+    if (ctx->nCode || ctx->nRCode)
+        printf("vm: %d instructions, %ld run\n", ctx->nCode + ctx->nRCode, ctx->vmSteps);
+    if (ctx->nAllocated || ctx->nSpilled)
+        printf("native: %d registers allocated, %d left in the frame\n", ctx->nAllocated, ctx->nSpilled);
+    if (ctx->nJitted)
+        printf("jit: %d functions translated to %ld bytes of machine code\n", ctx->nJitted, ctx->jitBytes);
 }
 
-void exprAdd1()
+// Compiling several files: each file is compiled in its own context by one of
+// the worker threads. A worker takes the files from the front of its own queue
+// and, when that is empty, steals from the back of the queues of the others,
+// so a large file does not hold up the files queued after it. The output of
+// each file is kept and printed in the order of the files given.
+
+typedef struct
 {
-    if (consume(ADD))
-    {
-    }
-    else if (consume(SUB))
-    {
-    }
-    else
-        return;
-    if (!exprMul())
-        tkerr(crtTk, "missing expressiong after + or -");
-    exprAdd1();
-}
+    const char *filename;
+    char *output;      // what the compilation printed
+    size_t outputSize;
+    int failed;
+    int done;
+} Job;
 
-// exprMul: exprMul ( MUL | DIV ) exprCast | exprCast
-// Remove left recursion:
-//     exprMul: exprCast exprMul1
-//     exprMul1: ( MUL | DIV ) exprCast exprMul1
-int exprMul()
+typedef struct
 {
-    if (!exprCast())
-        return 0;
-    exprMul1();
-    return 1;
-}
+    pthread_mutex_t lock;
+    int *jobs;         // indexes in jobs; the queue is jobs[first..last)
+    int first, last;
+    pthread_t thread;
+} Worker;
 
-void exprMul1()
+Job *jobs;
+int nJobs;
+Worker *workers;
+int nWorkers;
+pthread_mutex_t jobsLock = PTHREAD_MUTEX_INITIALIZER;
+pthread_cond_t jobDone = PTHREAD_COND_INITIALIZER;
+
+// Reads the whole file, followed by the '\0' and the LEX_PADDING bytes of the lexer
+char *read_file(const char *filename, size_t *size)
 {
-    if (consume(MUL))
+    struct stat st;
+    char *text;
+    size_t n = 0;
+    ssize_t r = 1;
+    int fd = open(filename, O_RDONLY);
+    if (fd == -1)
+        return NULL;
+    if (fstat(fd, &st) != 0 || (text = (char *)malloc(st.st_size + 1 + LEX_PADDING)) == NULL)
     {
+        close(fd);
+        return NULL;
     }
-    else if (consume(DIV))
+    for (; n < (size_t)st.st_size && r > 0; n += r)
     {
+        if ((r = read(fd, text + n, st.st_size - n)) < 0)
+        {
+            close(fd);
+            free(text);
+            return NULL;
+        }
     }
-    else
-        return;
-    if (!exprCast())
-        tkerr(crtTk, "missing expressiong after * or /");
-    exprMul1();
+    close(fd);
+    memset(text + n, 0, 1 + LEX_PADDING);
+    *size = n;
+    return text;
 }
 
-// exprCast: LPAR typeName RPAR exprCast | exprUnary
-int exprCast()
+void compileFile(Job *job)
 {
-    Token *startTk = crtTk;
-    if (consume(LPAR))
+    Context context, *ctx = &context;
+    FILE *out = open_memstream(&job->output, &job->outputSize);
+    size_t size;
+    char *input;
+    if (out == NULL)
+        err("not enough memory");
+    if ((input = read_file(job->filename, &size)) == NULL)
+    {
+        fprintf(out, "%s: cannot read the file\n", job->filename);
+        job->failed = 1;
+    }
+    else
     {
-        if (typeName())
+        initContext(ctx, job->filename, out);
+        if (setjmp(ctx->onError) == 0)
         {
-            if (consume(RPAR))
+            ctx->pInput = input;
+            ctx->inputSize = size;
+            parallelLex(ctx, input);
+            if (unit(ctx))
             {
-                if (exprCast())
-                {
-                    return 1;
-                }
+                fprintf(out, "%s: The syntax is correct!\n", job->filename);
+                checkDomain(ctx, ctx->root);
             }
+            else
+                job->failed = 1;
         }
-        crtTk = startTk;
-    }
-    if (exprUnary())
-    {
+        else
+            job->failed = 1;
+        freeContext(ctx);
+        free(input);
     }
-    else
-        return 0;
-    return 1;
+    fclose(out);
 }
 
-// exprUnary: ( SUB | NOT ) exprUnary | exprPostfix
-int exprUnary()
+// Returns the next job for the worker, or -1 if all the jobs were taken
+int takeJob(int self)
 {
-    if (consume(SUB))
-    {
-        if (!exprUnary())
-            tkerr(crtTk, "missing unary expression after -");
-    }
-    else if (consume(NOT))
-    {
-        if (!exprUnary())
-            tkerr(crtTk, "missing unary expression after !");
-    }
-    else if (exprPostfix())
+    int k, job = -1;
+    for (k = 0; k < nWorkers && job < 0; k++)
     {
+        Worker *w = &workers[(self + k) % nWorkers];
+        pthread_mutex_lock(&w->lock);
+        if (w->first < w->last)
+            job = k == 0 ? w->jobs[w->first++] : w->jobs[--w->last];
+        pthread_mutex_unlock(&w->lock);
     }
-    else
-        return 0;
-    return 1;
-}
-
-// exprPostfix: exprPostfix LBRACKET expr RBRACKET
-//            | exprPostfix DOT ID
-//            | exprPrimary
-// Remove left recursion:
-//     exprPostfix: exprPrimary exprPostfix1
-//     exprPostfix1: ( LBRACKET expr RBRACKET | DOT ID ) exprPostfix1
-int exprPostfix()
-{
-    if (!exprPrimary())
-        return 0;
-    exprPostfix1();
-    return 1;
+    return job;
 }
 
-void exprPostfix1()
+void *runWorker(void *arg)
 {
-    if (consume(LBRACKET))
-    {
-        if (!expr())
-            tkerr(crtTk, "missing expression after (");
-        if (!consume(RBRACKET))
-            tkerr(crtTk, "missing ) after expression");
-    }
-    else if (consume(DOT))
+    int self = (Worker *)arg - workers, job;
+    while ((job = takeJob(self)) >= 0)
     {
-        if (!consume(ID))
-            tkerr(crtTk, "error consuming");
+        compileFile(&jobs[job]);
+        pthread_mutex_lock(&jobsLock);
+        jobs[job].done = 1;
+        pthread_cond_broadcast(&jobDone);
+        pthread_mutex_unlock(&jobsLock);
     }
-    else
-        return;
-    exprPostfix1();
+    return NULL;
 }
 
-// exprPrimary: ID ( LPAR ( expr ( COMMA expr )* )? RPAR )?
-//            | CT_INT
-//            | CT_REAL
-//            | CT_CHAR
-//            | CT_STRING
-//            | LPAR expr RPAR
-int exprPrimary()
+// Compiles the files with up to nThreads threads and returns the number of files which failed
+int compileFiles(char **filenames, int n, int nThreads)
 {
-    Token *startTk = crtTk;
-    if (consume(ID))
+    int i, failed = 0;
+    if ((jobs = (Job *)calloc(n, sizeof(Job))) == NULL)
+        err("not enough memory");
+    nJobs = n;
+    nWorkers = nThreads < 1 ? 1 : nThreads < n ? nThreads : n;
+    if ((workers = (Worker *)calloc(nWorkers, sizeof(Worker))) == NULL)
+        err("not enough memory");
+    if (nLexClasses == 0) // initialized before they are shared
+        initLexTable();
+    if (powersOfFive == NULL)
+        initPowersOfFive();
+    for (i = 0; i < nWorkers; i++)
     {
-        if (consume(LPAR))
-        {
-            if (expr())
-            {
-                while (1)
-                {
-                    if (!consume(COMMA))
-                        break;
-                    if (!expr())
-                        tkerr(crtTk, "missing expression after , in primary expression");
-                }
-            }
-            if (!consume(RPAR))
-                tkerr(crtTk, "missing )");
-        }
+        pthread_mutex_init(&workers[i].lock, NULL);
+        if ((workers[i].jobs = (int *)malloc(n * sizeof(int))) == NULL)
+            err("not enough memory");
     }
-    else if (consume(CT_INT))
+    for (i = 0; i < n; i++) // dealt in turn, so each worker starts with the first files
     {
+        Worker *w = &workers[i % nWorkers];
+        jobs[i].filename = filenames[i];
+        w->jobs[w->last++] = i;
     }
-    else if (consume(CT_REAL))
+    for (i = 0; i < nWorkers; i++)
     {
+        if (pthread_create(&workers[i].thread, NULL, runWorker, &workers[i]))
+            err("cannot create a thread");
     }
-    else if (consume(CT_CHAR))
+    for (i = 0; i < n; i++)
     {
+        pthread_mutex_lock(&jobsLock);
+        while (!jobs[i].done)
+            pthread_cond_wait(&jobDone, &jobsLock);
+        pthread_mutex_unlock(&jobsLock);
+        fwrite(jobs[i].output, 1, jobs[i].outputSize, stdout);
+        fflush(stdout);
+        failed += jobs[i].failed;
+        free(jobs[i].output);
     }
-    else if (consume(CT_STRING))
+    for (i = 0; i < nWorkers; i++)
     {
+        pthread_join(workers[i].thread, NULL);
+        pthread_mutex_destroy(&workers[i].lock);
+        free(workers[i].jobs);
     }
-    else if (consume(LPAR))
-    {
-        if (!expr())
-        {
-            crtTk = startTk;
-            return 0;
+    free(workers);
+    free(jobs);
+    return failed;
+}
+
+typedef struct
+{
+    int useMmap, showStats, useTable, benchLexers, scalarLexer, useStream, nJobThreads;
+    int showAst, showLayout, showCode, runProgram, fuse, regVm, useJit, loadTree;
+    char *asmFile, *exeFile, *dumpFile;
+} Options; // the command line options of main
+
+// Compiles the opened file as the options tell; the errors return to the
+// setjmp of the caller, so the state kept across it is only in *opt
+int compileInput(Context *ctx, const Options *opt, int fd, const char *filename)
+{
+    struct stat st;
+    size_t size;
+    char *myString;
+    ssize_t last;
+    int quiet, i;
+
+    if (opt->useStream) {
+        // only checks the syntax, as the tokens are not kept to be listed
+        startStream(ctx, fd, opt->useTable ? getNextTokenTable : getNextToken);
+        if (unit(ctx)) {
+            printf("The syntax is correct!\n");
         }
-        if (!consume(RPAR))
-            tkerr(crtTk, "missing ) after expression");
-    }
-    else
+        printf("Read %lld bytes from the file '%s'\n", ctx->streamRead, filename);
+        if (opt->showStats) {
+            printStats(ctx);
+            printf("stream: at most %d tokens and %zu bytes of text kept\n", ctx->streamPeakTokens, ctx->streamCapacity);
+        }
+        close(fd);
         return 0;
-    return 1;
-}
+    }
 
-typedef struct _Symbol Symbol;
 
-typedef struct{
-	Symbol **begin; 	// the beginning of the symbols, or NULL
-	Symbol **end;		// the position after the last symbol
-	Symbol **after;		// the position after the allocated space
-} Symbols;
+    if (stat(filename, &st) == 0)
+        size = st.st_size;
+    else {
+        close(fd);
+        return -1;
+    }
 
-Symbols symbols;
+    if (opt->useMmap) {
+        myString = map_file(fd, size);
+        if (myString == NULL) {
+            perror("Error mapping file");
+            close(fd);
+            return -1;
+        }
+        last = size;
+    } else {
+        myString = (char *)malloc(size + 1 + LEX_PADDING);
+        if (myString == NULL) {
+            printf("Memory allocation error\n");
+            close(fd);
+            return -1;
+        }
 
-enum { TB_INT, TB_DOUBLE, TB_CHAR, TB_STRUCT, TB_VOID };
+        last = read(fd, myString, size);
+        if (last <= 0) {
+            printf("Error reading file\n");
+            close(fd);
+            free(myString);
+            return -1;
+        }
 
-typedef struct {
-    int typeBase;   // TB_*
-    Symbol *s;      // struct definition for TB_STRUCT
-    int nElements;  // >0 array of given size, 0=array without size, <0 non array
-} Type;
+        memset(myString + last, 0, 1 + LEX_PADDING);
+    }
 
-enum { CLS_VAR, CLS_FUNC, CLS_EXTFUNC, CLS_STRUCT };
-enum { MEM_GLOBAL, MEM_ARG, MEM_LOCAL };
+    if (opt->benchLexers) {
+        lexBench(ctx, myString, last);
+        close(fd);
+        if (opt->useMmap)
+            unmap_file(myString, size);
+        else
+            free(myString);
+        return 0;
+    }
 
-typedef struct _Symbol {
-    const char *name;  // a reference to the name stored in a token
-    int cls;           // CLS_*
-    int mem;           // MEM_*
-    Type type;
-    int depth;         // 0-global, 1-in function, 2... - nested blocks in function
-    union {
-        Symbols args;    // used only for functions
-        Symbols members; // used only for structs
-    };
-} Symbol;
+    // the listing of the input and its tokens is left out when the program is run
+    quiet = opt->runProgram || opt->showCode || opt->asmFile || opt->exeFile;
+    if (!quiet)
+        puts(myString);
+    ctx->pInput = myString;
+    chunkLexer = opt->useTable ? getNextTokenTable : getNextToken;
+    ctx->inputSize = last;
+    parallelLex(ctx, myString);
+    for (i = 0; i < ctx->tokens.n && !quiet; i++) {
+        int code = ctx->tokens.code[i];
+        Literal *aux = &ctx->literals[ctx->tokens.aux[i]]; // only used for literal tokens
+        // printf("Code %d ", code);
+        if ((code == ID))
+            printf("%d Identifier %s \n", tkLine(ctx, i), ctx->names[ctx->tokens.aux[i]].text);
+        else if (code == CT_CHAR)
+            printf("%d character %c\n", tkLine(ctx, i), (char)aux->i);
+        else if (code == CT_STRING)
+            printf("%d string %s\n", tkLine(ctx, i), ctx->names[ctx->tokens.aux[i]].text);
+        else if (code == CT_INT)
+            printf("%d integer value %ld \n", tkLine(ctx, i), aux->i);
+        else if (code == CT_REAL)
+            printf("%d float value %f \n", tkLine(ctx, i), aux->r);
+    }
 
-struct _Symbol;
-typedef struct _Symbol Symbol;
+    if (!quiet)
+        printf("Read %zd bytes from the file '%s'\n", last, filename);
 
-void initSymbols(Symbols *symbols) {
-    symbols->begin = NULL;
-    symbols->end = NULL;
-    symbols->after = NULL;
-}
-Symbol *addSymbol(Symbols *symbols,const char *name,int cls) {
-	Symbol *s;
-	if(symbols->end==symbols->after){ // create more room
-		int count = symbols->after-symbols->begin;
-		int n = count*2; // double the room
-		if(n==0)
-			n=1; // needed for the initial case
-		symbols->begin=(Symbol*)realloc(symbols->begin, n*sizeof(Symbol));
-		if(symbols->begin==NULL)
-			err("not enough memory");
-		symbols->end = symbols->begin+count;
-		symbols->after = symbols->begin+n;
-	}
-	SAFEALLOC(s,Symbol);
-	*symbols->end++ = s;
-	s->name = name;
-	s->cls = cls;
-	s->depth = crtDepth;
+    if (unit(ctx) && !quiet) {
+        printf("The syntax is correct!\n");
+    }
+    checkDomain(ctx, ctx->root);
+    if (opt->showLayout)
+        printLayout(ctx);
+    if (opt->showAst)
+        printNodes(ctx, ctx->root, 0);
+    if (opt->dumpFile)
+        dumpAst(ctx, opt->dumpFile);
+    if (quiet && (opt->regVm || opt->useJit || opt->asmFile || opt->exeFile)) {
+        ctx->useJit = opt->useJit;
+        genRegProgram(ctx);
+        if (opt->showCode)
+            printRegCode(ctx);
+        if (opt->asmFile || opt->exeFile) {
+            char *s = opt->asmFile;
+            if (s == NULL) {
+                if ((s = (char *)malloc(strlen(opt->exeFile) + 3)) == NULL)
+                    err("not enough memory");
+                sprintf(s, "%s.s", opt->exeFile);
+            }
+            genAsm(ctx, s);
+            if (opt->exeFile)
+                linkAsm(s, opt->exeFile);
+            if (s != opt->asmFile)
+                free(s);
+        }
+        if (opt->runProgram)
+            runRegCode(ctx);
+    } else if (quiet) {
+        genProgram(ctx);
+        if (opt->fuse)
+            fuseCode(ctx);
+        if (opt->showCode)
+            printCode(ctx);
+        if (opt->runProgram)
+            runCode(ctx);
+    }
 
-	return s;
+    if (opt->showStats)
+        printStats(ctx);
+
+    close(fd);
+    if (opt->useMmap)
+        unmap_file(myString, size);
+    else
+        free(myString);
+    freeContext(ctx);
+
+    return 0;
 }
 
 int main(int argc, char **argv) {
-    struct stat st;
-    int size;
     int fd;
+    Options options = {0}, *opt = &options;
+    char *filename = NULL;
+    char **filenames;
+    int nFilenames = 0;
+    int chooseVm = 0;
+    int i;
+    Context context, *ctx = &context;
 
-    if (argc != 2) {
-        printf("Usage: %s <filename>\n", argv[0]);
-        return -1;
-    }
+    opt->fuse = 1;
+    if ((filenames = (char **)malloc(argc * sizeof(char *))) == NULL)
+        err("not enough memory");
 
-    fd = open_file(argv[1]);
-    if (fd == -1) {
-        printf("Unable to open file\n");
-        return -1;
+    for (i = 1; i < argc; i++) {
+        if (!strcmp(argv[i], "-mmap"))
+            opt->useMmap = 1;
+        else if (!strcmp(argv[i], "-stats"))
+            opt->showStats = 1;
+        else if (!strcmp(argv[i], "-dfa"))
+            opt->useTable = 1;
+        else if (!strcmp(argv[i], "-lexbench"))
+            opt->benchLexers = 1;
+        else if (!strcmp(argv[i], "-nosimd"))
+            opt->scalarLexer = 1;
+        else if (!strcmp(argv[i], "-stream"))
+            opt->useStream = 1;
+        else if (!strcmp(argv[i], "-threads") && i + 1 < argc)
+            lexThreads = atoi(argv[++i]);
+        else if (!strcmp(argv[i], "-j") && i + 1 < argc)
+            opt->nJobThreads = atoi(argv[++i]);
+        else if (!strcmp(argv[i], "-ast"))
+            opt->showAst = 1;
+        else if (!strcmp(argv[i], "-dumpast") && i + 1 < argc)
+            opt->dumpFile = argv[++i];
+        else if (!strcmp(argv[i], "-loadast"))
+            opt->loadTree = 1;
+        else if (!strcmp(argv[i], "-layout"))
+            opt->showLayout = 1;
+        else if (!strcmp(argv[i], "-code"))
+            opt->showCode = 1;
+        else if (!strcmp(argv[i], "-run"))
+            opt->runProgram = 1;
+        else if (!strcmp(argv[i], "-nofuse"))
+            opt->fuse = 0;
+        else if (!strcmp(argv[i], "-vm") && i + 1 < argc && (!strcmp(argv[i + 1], "stack") || !strcmp(argv[i + 1], "reg"))) {
+            opt->regVm = !strcmp(argv[++i], "reg");
+            chooseVm = 1;
+        } else if (!strcmp(argv[i], "-jit"))
+            opt->useJit = opt->runProgram = 1; // -jit is a way to run the program
+        else if (!strcmp(argv[i], "-S") && i + 1 < argc)
+            opt->asmFile = argv[++i];
+        else if (!strcmp(argv[i], "-o") && i + 1 < argc)
+            opt->exeFile = argv[++i];
+        else
+            filenames[nFilenames++] = argv[i];
     }
-    
-
-    if (stat(argv[1], &st) == 0)
-        size = st.st_size;
-    else {
-        close(fd);
+    if (nFilenames == 0) {
+        printf("Usage: %s [-mmap] [-stats] [-dfa] [-lexbench] [-nosimd] [-stream] [-threads N] [-j N] [-ast] [-dumpast <file>] [-loadast] [-layout] [-code] [-run] [-nofuse] [-vm stack|reg] [-jit] [-S <file.s>] [-o <executable>] <filename>...\n", argv[0]);
         return -1;
     }
-
-    char *myString = (char *)malloc(size + 1);
-    if (myString == NULL) {
-        printf("Memory allocation error\n");
-        close(fd);
+    if (chooseVm && !opt->runProgram && !opt->showCode && !opt->asmFile && !opt->exeFile) {
+        printf("-vm needs -run or -code\n");
         return -1;
     }
+    // more lexer threads than processors would only add the cost of stitching
+    // the chunks; -lexbench keeps them, to check and time the parallel lexer
+    if (!opt->benchLexers && lexThreads > sysconf(_SC_NPROCESSORS_ONLN))
+        lexThreads = sysconf(_SC_NPROCESSORS_ONLN);
 
-    ssize_t last = read(fd, myString, size);
-    if (last <= 0) {
-        printf("Error reading file\n");
-        close(fd);
-        free(myString);
-        return -1;
+    if (nFilenames > 1 || opt->nJobThreads > 0) {
+        // only checks the syntax of each file
+        initLexKernels(opt->scalarLexer);
+        chunkLexer = opt->useTable ? getNextTokenTable : getNextToken;
+        i = compileFiles(filenames, nFilenames, opt->nJobThreads);
+        free(filenames);
+        return i ? 1 : 0;
     }
+    filename = filenames[0];
+    free(filenames);
 
-    myString[last] = '\0';
-
-    puts(myString);
-    getNextToken(myString);
-    Token *aux = tokens;
-    while (aux != NULL) {
-        // printf("Code %d ", aux->code);
-        if ((aux->code == ID))
-            printf("%d Identifier %s \n",aux->line, aux->text);
-        else if (aux->code == CT_CHAR)
-            printf("%d character %s\n", aux->line ,aux->text);
-        else if (aux->code == CT_STRING)
-            printf("%d string %s\n", aux->line, aux->text);
-        else if (aux->code == CT_INT)
-            printf("%d integer value %ld \n", aux->line, aux->i);
-        else if (aux->code == CT_REAL)
-            printf("%d float value %f \n", aux->line, aux->r);
-        aux = aux->next;
+    if (opt->loadTree) {
+        // the file is a tree written by -dumpast
+        initContext(ctx, NULL, stderr);
+        loadAst(ctx, filename);
+        if (opt->showAst)
+            printNodes(ctx, ctx->root, 0);
+        printf("Loaded %d nodes from the file '%s'\n", ctx->nNodes - 1, filename);
+        if (opt->showStats)
+            printStats(ctx);
+        freeContext(ctx);
+        return 0;
     }
 
-    printf("Read %zd bytes from the file '%s'\n", last, argv[1]);
-
-    if (unit()) {
-        printf("The syntax is correct!\n");
+    fd = open_file(filename);
+    if (fd == -1) {
+        printf("Unable to open file\n");
+        return -1;
     }
 
-    // initSymbols(&symbols);
-
-    close(fd);
-    free(myString);
-
-    return 0;
-}
\ No newline at end of file
+    initLexKernels(opt->scalarLexer);
+    initContext(ctx, NULL, stderr);
+    if (setjmp(ctx->onError))
+        return -1;
+    return compileInput(ctx, opt, fd, filename);
+}
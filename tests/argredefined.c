@@ -0,0 +1,11 @@
+int f(int a)
+{
+    int a;
+    a = 2;
+    return a;
+}
+
+void main()
+{
+    put_i(f(1));
+}
@@ -0,0 +1,9 @@
+int add(int a, int b)
+{
+    return a + b;
+}
+
+void main()
+{
+    put_i(add(1));
+}
@@ -0,0 +1,6 @@
+int v[(int)1e30];
+
+void main()
+{
+    put_i(1);
+}
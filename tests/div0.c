@@ -0,0 +1,13 @@
+int zero;
+
+int divide(int a, int b)
+{
+    return a / b;
+}
+
+void main()
+{
+    put_i(divide(7, 2));
+    put_i(divide(1, zero));
+    put_i(3);
+}
@@ -0,0 +1,13 @@
+int sign(int x)
+{
+    if (x > 0)
+        return 1;
+    if (x < 0)
+        return -1;
+}
+
+void main()
+{
+    put_i(sign(5));
+    put_i(sign(0));
+}
@@ -0,0 +1,79 @@
+struct Item
+{
+    int key;
+    char tag;
+    double weight;
+};
+
+struct Item items[50];
+int counts[10];
+
+int fib(int n)
+{
+    if (n < 2)
+        return n;
+    return fib(n - 1) + fib(n - 2);
+}
+
+double scale(double x, int k)
+{
+    return x * k / 4 - 0.5;
+}
+
+char next(char c)
+{
+    if (c == 'z')
+        return 'a';
+    return c + 1;
+}
+
+void fill(int i)
+{
+    items[i].key = (i * 37) / 7 - i * 5;
+    items[i].tag = next('a' + i - i / 26 * 26);
+    items[i].weight = scale(i, 3);
+    counts[i / 5] = counts[i / 5] + 1;
+}
+
+int sum(int v[], int n)
+{
+    int i, s;
+    s = 0;
+    for (i = 0; i < n; i = i + 1)
+        s = s + v[i];
+    return s;
+}
+
+void main()
+{
+    int i, keys, small;
+    double total;
+    char c;
+    for (i = 0; i < 50; i = i + 1)
+        fill(i);
+    keys = 0;
+    small = 0;
+    total = 0.0;
+    for (i = 0; i < 50; i = i + 1)
+    {
+        keys = keys + items[i].key;
+        if (items[i].weight < 10.0 && !(items[i].key > 0))
+            small = small + 1;
+        total = total + items[i].weight;
+    }
+    c = 'x';
+    for (i = 0; i < 200; i = i + 1)
+        c = next(c);
+    put_i(fib(20));
+    put_c(' ');
+    put_i(keys);
+    put_c(' ');
+    put_i(small);
+    put_c(' ');
+    put_d(total);
+    put_c(' ');
+    put_c(c);
+    put_c(' ');
+    put_i(sum(counts, 10));
+    put_c(10);
+}
@@ -0,0 +1,5 @@
+void main()
+{
+    int x;
+    x = 1 @ 2;
+}
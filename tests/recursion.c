@@ -0,0 +1,17 @@
+int depth(int n)
+{
+    if (n == 0)
+        return 0;
+    return 1 + depth(n - 1);
+}
+
+int forever(int n)
+{
+    return forever(n + 1);
+}
+
+void main()
+{
+    put_i(depth(10000));
+    put_i(forever(0));
+}
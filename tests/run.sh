@@ -0,0 +1,145 @@
+#!/bin/sh
+# Runs the samples and the programs of tests/ in each way CT can run them and
+# compares their output and exit code with tests/expected/<program>.out, then
+# checks the other modes of CT in the same way and that the switch, table and
+# parallel lexers produce the same tokens.
+#
+#     tests/run.sh [CT]
+#
+# Without an argument, CT.c is built in a temporary directory.
+
+cd "$(dirname "$0")/.." || exit 1
+tmp=$(mktemp -d) || exit 1
+trap 'rm -rf "$tmp"' EXIT
+if [ $# -gt 0 ]; then
+    ct=$1
+else
+    ct=$tmp/CT
+    cc -O2 -o "$ct" CT.c -pthread -lm || exit 1
+fi
+
+failed=0
+runs=0
+
+# check <expected> <label> <command>...: runs the command and compares its
+# output and exit code with tests/expected/<expected>.out; the paths of the
+# temporary files are left out of the output
+check()
+{
+    expected=tests/expected/$1.out
+    label=$2
+    shift 2
+    "$@" </dev/null >"$tmp/out" 2>&1
+    status=$?
+    sed "s|$tmp/||g" "$tmp/out" >"$tmp/actual"
+    printf '\n--- exit %d\n' $status >>"$tmp/actual"
+    runs=$((runs + 1))
+    if ! cmp -s "$expected" "$tmp/actual"; then
+        echo "FAIL: $label"
+        diff "$expected" "$tmp/actual" | head -10
+        failed=$((failed + 1))
+    fi
+}
+
+aot()
+{
+    "$ct" -o "$tmp/a.out" "$1" && "$tmp/a.out"
+}
+
+for program in [0-9].c tests/*.c; do
+    name=$(basename "$program" .c)
+    check "$name" "$program (run)" "$ct" -run "$program"
+    check "$name" "$program (nofuse)" "$ct" -run -nofuse "$program"
+    check "$name" "$program (reg)" "$ct" -run -vm reg "$program"
+    check "$name" "$program (jit)" "$ct" -run -jit "$program"
+    check "$name" "$program (aot)" aot "$program"
+done
+
+# an expression nested 6000 deep, run when the calls in progress have left
+# fewer free values on the stack of the operands: the stack machine checks
+# the depth which each function needs when it is entered
+{
+    printf 'int nested(int n)\n{\n    return '
+    i=0
+    while [ $i -lt 6000 ]; do
+        printf 'n + ('
+        i=$((i + 1))
+    done
+    printf 'n'
+    i=0
+    while [ $i -lt 6000 ]; do
+        printf ')'
+        i=$((i + 1))
+    done
+    printf ';\n}\n\n'
+    printf 'int pending(int k)\n{\n    if (k == 0)\n        return nested(0);\n'
+    printf '    return 1 + (1 + (1 + (1 + pending(k - 1))));\n}\n\n'
+    printf 'void main()\n{\n    put_i(pending(261000));\n}\n'
+} >"$tmp/deepexpr.c"
+check deepexpr "deepexpr (run)" "$ct" -run "$tmp/deepexpr.c"
+check deepexpr "deepexpr (nofuse)" "$ct" -run -nofuse "$tmp/deepexpr.c"
+check deepexpr.reg "deepexpr (reg)" "$ct" -run -vm reg "$tmp/deepexpr.c"
+check deepexpr.reg "deepexpr (jit)" "$ct" -run -jit "$tmp/deepexpr.c"
+check deepexpr.reg "deepexpr (aot)" aot "$tmp/deepexpr.c"
+
+# the lexers stop at the same error
+check lexbench.lexerror "-lexbench tests/lexerror.c" "$ct" -lexbench tests/lexerror.c
+check lexerror "-run -dfa tests/lexerror.c" "$ct" -run -dfa tests/lexerror.c
+
+# the members of nested structs and arrays are laid out with their alignment
+check layout "-run -layout" "$ct" -run -layout tests/structs.c
+
+# the tree printed by -ast is the one read back from -dumpast by -loadast
+check ast "-run -ast" "$ct" -run -ast 9.c
+loadast()
+{
+    "$ct" -run -dumpast "$tmp/9.ast" 9.c >/dev/null && "$ct" -loadast -ast "$tmp/9.ast"
+}
+check loadast "-dumpast, -loadast -ast" loadast
+
+# -stream reads the input in chunks of 64 KB
+i=0
+while [ $i -lt 100 ]; do
+    for program in [0-9].c; do
+        cat "$program"
+        echo
+    done
+    i=$((i + 1))
+done >"$tmp/samples.c"
+cat "$tmp/samples.c" tests/lexerror.c >"$tmp/lexerror.c"
+check stream "-stream" "$ct" -stream "$tmp/samples.c"
+check stream "-stream -dfa" "$ct" -stream -dfa "$tmp/samples.c"
+check stream.lexerror "-stream, with an error" "$ct" -stream "$tmp/lexerror.c"
+check stream.lexerror "-stream -dfa, with an error" "$ct" -stream -dfa "$tmp/lexerror.c"
+
+# over 1 MB, so that each of the 4 threads lexes a chunk
+i=0
+while [ $i -lt 7 ]; do
+    cat "$tmp/samples.c"
+    i=$((i + 1))
+done >"$tmp/big.c"
+"$ct" -lexbench -threads 4 "$tmp/big.c" >"$tmp/lex.out" 2>&1
+runs=$((runs + 1))
+if [ "$(grep -c "lexer produces the same" "$tmp/lex.out")" != 2 ]; then
+    echo "FAIL: -lexbench"
+    cat "$tmp/lex.out"
+    failed=$((failed + 1))
+fi
+
+# -j compiles several files in parallel, each in its own context
+check jobs "-j 2" "$ct" -j 2 [0-9].c tests/lexerror.c tests/undefined.c
+
+# an error in the first and in the last chunk of inputs lexed by 4 threads
+# each, checked for the memory which the threads still use after the error;
+# -lexbench keeps the 4 threads on fewer processors
+cat tests/lexerror.c "$tmp/big.c" >"$tmp/first.c"
+cat "$tmp/big.c" tests/lexerror.c >"$tmp/last.c"
+asan=$tmp/CT-asan
+if ! cc -g -O1 -fsanitize=address -o "$asan" CT.c -pthread -lm 2>/dev/null; then
+    echo "AddressSanitizer is not available, -threads 4 -j 2 is run without it"
+    asan=$ct
+fi
+check jobs.lexerror "-threads 4 -j 2" "$asan" -lexbench -threads 4 -j 2 "$tmp/first.c" "$tmp/last.c" 0.c
+
+echo "$((runs - failed)) of $runs checks passed"
+[ $failed -eq 0 ]
@@ -0,0 +1,45 @@
+struct Name
+{
+    char first;
+    char text[5];
+    char last;
+};
+
+struct Point
+{
+    char tag;
+    double x;
+    int y;
+};
+
+struct Shape
+{
+    struct Name name;
+    char kind;
+    struct Point points[3];
+    int n;
+};
+
+struct Shape shapes[2];
+
+void main()
+{
+    int i;
+    shapes[1].name.text[4] = 'z';
+    shapes[1].name.last = 'y';
+    shapes[1].kind = 'k';
+    for (i = 0; i < 3; i = i + 1)
+    {
+        shapes[1].points[i].tag = 'a' + i;
+        shapes[1].points[i].x = i / 2.0;
+        shapes[1].points[i].y = i * 10;
+    }
+    shapes[1].n = 3;
+    put_c(shapes[1].name.text[4]);
+    put_c(shapes[1].name.last);
+    put_c(shapes[1].kind);
+    put_c(shapes[1].points[2].tag);
+    put_d(shapes[1].points[1].x);
+    put_i(shapes[1].points[2].y + shapes[1].n);
+    put_c(10);
+}
@@ -0,0 +1,11 @@
+struct P
+{
+    int x;
+};
+
+void main()
+{
+    struct P p;
+    int i;
+    i = p;
+}
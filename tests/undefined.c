@@ -0,0 +1,5 @@
+void main()
+{
+    int x;
+    x = y + 1;
+}